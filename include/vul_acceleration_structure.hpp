@@ -33,6 +33,9 @@ class VulAs {
             uint32_t shaderBindingTableRecordOffset;
             glm::mat4 transform;
         };
+        // Nodes using EXT_mesh_gpu_instancing get one tlas instance per instance transform for every instance of the blas they're
+        // in. Those are added after instanceInfos and their custom index is the one of the blas instance plus the node's geometry
+        // index in that blas, so both kinds of hits find the node the same way
         void loadScene(const Scene &scene, const std::vector<AsNode> &nodes, const std::vector<InstanceInfo> &instanceInfos, bool allowUpdating, VulCmdPool &cmdPool);
         void loadAabbs(const std::vector<Aabb> &aabbs, const std::vector<InstanceInfo> &instanceInfos, bool allowUpdating, VulCmdPool &cmdPool);
 
@@ -65,6 +68,7 @@ class VulAs {
         As buildBlas(BlasBuildData &buildData, VkDeviceAddress scratchBufferAddress, VkQueryPool queryPool, uint32_t queryIndex, VkCommandBuffer cmdBuf);
 
         VkAccelerationStructureInstanceKHR blasToAsInstance(uint32_t index, uint32_t sbtOffset, const glm::mat4 &transform, const As &blas);
+        // Without a transforms buffer the geometry stays in the space of its mesh
         BlasInput gltfNodesToBlasInput(const Scene &scene, const std::vector<uint32_t> &orderedNodesIndices, uint32_t startIdx, uint32_t count, const std::unique_ptr<VulBuffer> &transformsBuffer);
         BlasInput aabbsToBlasInput(VulBuffer &aabbBuf, VkDeviceSize maxAabbCount, VkDeviceSize aabbOffset);
         std::unique_ptr<VulBuffer> createTransformsBuffer(const Scene &scene, const std::vector<uint32_t> &orderedNodesIndices);
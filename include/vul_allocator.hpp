@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace vul {
+
+// Sub-allocates device memory out of big blocks, so thousands of buffers and images only take a handful of vkAllocateMemory
+// calls and stay far below maxMemoryAllocationCount. Every block is managed with a two level segregated fit (TLSF) free list,
+// which finds a good fit and merges neighbouring free ranges in constant time.
+//
+// Buffers and linear images get their own blocks apart from optimal images, so neighbours never break
+// bufferImageGranularity. Allocations that take more than half a block together with their alignment get dedicated memory.
+// Host visible blocks are mapped for their whole life, since memory can only be mapped once, and allocations come with a
+// pointer to their part of it. Every function is thread safe.
+class VulAllocator {
+    public:
+        enum class ResourceType {
+            linear,
+            optimal
+        };
+        struct Block;
+        struct Range;
+        struct Allocation {
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            VkDeviceSize offset = 0;
+            VkDeviceSize size = 0;
+            // Start of the allocation for host visible memory, otherwise null
+            void *mapped = nullptr;
+            uint32_t memoryTypeIndex = 0;
+
+            Block *block = nullptr;
+            Range *range = nullptr;
+        };
+        struct Stats {
+            uint32_t blockCount = 0;
+            uint32_t allocationCount = 0;
+            uint32_t dedicatedAllocationCount = 0;
+            uint32_t freeRangeCount = 0;
+            VkDeviceSize blockBytes = 0;
+            VkDeviceSize usedBytes = 0;
+            VkDeviceSize dedicatedBytes = 0;
+            VkDeviceSize largestFreeRange = 0;
+
+            // 0 when all free space of the blocks is in one range, and closer to 1 the more it's split into small ranges
+            float getFragmentation() const
+            {
+                const VkDeviceSize freeBytes = blockBytes - usedBytes;
+                return freeBytes == 0 ? 0.0f : 1.0f - static_cast<float>(largestFreeRange) / static_cast<float>(freeBytes);
+            }
+        };
+
+        static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 256ull * 1024 * 1024;
+
+        VulAllocator(VkDevice device, VkPhysicalDevice physicalDevice, bool bufferDeviceAddress, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+        ~VulAllocator();
+
+        VulAllocator(const VulAllocator &) = delete;
+        VulAllocator &operator=(const VulAllocator &) = delete;
+        VulAllocator(VulAllocator &&) = delete;
+        VulAllocator &operator=(VulAllocator &&) = delete;
+
+        VkResult allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, ResourceType resourceType,
+                Allocation &outAllocation);
+        // Resets the allocation. Freeing an empty allocation does nothing
+        void free(Allocation &allocation);
+
+        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+        bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+        // True on integrated gpus, software renderers and cards with resizable BAR, where the gpu's own memory can be written
+        // by the cpu directly
+        bool hasHostVisibleDeviceLocalMemory() const {return hasMemoryType(~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);}
+        const VkPhysicalDeviceMemoryProperties &getMemoryProperties() const {return m_memoryProperties;}
+
+        Stats getStats() const;
+        Stats getStats(uint32_t memoryTypeIndex) const;
+
+    private:
+        struct Pool {
+            std::vector<std::unique_ptr<Block>> blocks;
+        };
+        struct DedicatedStats {
+            uint32_t allocationCount = 0;
+            VkDeviceSize bytes = 0;
+        };
+
+        VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const;
+        VkResult allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex, ResourceType resourceType, Allocation &outAllocation);
+        VkResult allocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, ResourceType resourceType, VkDeviceMemory &outMemory,
+                void *&outMapped) const;
+        void addStats(uint32_t memoryTypeIndex, Stats &stats) const;
+
+        VkDevice m_device;
+        bool m_bufferDeviceAddress;
+        VkDeviceSize m_blockSize;
+        VkPhysicalDeviceMemoryProperties m_memoryProperties{};
+
+        std::vector<std::array<Pool, 2>> m_pools;
+        std::vector<DedicatedStats> m_dedicatedStats;
+        mutable std::mutex m_mutex;
+};
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+namespace vul {
+
+// Compresses rgba half float texels into BC6H unsigned float blocks. The blocks of the whole image are 16 bytes each and laid
+// out row by row, and only the given block rows get written, so the rows can be split between threads. Alpha is dropped and
+// negative values are clamped to zero, since BC6H unsigned can't store them. Every block uses the single region mode with 10
+// bit endpoints, which is quick to search and holds up well on smooth content like environment maps. Texels past the edges
+// of images whose size isn't a multiple of 4 are clamped.
+// Bump whenever the compressed output changes, since it's part of the key of cached results
+constexpr uint32_t BC6H_ENCODER_VERSION = 1;
+
+void compressBc6hBlockRows(const uint16_t *rgbaHalfs, uint32_t width, uint32_t height, uint32_t firstBlockRow,
+        uint32_t blockRowCount, uint8_t *blocks);
+
+}
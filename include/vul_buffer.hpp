@@ -1,5 +1,6 @@
 #pragma once
 
+#include "vul_allocator.hpp"
 #include "vul_command_pool.hpp"
 #include"vul_device.hpp"
 
@@ -17,10 +18,19 @@ class VulBuffer {
 
         VulBuffer(const VulBuffer &) = delete;
         VulBuffer &operator=(const VulBuffer &) = delete;
-        VulBuffer(VulBuffer &&) = default;
+        // Leaves the moved from buffer empty, so that only one of the two destroys the buffer and frees its memory
+        VulBuffer(VulBuffer &&other) noexcept;
 
         VkResult createBuffer(uint32_t elementSize, uint32_t elementCount, bool isLocal, VkBufferUsageFlags usage);
-
+        // Dynamic local buffers live in memory that is both device local and host visible, which integrated gpus and cards with
+        // resizable BAR have, and stay mapped, so writes land in place without staging or copy commands. Without such memory
+        // they fall back to host visible memory and getMemoryPropertyFlags tells which one was used
+        VkResult createDynamicLocalBuffer(uint32_t elementSize, uint32_t elementCount, VkBufferUsageFlags usage);
+        static std::unique_ptr<VulBuffer> createDynamicLocal(uint32_t elementSize, uint32_t elementCount, VkBufferUsageFlags usage,
+                const VulDevice &vulDevice);
+
+        // Writes to device local buffers stage through the device's staging ring and copy in cmdBuf, so the data may be freed
+        // right after this returns
         VkResult writeData(const void *data, VkDeviceSize size, VkDeviceSize offset, VkCommandBuffer cmdBuf);
         template<typename T> VkResult writeVector(const std::vector<T> &vector, VkDeviceSize offset, VkCommandBuffer cmdBuf) {return writeData(vector.data(), sizeof(T) * vector.size(), sizeof(T) * offset, cmdBuf);}
         
@@ -44,23 +54,33 @@ class VulBuffer {
         template<typename T> VkResult resizeBufferWithVector(const std::vector<T> &vector, VkCommandBuffer commandBuffer) {return resizeBufferWithData(vector.data(), sizeof(T), static_cast<uint32_t>(vector.size()), commandBuffer);}
         VkResult resizeBufferAsEmpty(uint32_t elementSize, uint32_t elementCount) {return resizeBufferWithData(nullptr, elementSize, elementCount, VK_NULL_HANDLE);}
 
+        // The old buffer is kept alive until commandBuffer, which copies the contents over, has finished
         VkResult reallocElsewhere(bool isLocal, VkCommandBuffer commandBuffer);
 
+        // Appends only upload the new elements. When the capacity runs out it grows geometrically, and the old contents are
+        // copied to the new buffer on the gpu in commandBuffer, so getBuffer and getBufferAddress change and descriptors have to be
+        // updated. The old buffer is kept alive until commandBuffer has finished
+        VkResult appendData(const void *data, uint32_t elementCount, VkCommandBuffer commandBuffer);
+        template<typename T> VkResult appendVector(const std::vector<T> &vector, VkCommandBuffer commandBuffer) {return appendData(vector.data(), static_cast<uint32_t>(vector.size()), commandBuffer);}
+        VkResult appendEmpty(uint32_t elementCount, VkCommandBuffer commandBuffer) {return appendData(nullptr, elementCount, commandBuffer);}
         VkResult appendData(const void *data, uint32_t elementCount, VulCmdPool &cmdPool);
         template<typename T> VkResult appendVector(const std::vector<T> &vector, VulCmdPool &cmdPool) {return appendData(vector.data(), static_cast<uint32_t>(vector.size()), cmdPool);}
         VkResult appendEmpty(uint32_t elementCount, VulCmdPool &cmdPool) {return appendData(nullptr, elementCount, cmdPool);}
-
-        VkResult addStagingBuffer();
-        void deleteStagingBuffer() {m_stagingBuffer.reset(nullptr);}
+        // Host visible buffers can grow without a command buffer, but then the old buffer is destroyed right away
+        VkResult reserve(uint32_t elementCount, VkCommandBuffer commandBuffer);
 
         VkBuffer getBuffer() const { return m_buffer; }
-        VkDeviceMemory getMemory() const {return m_memory; }
-        bool hasStagingBuffer() const {return m_stagingBuffer.get() != nullptr;}
-        const std::unique_ptr<VulBuffer> &getStagingBuffer() const {return m_stagingBuffer;}
+        // The memory is shared with other resources, and the buffer starts at getMemoryOffset in it
+        VkDeviceMemory getMemory() const {return m_allocation.memory; }
+        VkDeviceSize getMemoryOffset() const {return m_allocation.offset; }
         void* getMappedMemory() const { return m_mapped; }
         VkBufferUsageFlags getUsageFlags() const { return m_usageFlags; }
         VkMemoryPropertyFlags getMemoryPropertyFlags() const { return m_memoryPropertyFlags; }
+        bool isDynamicLocal() const { return m_isDynamicLocal; }
+        // Size of the elements in the buffer, which can be less than the size of the VkBuffer after appends
         VkDeviceSize getBufferSize() const { return m_bufferSize; }
+        uint32_t getElementSize() const { return m_elementSize; }
+        VkDeviceSize getCapacitySize() const { return m_elementStride * m_capacityCount; }
 
         VkDescriptorBufferInfo getDescriptorInfo() const {return VkDescriptorBufferInfo{m_buffer, 0, m_bufferSize};}
         VkDeviceAddress getBufferAddress() const
@@ -69,19 +89,25 @@ class VulBuffer {
             return vkGetBufferDeviceAddress(m_vulDevice.device(), &addressInfo);
         }
     private:
+        VkResult initBuffer(uint32_t elementSize, uint32_t elementCount, bool isLocal, VkBufferUsageFlags usage);
+        VkResult allocateBuffer(VkDeviceSize size);
+
         const VulDevice &m_vulDevice; 
 
         uint32_t m_elementSize = 0;
         uint32_t m_elementCount = 0;
+        uint32_t m_capacityCount = 0;
+        VkDeviceSize m_elementStride = 0;
 
         void* m_mapped = nullptr;
+        VkDeviceSize m_mappedOffset = 0;
         VkBuffer m_buffer = VK_NULL_HANDLE;
-        VkDeviceMemory m_memory = VK_NULL_HANDLE;
-        std::unique_ptr<VulBuffer> m_stagingBuffer = nullptr;
+        VulAllocator::Allocation m_allocation;
 
         VkDeviceSize m_bufferSize;
         VkBufferUsageFlags m_usageFlags;
         VkMemoryPropertyFlags m_memoryPropertyFlags;
         bool m_isDeviceLocal;
+        bool m_isDynamicLocal = false;
 };
 }
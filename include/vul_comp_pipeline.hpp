@@ -22,6 +22,8 @@ class VulCompPipeline
         void begin(const std::vector<VkDescriptorSet> &sets);
         void dispatch(uint32_t x, uint32_t y, uint32_t z);
         void end(bool waitForSubmitToFinish);
+        // Records into the given command buffer instead of the pipeline's own, for work that sits between other work of a frame
+        void recordDispatch(VkCommandBuffer cmdBuf, const std::vector<VkDescriptorSet> &sets, uint32_t x, uint32_t y, uint32_t z);
 
         void *pPushData = nullptr;
         uint32_t pushSize = 0;
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stop_token>
+#include <vector>
+
+namespace vul {
+
+// Bounded queue that any number of worker threads push finished work into and consumer threads pop from. Consumers sleep
+// until something is pushed instead of polling, and popAll hands over everything that's ready at once so it can be
+// processed as one batch.
+template<typename T>
+class VulCompletionQueue {
+    public:
+        VulCompletionQueue(size_t capacity) : m_items(std::max(capacity, static_cast<size_t>(1))) {}
+
+        VulCompletionQueue(const VulCompletionQueue &) = delete;
+        VulCompletionQueue &operator=(const VulCompletionQueue &) = delete;
+        VulCompletionQueue(VulCompletionQueue &&) = delete;
+        VulCompletionQueue &operator=(VulCompletionQueue &&) = delete;
+
+        // Blocks while the queue is full. Returns false if stop was requested before there was room for the item
+        bool push(T item, std::stop_token stoken = {})
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                if (!m_notFull.wait(lock, stoken, [this]{return m_count < m_items.size();})) return false;
+                m_items[(m_head + m_count) % m_items.size()] = std::move(item);
+                m_count++;
+            }
+            m_notEmpty.notify_one();
+            return true;
+        }
+
+        // Blocks until there is at least one item and then moves every queued item to the end of outItems. Returns false if
+        // stop was requested before anything got queued
+        bool popAll(std::vector<T> &outItems, std::stop_token stoken = {})
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                if (!m_notEmpty.wait(lock, stoken, [this]{return m_count > 0;})) return false;
+                for (; m_count > 0; m_count--) {
+                    outItems.push_back(std::move(m_items[m_head]));
+                    m_head = (m_head + 1) % m_items.size();
+                }
+            }
+            m_notFull.notify_all();
+            return true;
+        }
+
+        // Blocks until there is an item and takes only that one, for when several consumers share the work. Returns false if
+        // stop was requested before anything got queued
+        bool pop(T &outItem, std::stop_token stoken = {})
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                if (!m_notEmpty.wait(lock, stoken, [this]{return m_count > 0;})) return false;
+                outItem = std::move(m_items[m_head]);
+                m_head = (m_head + 1) % m_items.size();
+                m_count--;
+            }
+            m_notFull.notify_one();
+            return true;
+        }
+
+        // Takes every queued item without blocking
+        void tryPopAll(std::vector<T> &outItems)
+        {
+            {
+                std::scoped_lock lock(m_mutex);
+                for (; m_count > 0; m_count--) {
+                    outItems.push_back(std::move(m_items[m_head]));
+                    m_head = (m_head + 1) % m_items.size();
+                }
+            }
+            m_notFull.notify_all();
+        }
+
+    private:
+        std::vector<T> m_items;
+        size_t m_head = 0;
+        size_t m_count = 0;
+
+        std::mutex m_mutex;
+        std::condition_variable_any m_notEmpty;
+        std::condition_variable_any m_notFull;
+};
+
+}
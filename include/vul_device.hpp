@@ -2,11 +2,15 @@
 
 #include"vul_window.hpp"
 
+#include <memory>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
 namespace vul {
 
+class VulAllocator;
+class VulStagingRing;
+
 class VulDevice {
     public:
 #ifdef NDEBUG
@@ -55,6 +59,10 @@ class VulDevice {
                 const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
         void waitForIdle() const {vkDeviceWaitIdle(device_);}
+        // Buffers and images allocate their memory through this
+        VulAllocator &getAllocator() const {return *m_allocator;}
+        // Uploads to device local memory stage through this
+        VulStagingRing &getStagingRing() const {return *m_stagingRing;}
 
         VkPhysicalDeviceProperties properties;
 
@@ -87,6 +95,9 @@ class VulDevice {
         std::vector<VkQueue> m_sideQueues;
 
         QueueFamilyIndices m_queueFamilyIndices;
+        bool m_bufferDeviceAddressEnabled = false;
+        std::unique_ptr<VulAllocator> m_allocator;
+        std::unique_ptr<VulStagingRing> m_stagingRing;
 
         const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
         std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
@@ -3,6 +3,7 @@
 #include "vul_command_pool.hpp"
 #include "vul_device.hpp"
 #include"vul_image.hpp"
+#include "vul_mapped_file.hpp"
 #include <atomic>
 #include <cstdint>
 #include <mutex>
@@ -92,6 +93,11 @@ class GltfLoader
             glm::vec3 position{0.0f};
             int primMesh = 0;
 
+            // Range in instanceTransforms when the node uses EXT_mesh_gpu_instancing. Instance count of 0 means the node
+            // isn't instanced and is drawn once with worldMatrix
+            uint32_t firstInstance = 0;
+            uint32_t instanceCount = 0;
+
             std::string name;
         };
         struct GltfLight{
@@ -114,6 +120,7 @@ class GltfLoader
 
         std::vector<GltfLight> lights;
         std::vector<GltfNode> nodes;
+        std::vector<glm::mat4> instanceTransforms;
         std::vector<GltfPrimMesh> primMeshes;
         std::vector<Material> materials;
         std::vector<std::shared_ptr<VulImage>> images;
@@ -124,34 +131,95 @@ class GltfLoader
             std::jthread asyncLoadingThread;
             std::mutex pauseMutex;
         };
+        struct ImageSource{
+            std::string uri;
+            VulImage::KtxCompressionFormat format{};
+        };
 
         void importMaterials();
         void importFullTexturesSync(const std::string &textureDirectory, const VulDevice &device, VulCmdPool &cmdPool);
+        // Loads the textures without their detailMipCount largest mips, for VulTextureResidency to stream those in. Unlike the
+        // full import the images aren't shared through VulTextureRegistry, since residency swaps their vk images
+        void importBaselineTextures(const std::string &textureDirectory, uint32_t detailMipCount, const VulDevice &device, VulCmdPool &cmdPool);
         std::unique_ptr<AsyncImageLoadingInfo> importPartialTexturesAsync(const std::string &textureDirectory, uint32_t asyncMipLoadCount, const VulDevice &device, VulCmdPool &transferPool, VulCmdPool &destinationPool);
         void importDrawableNodes(GltfAttributes requestedAttributes);
 
+        // The ktx file and the compression format of every glTF image, and the image every glTF texture points to. These are
+        // all the texture loading needs, so they can be stored and the textures loaded later without the glTF file
+        std::vector<ImageSource> getImageSources() const;
+        std::vector<int> getTextureSources() const;
+        static std::vector<std::shared_ptr<VulImage>> loadTextures(const std::vector<ImageSource> &imageSources, const std::vector<int> &textureSources,
+                std::string textureDirectory, uint32_t mipOffset, uint32_t threadCount, const VulDevice &device, VulCmdPool &cmdPool);
+
+        // The glTF file followed by every external buffer file it uses
+        std::vector<std::string> getSourceFiles() const;
+
     private:
-        void processMesh(const tinygltf::Primitive &mesh, GltfAttributes requestedAttributes, const std::string &name);
-        void processNode(int nodeIdx, const glm::vec3 &parentPos, const glm::quat &parentRot, const glm::vec3 &parentScale);
+        struct PrimImportJob{
+            int indexAccessor = -1;
+            int positionAccessor = -1;
+            int normalAccessor = -1;
+            int tangentAccessor = -1;
+            int uvAccessor = -1;
+            int colorAccessor = -1;
+            bool generateTangents = false;
+            int tangentNormalAccessor = -1;
+            int tangentUvAccessor = -1;
+            // Vertices reserved for the primitive. Bigger than its vertex count when generated tangents may split vertices
+            uint32_t vertexCapacity = 0;
+
+            // Index of the primitive whose vertices this one shares, or -1 if it has its own
+            int vertexSourcePrim = -1;
+            // Generated tangents remap the indices of the source primitive, so those get copied once it's done instead
+            bool copiesSourceIndices = false;
+            // Meshopt compressed buffer views the primitive reads from
+            std::vector<int> compressedViews;
+        };
+        // Decoded on first use and freed again once every primitive reading from it has been imported
+        struct DecodedBufferView{
+            std::mutex mutex;
+            std::vector<uint8_t> data;
+            std::atomic_uint32_t pendingPrims = 0;
+        };
 
-        void createTangents(size_t amount);
+        void processMesh(const PrimImportJob &job, GltfPrimMesh &primMesh);
+        void flattenNodeHierarchy(const std::vector<int> &rootNodes);
+        glm::mat4 getLocalMatrix(const tinygltf::Node &node) const;
+        void processNodes();
+        void appendInstanceTransforms(const tinygltf::Value &extension, const glm::mat4 &worldMatrix);
+
+        void computeBounds(GltfPrimMesh &primMesh, const tinygltf::Accessor &posAccessor) const;
+        void createTangents(const PrimImportJob &job, GltfPrimMesh &primMesh);
 
         void importTextures(std::string textureDirectory, uint32_t mipOffset, uint32_t threadCount, const VulDevice &device, VulCmdPool &cmdPool);
 
+        void findMeshoptBufferViews();
+        std::vector<uint8_t> decodeMeshoptBufferView(int bufferViewIdx) const;
+        void addCompressedViews(int accessorIdx, std::vector<int> &outViews) const;
+        void releaseDecodedBufferViews(const std::vector<int> &views);
+
         float getFloat(const tinygltf::Value &value, const std::string &name);
+        const uint8_t *getBufferViewData(int bufferViewIdx) const;
+        const uint8_t *getAccessorView(const tinygltf::Accessor &accessor, size_t elementSize, size_t &outStride) const;
 
+        template<typename Func>
+        void forEachSparseElement(const tinygltf::Accessor &accessor, size_t elementSize, Func func) const;
         template<class T>
         void copyAccessorData(  std::vector<T> &outData, size_t outFirstElement, 
                                 const tinygltf::Accessor &accessor, size_t accessorFirstElement, size_t numElementsToCopy);
         template<class T>
-        bool getAccessorData(const tinygltf::Accessor &accessor, std::vector<T> &attribVec);
-        template <typename T>
-        bool getAttribute(const tinygltf::Primitive &primitive, std::vector<T> &attribVec, const std::string &attribName);
+        void getAccessorData(const tinygltf::Accessor &accessor, std::vector<T> &attribVec, size_t outFirstElement, size_t elementCount);
 
         tinygltf::Model m_model;
+        std::vector<std::unique_ptr<VulMappedFile>> m_mappedFiles;
+        std::vector<const uint8_t *> m_bufferData;
+        std::vector<size_t> m_bufferSizes;
+        // Null for views that aren't compressed. Mutable, since reading a compressed view decodes it
+        mutable std::vector<std::unique_ptr<DecodedBufferView>> m_decodedBufferViews;
         
         std::unordered_map<int, std::vector<uint32_t>> m_meshToPrimMesh;
-        std::unordered_map<std::string, GltfPrimMesh> m_cachePrimMesh;
+        std::vector<int> m_flatNodes;
+        std::vector<int> m_flatNodeParents;
 };
 
 }
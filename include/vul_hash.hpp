@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vul {
+
+// 64 bit XXH64 hash. Fast enough to run over whole scene and texture files on every launch, so it's used for keying the
+// on-disk caches and for finding duplicate content
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+inline uint64_t hashCombine(uint64_t hash, uint64_t value)
+{
+    return hash ^ (value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2));
+}
+
+}
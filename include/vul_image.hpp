@@ -1,6 +1,8 @@
 #pragma once
 
+#include "vul_allocator.hpp"
 #include "vul_device.hpp"
+#include <atomic>
 #include <cassert>
 #include <ktx.h>
 #include <variant>
@@ -15,7 +17,7 @@ class VulSampler {
 
         VulSampler(const VulSampler &) = delete;
         VulSampler &operator=(const VulSampler &) = delete;
-        VulSampler(VulSampler &&) = default;
+        VulSampler(VulSampler &&other) noexcept;
 
         static std::shared_ptr<VulSampler> createDefaultTexSampler(const VulDevice &vulDevice);
         static std::shared_ptr<VulSampler> createCustomSampler(const VulDevice &vulDevice, VkFilter filter,
@@ -41,7 +43,8 @@ class VulImage {
 
         VulImage(const VulImage &) = delete;
         VulImage &operator=(const VulImage &) = delete;
-        VulImage(VulImage &&) = default;
+        // Leaves the moved from image without any vulkan objects or memory, so that only one of the two destroys them
+        VulImage(VulImage &&other) noexcept;
 
         enum class KtxCompressionFormat {
             uncompressedRgba32nonLinear,
@@ -85,6 +88,9 @@ class VulImage {
             uint32_t startingX;
             uint32_t startingY;
             uint32_t startingZ;
+            uint32_t width;
+            uint32_t height;
+            uint32_t depth;
             uint32_t mipLevel;
             uint32_t arrayLayer;
         };
@@ -96,10 +102,11 @@ class VulImage {
         };
         struct OldVkImageStuff {
             VkImage image = VK_NULL_HANDLE;
-            VkDeviceMemory imageMemory = VK_NULL_HANDLE;
+            VulAllocator::Allocation allocation;
             VkImageView imageView = VK_NULL_HANDLE;
             std::vector<VkImageView> mipImageViews;
             VkDevice device = VK_NULL_HANDLE;
+            VulAllocator *allocator = nullptr;
 
             void destoyImageStuff();
             ~OldVkImageStuff() {destoyImageStuff();}
@@ -115,7 +122,11 @@ class VulImage {
             VkExtent3D imageRegionSize;
             uint32_t arrayLayer;
             uint32_t mipLevel;
+            // Removes the memory from the region instead, and memoryIndex and blockOffset are ignored
+            bool unbind = false;
         };
+        // A compressed ktx load that's split into transcode tasks, see startCompressedKtxLoad
+        class KtxLoad;
 
         static std::unique_ptr<VulImage> createDefaultWholeImageAllInOne(const VulDevice &vulDevice, std::variant<std::string,
                 RawImageData> data, std::variant<KtxCompressionFormat, VkFormat> format, bool addSampler,
@@ -130,14 +141,34 @@ class VulImage {
                 VkImageTiling tiling, VkFilter filter, VkSamplerAddressMode addressMode, float maxAnisotropy,
                 VkBorderColor borderColor, float mipLodBias, float mipMinLod, float mipMaxLod, VkCommandBuffer cmdBuf);
 
+        // When set, the transcoded payloads of compressed ktx files are stored in this directory, keyed by the contents of the
+        // ktx file, the target format and the mip range, and later loads of the same texture skip transcoding entirely. BC6H
+        // cubemaps compressed from exr files are stored here as well. Empty disables the cache. Must not be changed while
+        // textures are being loaded
+        static void setKtxTranscodeCacheDirectory(const std::string &directory);
+        static const std::string &getKtxTranscodeCacheDirectory();
+
         void loadCompressedKtxFromFileWhole(const std::string &fileName, KtxCompressionFormat compressionFormat);
+        // With transcodeIntoStaging the transcoded data goes straight into a mapped staging buffer instead of the cpu data. It saves
+        // a copy and the memory of the cpu data, but the data is then only good for a single createCustomImage and can't be added to
+        // with addMipLevelsToStartFromCompressedKtxFile
         void loadCompressedKtxFromFile(const std::string &fileName, KtxCompressionFormat compressionFormat,
-                uint32_t inputMipLevel, uint32_t mipLevelCount);
+                uint32_t inputMipLevel, uint32_t mipLevelCount, bool transcodeIntoStaging = false);
         void addMipLevelsToStartFromCompressedKtxFile(const std::string &fileName,
                 KtxCompressionFormat compressionFormat, uint32_t mipLevelCount);
+        // Like loadCompressedKtxFromFile, except that a big UASTC file going to a block compressed format only gets laid out
+        // here, and is returned as tasks over bands of block rows for several threads to transcode. Returns nullptr when the
+        // image got loaded right away instead. The image must not be used until the last task has run
+        std::unique_ptr<KtxLoad> startCompressedKtxLoad(const std::string &fileName, KtxCompressionFormat compressionFormat,
+                uint32_t inputMipLevel, uint32_t mipLevelCount, bool transcodeIntoStaging = false);
+        // The same for addMipLevelsToStartFromCompressedKtxFile
+        std::unique_ptr<KtxLoad> startAddingMipLevelsFromCompressedKtxFile(const std::string &fileName,
+                KtxCompressionFormat compressionFormat, uint32_t mipLevelCount);
 
         void loadUncompressedFromFile(const std::string &fileName);
-        void loadCubemapFromEXR(const std::string &filename);
+        // The faces are decoded in parallel. With compressToBc6h the cubemap is stored as BC6H, which takes an eighth of the
+        // memory, and the compressed result is kept in the transcode cache directory if one is set
+        void loadCubemapFromEXR(const std::string &filename, bool compressToBc6h = false);
 
         void loadRegularRaw2d8bitRgbaFromMemory(const void *data, uint32_t width, uint32_t height);
         void loadRegularRaw2d32bitRgbaFromMemory(const void *data, uint32_t width, uint32_t height);
@@ -147,6 +178,8 @@ class VulImage {
         void keepRegularRaw2d8bitRgbaEmpty(uint32_t width, uint32_t height);
         void keepRegularRaw2d32bitRgbaEmpty(uint32_t width, uint32_t height);
         void keepEmpty(uint32_t baseWidth, uint32_t baseHeight, uint32_t baseDepth, uint32_t mipCount, uint32_t arrayCount, VkFormat format);
+        // Like keepEmpty but without the cpu side copy, for sparse images that are too big to ever be in memory at once
+        void keepEmptyWithoutData(uint32_t baseWidth, uint32_t baseHeight, uint32_t baseDepth, uint32_t mipCount, uint32_t arrayCount, VkFormat format);
 
         std::unique_ptr<OldVkImageStuff> createDefaultImage(ImageType type, VkCommandBuffer cmdBuf);
         std::unique_ptr<OldVkImageStuff> createCustomImage(VkImageViewType type, VkImageLayout layout, VkImageUsageFlags usage,
@@ -154,21 +187,43 @@ class VulImage {
         std::unique_ptr<OldVkImageStuff> createCustomImageSparse(VkImageViewType type, VkImageLayout layout, VkImageUsageFlags usage,
                 VkMemoryPropertyFlags memoryProperties, VkImageAspectFlags aspect, VkCommandBuffer cmdBuf);
         void allocateSparseMemory(const std::vector<uint32_t> &blockCounts);
-        void bindSparseMemory(const std::vector<SparseBindInfo> &bindInfos);
+        // Without a semaphore the queue is waited on before and after binding. With one nothing is waited on, and the semaphore
+        // is signaled once the binds are done instead. The caller then has to make sure that nothing on the gpu still uses the
+        // regions that get rebound, and that whatever uses the new binds waits on the semaphore
+        void bindSparseMemory(const std::vector<SparseBindInfo> &bindInfos, VkSemaphore signalSemaphore = VK_NULL_HANDLE);
+        // Binds the mip tail of every layer, which can't be bound by region, to consecutive blocks starting from blockOffset.
+        // Needs getSparseMipTailBlockCount blocks
+        void bindSparseMipTail(uint32_t memoryIndex, uint32_t blockOffset);
 
         void createFromVkImage(VkImage image, VkImageViewType type, VkFormat format, VkImageAspectFlags aspect,
                 uint32_t mipLevelCount, uint32_t arrayLayerCount);
 
+        // Blits every mip from the one above it, with a barrier between each level. Mip 0 has to be written before and the image
+        // format has to support linear blits. For images that are re-mipped every frame VulMipChainGenerator does it in one dispatch
         void createMipMaps(VkCommandBuffer cmdBuf);
+        // Does nothing if the views already exist
         void createImageViewsForMipMaps();
 
+        // Copies the sections through a staging buffer, which has to be kept until cmdBuf has finished executing
         void modifyImage(const std::vector<DataSection> &modificationSections, VkCommandBuffer cmdBuf);
         void readImage(std::vector<DataSection> &readSections, VkCommandBuffer cmdBuf);
 
         void transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, VkCommandBuffer cmdBuf);
+        // Transitions from the current layout with the given stages and accesses, for uses that the fixed ones of
+        // transitionImageLayout don't cover, like compute writes
+        void transitionImageLayoutWithStages(VkImageLayout newLayout, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+                VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkCommandBuffer cmdBuf);
         void transitionQueueFamily(uint32_t srcFamilyIdx, uint32_t dstFamilyIdx, VkPipelineStageFlags accessMask, VkCommandBuffer cmdBuf);
-
-        void deleteStagingResources() {m_stagingBuffer.reset(nullptr);}
+        // Makes the barrier of transitionImageLayoutWithStages without recording it, for recording many in one call. The image
+        // counts as being in the new layout right away
+        VkImageMemoryBarrier makeLayoutTransitionBarrier(VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess);
+
+        void deleteStagingResources() {m_stagingBuffer.reset(nullptr); m_stagingBufferHasData = false;}
+        // For keeping the staging buffer of an upload alive until the gpu is done with it, while the image itself moves on
+        std::unique_ptr<VulBuffer> releaseStagingResources() {m_stagingBufferHasData = false; return std::move(m_stagingBuffer);}
+        // Moves over what another image loaded, so the loading can happen on another image while this one is still in use. The
+        // vk image of this one stays as is until the next createCustomImage
+        void takeLoadedData(VulImage &&other);
         void deleteCpuData() {m_data.resize(0);}
 
         VkRenderingAttachmentInfo getAttachmentInfo(VkClearValue clearValue) const;
@@ -183,9 +238,17 @@ class VulImage {
         uint32_t getArrayCount() const {return m_arrayLayersCount;}
         uint32_t getBitsPerTexel() const {return m_bitsPerTexel;}
         size_t getDataSize() const {return m_data.size();}
+        size_t getMipLayerSize(uint32_t mip) const {return m_mipLevels[mip].layerSize;}
+        uint8_t *getCpuData(uint32_t mip, uint32_t layer) {return m_mipLevels[mip].containsData[layer] ? &m_data[m_mipLevels[mip].layers[layer]] : nullptr;}
         VkExtent3D getSparseBlockExtent() const {return m_sparseBlockExtent;}
         size_t getSparseMemoryCount() const {return m_sparseMemoryRegions.size();}
         uint32_t getSparseMemoryBlockCount(uint32_t memoryIndex) const {return m_sparseMemoryRegions[memoryIndex].blockCount;}
+        VkDeviceSize getSparseBlockSize() const {return m_blockSize;}
+        // Mips starting from this one are in the mip tail. It's at least the mip count if there is no mip tail
+        uint32_t getSparseMipTailFirstLod() const {return m_sparseMipTailFirstLod;}
+        uint32_t getSparseMipTailBlockCount() const;
+
+        static VkFormat getKtxVkFormat(KtxCompressionFormat compressionFormat) {return getKtxCompressionFormatProperties(compressionFormat).vkFormat;}
 
         VkFormat getFormat() const {return m_format;}
         VkMemoryPropertyFlags getMemoryProperties() const {return m_memoryProperties;}
@@ -199,7 +262,9 @@ class VulImage {
         VkImage getImage() const {return m_image;}
         VkImageView getImageView() const {return m_imageView;}
         VkImageView getImageViewForMipLevel(uint32_t mipLevel) const {assert(m_mipImageViews.size() > mipLevel); return m_mipImageViews[mipLevel];}
-        VkDeviceMemory getMemory() const {return m_imageMemory;}
+        // The memory is shared with other resources, and the image starts at getMemoryOffset in it
+        VkDeviceMemory getMemory() const {return m_allocation.memory;}
+        VkDeviceSize getMemoryOffset() const {return m_allocation.offset;}
         
         std::shared_ptr<VulSampler> vulSampler = nullptr;
         bool attachmentPreservePreviousContents = false;
@@ -230,9 +295,21 @@ class VulImage {
         VkImageView createImageView(uint32_t baseMipLevel, uint32_t mipLevelCount);
         void copyBufferToImage(VkBuffer buffer, VkDeviceSize offset, uint32_t mipLevel, VkCommandBuffer cmdBuf);
 
+        std::unique_ptr<KtxLoad> loadOrSplitCompressedKtx(const std::string &fileName, KtxCompressionFormat compressionFormat,
+                uint32_t inputMipLevel, uint32_t mipLevelCount, bool transcodeIntoStaging, bool allowSplit);
+        std::unique_ptr<KtxLoad> addOrSplitMipLevelsFromCompressedKtx(const std::string &fileName,
+                KtxCompressionFormat compressionFormat, uint32_t mipLevelCount, bool allowSplit);
+        void appendOldMipLevels(const std::vector<uint8_t> &oldData, std::vector<MipLevel> &oldMipLevels);
+
+        size_t setMipLayout(uint32_t baseWidth, uint32_t baseHeight, uint32_t baseDepth, uint32_t mipCount, uint32_t arrayCount, VkFormat format);
+        uint8_t *allocateTexelStorage(size_t size, bool inStaging);
+
+        bool loadFromKtxTranscodeCache(const std::string &cacheFile, VkFormat format, bool intoStaging);
+        void writeKtxTranscodeCache(const std::string &cacheFile, const std::vector<const uint8_t *> &mipData) const;
+
         uint32_t alignUp(uint32_t alignee, uint32_t aligner);
 
-        KtxCompressionFormatProperties getKtxCompressionFormatProperties(KtxCompressionFormat compressionFormat);
+        static KtxCompressionFormatProperties getKtxCompressionFormatProperties(KtxCompressionFormat compressionFormat);
         VkFormatProperties getVkFormatProperties(VkFormat format);
 
         bool m_ownsImage = false;
@@ -254,15 +331,57 @@ class VulImage {
         uint32_t m_baseDepth = 0;
         VkExtent3D m_sparseBlockExtent{};
         VkDeviceSize m_blockSize = 0;
+        uint32_t m_sparseMipTailFirstLod = 0;
+        VkDeviceSize m_sparseMipTailSize = 0;
+        VkDeviceSize m_sparseMipTailOffset = 0;
+        VkDeviceSize m_sparseMipTailStride = 0;
+        bool m_sparseSingleMipTail = false;
         std::unique_ptr<VulBuffer> m_stagingBuffer;
+        bool m_stagingBufferHasData = false;
 
         VkImage m_image = VK_NULL_HANDLE;
         VkImageView m_imageView = VK_NULL_HANDLE;
         std::vector<VkImageView> m_mipImageViews;
-        VkDeviceMemory m_imageMemory = VK_NULL_HANDLE;
+        VulAllocator::Allocation m_allocation;
         std::vector<SparseMemory> m_sparseMemoryRegions;
 
         const VulDevice &m_vulDevice;
 };
 
+class VulImage::KtxLoad {
+    public:
+        ~KtxLoad();
+
+        KtxLoad(const KtxLoad &) = delete;
+        KtxLoad &operator=(const KtxLoad &) = delete;
+
+        uint32_t getTaskCount() const {return m_tasks.size();}
+        // Tasks can run on any thread in any order, each one once. Returns true for the task that completed the image
+        bool runTask(uint32_t taskIdx);
+    private:
+        struct Task {
+            uint32_t mipLevel;
+            uint32_t layer;
+            uint32_t firstBlockRow;
+            uint32_t blockRowCount;
+        };
+
+        KtxLoad(VulImage &image) : m_image{image} {}
+        void finish();
+
+        VulImage &m_image;
+        ktxTexture2 *m_texture = nullptr;
+        ktx_transcode_fmt_e m_transcodeFormat;
+        uint32_t m_outputBlockSize = 0;
+        uint8_t *m_dst = nullptr;
+        std::string m_cacheFile;
+        std::vector<Task> m_tasks;
+        std::atomic_uint32_t m_remainingTaskCount{0};
+        // What the image had before addMipLevelsToStart, which goes after the new mips once they're done
+        std::vector<uint8_t> m_oldData;
+        std::vector<MipLevel> m_oldMipLevels;
+
+        friend class VulImage;
+};
+
 }
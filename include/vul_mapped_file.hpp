@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace vul {
+
+class VulMappedFile {
+    public:
+        VulMappedFile(const std::string &fileName);
+        ~VulMappedFile();
+
+        VulMappedFile(const VulMappedFile &) = delete;
+        VulMappedFile &operator=(const VulMappedFile &) = delete;
+        VulMappedFile(VulMappedFile &&) = delete;
+        VulMappedFile &operator=(VulMappedFile &&) = delete;
+
+        const uint8_t *getData() const {return m_data;}
+        size_t getSize() const {return m_size;}
+        const std::string &getFileName() const {return m_fileName;}
+
+    private:
+        const uint8_t *m_data = nullptr;
+        size_t m_size = 0;
+        std::string m_fileName;
+};
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "vul_buffer.hpp"
+#include "vul_comp_pipeline.hpp"
+#include "vul_descriptors.hpp"
+#include "vul_device.hpp"
+#include "vul_image.hpp"
+
+#include <memory>
+#include <string>
+
+namespace vul {
+
+// Builds the whole mip chain of a 2D image from its mip 0 in a single compute dispatch, with one barrier before and one after
+// instead of one per level like VulImage::createMipMaps. Meant for render targets that get re-mipped every frame, like hi-z
+// depth pyramids and bloom chains. The image needs sampled and storage usage, a format that can be stored to without a format
+// qualifier, at most 4096 texels per side and at most 13 mips.
+//
+// Min and max reduction only cover every texel of the mip above for power of two sizes, since odd rows and columns get
+// dropped like they do with blits. Depth formats can't be storage images, so hi-z pyramids need the depth copied to mip 0 of
+// an R32_SFLOAT image first.
+class VulMipChainGenerator {
+    public:
+        enum class Reduction {
+            average,
+            min,
+            max
+        };
+
+        VulMipChainGenerator(VulImage &image, Reduction reduction, const VulDescriptorPool &descPool, const VulDevice &vulDevice,
+                const std::string &shaderFile = "../bin/vulMipChain.comp.spv");
+
+        VulMipChainGenerator(const VulMipChainGenerator &) = delete;
+        VulMipChainGenerator &operator=(const VulMipChainGenerator &) = delete;
+
+        // Mip 0 has to be written before cmdBuf gets to this, and the image is left in finalLayout
+        void generate(VkCommandBuffer cmdBuf, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        Reduction getReduction() const {return m_reduction;}
+
+    private:
+        struct PushConstant {
+            uint32_t mipCount;
+            uint32_t reduction;
+            uint32_t groupCount;
+        };
+
+        // Matches the shader, which can write this many mips below mip 0 and keeps mip 6 in the intermediate buffer
+        static constexpr uint32_t MAX_WRITTEN_MIP_COUNT = 12;
+        static constexpr uint32_t MAX_SIDE_LENGTH = 4096;
+        static constexpr uint32_t TILE_SIDE_LENGTH = 64;
+        static constexpr uint32_t INTERMEDIATE_BUFFER_SIZE = 16 + 64 * 64 * 16;
+
+        VulImage &m_image;
+        Reduction m_reduction;
+        uint32_t m_groupCountX = 0;
+        uint32_t m_groupCountY = 0;
+        bool m_counterCleared = false;
+
+        std::shared_ptr<VulSampler> m_sampler;
+        std::unique_ptr<VulBuffer> m_intermediateBuffer;
+        std::unique_ptr<VulDescriptorSet> m_descriptorSet;
+        std::unique_ptr<VulCompPipeline> m_pipeline;
+
+        const VulDevice &m_vulDevice;
+};
+
+}
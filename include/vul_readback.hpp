@@ -0,0 +1,87 @@
+#pragma once
+
+#include "vul_buffer.hpp"
+#include "vul_device.hpp"
+#include "vul_image.hpp"
+#include "vul_swap_chain.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace vul {
+
+// Reads buffers and images back to the cpu without stalling. The copies are recorded into the command buffer of the frame
+// that asks for them and land in a persistently mapped ring with a slot per frame in flight. Once the fence of that frame has
+// been waited on, which VulRenderer::beginFrame does, resolve hands the data over, so results arrive MAX_FRAMES_IN_FLIGHT
+// frames later and nothing ever waits for the gpu to drain.
+//
+// The ring lives in host cached memory when the device has it, since reads from uncached memory are slow, and is invalidated
+// before resolving when that memory isn't coherent.
+//
+// The copies see everything recorded before them. Futures can be waited on from any thread, but they are only fulfilled by
+// resolve, and callbacks run inside it and get pointers straight into the ring that are only valid during the call.
+class VulReadback {
+    public:
+        using Callback = std::function<void(const void *data, VkDeviceSize size)>;
+        struct ImageRegion {
+            VkOffset3D offset;
+            VkExtent3D extent;
+            uint32_t mipLevel;
+            uint32_t arrayLayer;
+        };
+
+        VulReadback(VkDeviceSize bytesPerFrame, const VulDevice &vulDevice);
+        ~VulReadback();
+
+        VulReadback(const VulReadback &) = delete;
+        VulReadback &operator=(const VulReadback &) = delete;
+
+        void readBuffer(const VulBuffer &buffer, VkDeviceSize size, VkDeviceSize offset, uint32_t frameIndex, VkCommandBuffer cmdBuf,
+                Callback callback);
+        std::future<std::vector<uint8_t>> readBuffer(const VulBuffer &buffer, VkDeviceSize size, VkDeviceSize offset, uint32_t frameIndex,
+                VkCommandBuffer cmdBuf);
+        // The image is transitioned for the copy and back to its current layout. Only uncompressed color formats are supported,
+        // and the data is tightly packed
+        void readImage(VulImage &image, const ImageRegion &region, uint32_t frameIndex, VkCommandBuffer cmdBuf, Callback callback);
+        std::future<std::vector<uint8_t>> readImage(VulImage &image, const ImageRegion &region, uint32_t frameIndex, VkCommandBuffer cmdBuf);
+
+        // Call with the index of a frame whose fence has just been waited on, before anything new is read in that frame
+        void resolve(uint32_t frameIndex);
+
+        VkDeviceSize getBytesPerFrame() const {return m_bytesPerFrame;}
+        VkDeviceSize getUsedBytes(uint32_t frameIndex) const {return m_frames[frameIndex].usedBytes;}
+
+    private:
+        struct PendingRead {
+            VkDeviceSize ringOffset;
+            VkDeviceSize size;
+            Callback callback;
+        };
+        struct Frame {
+            VkDeviceSize usedBytes = 0;
+            std::vector<PendingRead> pendingReads;
+        };
+
+        // Enough for the texel size of every uncompressed format, which image copies need their buffer offsets aligned to
+        static constexpr VkDeviceSize RING_ALIGNMENT = 16;
+
+        VkDeviceSize reserve(VkDeviceSize size, uint32_t frameIndex);
+        static std::pair<std::future<std::vector<uint8_t>>, Callback> makeFutureCallback();
+        static void recordMemoryBarrier(VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage,
+                VkAccessFlags dstAccess, VkCommandBuffer cmdBuf);
+
+        VkDeviceSize m_bytesPerFrame;
+        VkBuffer m_ring = VK_NULL_HANDLE;
+        VulAllocator::Allocation m_ringAllocation;
+        bool m_isRingCoherent = true;
+        std::array<Frame, VulSwapChain::MAX_FRAMES_IN_FLIGHT> m_frames;
+
+        const VulDevice &m_vulDevice;
+};
+
+}
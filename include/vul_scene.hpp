@@ -4,6 +4,7 @@
 #ifdef __cplusplus
 #include <cstdint>
 #include <memory>
+#include <span>
 
 #include"vul_gltf_loader.hpp"
 #include"vul_buffer.hpp"
@@ -49,12 +50,16 @@ class Scene
         void loadCubes(const std::vector<Cube> &cubes, const std::vector<GltfLoader::Material> &mats, WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
         void loadSpheres(const std::vector<Sphere> &spheres, const std::vector<GltfLoader::Material> &mats, WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
         void loadPlanes(const std::vector<Plane> &planes, const std::vector<GltfLoader::Material> &mats, WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
-        void loadSceneSync(const std::string &fileName, const std::string &textureDir, WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
+        // If cacheFile isn't empty, the scene is loaded from it when it's up to date with fileName, and otherwise the scene is loaded
+        // from fileName and baked into cacheFile for the next launch
+        void loadSceneSync(const std::string &fileName, const std::string &textureDir, WantedBuffers wantedBuffers, VulCmdPool &cmdPool,
+                const std::string &cacheFile = "");
         std::unique_ptr<GltfLoader::AsyncImageLoadingInfo> loadSceneAsync(const std::string &fileName, const std::string &textureDir,
                 uint32_t asyncMipLoadCount, WantedBuffers wantedBuffers, VulCmdPool &mainCmdPool, VulCmdPool &transferCmdPool, VulCmdPool &destinationCmdPool);
 
         std::vector<GltfLoader::GltfLight> lights;
         std::vector<GltfLoader::GltfNode> nodes;
+        std::vector<glm::mat4> instanceTransforms;
         std::vector<GltfLoader::GltfPrimMesh> meshes;
         std::vector<GltfLoader::Material> materials;
         std::vector<std::shared_ptr<vul::VulImage>> images;
@@ -72,6 +77,8 @@ class Scene
         std::unique_ptr<VulBuffer> indexBuffer;
         std::unique_ptr<VulBuffer> materialBuffer;
         std::unique_ptr<VulBuffer> primInfoBuffer;
+        // Created whenever a loaded scene has EXT_mesh_gpu_instancing nodes, since they can't be drawn without it
+        std::unique_ptr<VulBuffer> instanceTransformBuffer;
 
         using vec2 = glm::vec2;
         using vec3 = glm::vec3;
@@ -99,7 +106,7 @@ class Scene
             uint firstIndex;
             uint vertexOffset;
             int materialIndex;
-            int padding;
+            int firstInstance; // Index into the instance transform buffer, or -1 if the node isn't instanced
         };
 
         #ifdef __cplusplus
@@ -108,10 +115,14 @@ class Scene
         const VulDevice &m_vulDevice; 
 
         void moveGltfStuffToScene(GltfLoader &gltfLoader, WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
-        void createBuffers(const std::vector<uint32_t> &lIndices, const std::vector<glm::vec3> &lVertices,
-                const std::vector<glm::vec3> &lNormals, const std::vector<glm::vec4> &lTangents, const std::vector<glm::vec2> &lUvs,
+        void moveLoadedStuffToScene(std::span<const uint32_t> lIndices, std::span<const glm::vec3> lVertices, std::span<const glm::vec3> lNormals,
+                std::span<const glm::vec4> lTangents, std::span<const glm::vec2> lUvs, std::span<const glm::mat4> lInstanceTransforms,
+                std::vector<GltfLoader::GltfPrimMesh> &lMeshes, std::vector<GltfLoader::GltfNode> &lNodes, std::vector<GltfLoader::Material> &lMaterials,
+                const std::vector<GltfLoader::GltfLight> &lLights, const std::vector<std::shared_ptr<VulImage>> &lImages, WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
+        void createBuffers(std::span<const uint32_t> lIndices, std::span<const glm::vec3> lVertices,
+                std::span<const glm::vec3> lNormals, std::span<const glm::vec4> lTangents, std::span<const glm::vec2> lUvs,
                 const std::vector<GltfLoader::Material> &mats, const std::vector<GltfLoader::GltfNode> &nods,
-                WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
+                std::span<const glm::mat4> lInstanceTransforms, WantedBuffers wantedBuffers, VulCmdPool &cmdPool);
 };
 
 }
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "vul_gltf_loader.hpp"
+#include "vul_mapped_file.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace vul {
+
+// Baked copy of everything Scene::loadSceneSync produces from a glTF file. The geometry arrays are stored as is in page
+// aligned sections, so a warm start only has to map the file and upload them instead of parsing the json and decoding
+// every accessor again. The cache is keyed by the hash of the glTF json and the size and last write time of the buffer
+// files, so a buffer rewritten with its old size and time kept isn't noticed. It doesn't contain textures, only where to
+// load them from.
+class VulSceneCache {
+    public:
+        static constexpr uint32_t VERSION = 1;
+
+        // Returns nullptr if the cache file doesn't exist, was made by another version, is out of date with the source files or is
+        // truncated or corrupted, in which case the caller rebuilds the scene and writes over it
+        static std::unique_ptr<VulSceneCache> open(const std::string &cacheFile, const std::string &sourceFile);
+        // Has to be called before the loader's contents are moved into a scene, since moving offsets the indices in place
+        static void write(const std::string &cacheFile, const GltfLoader &gltfLoader);
+
+        std::span<const uint32_t> indices;
+        std::span<const glm::vec3> vertices;
+        std::span<const glm::vec3> normals;
+        std::span<const glm::vec4> tangents;
+        std::span<const glm::vec2> uvs;
+        std::span<const glm::mat4> instanceTransforms;
+
+        std::vector<GltfLoader::GltfPrimMesh> meshes;
+        std::vector<GltfLoader::GltfNode> nodes;
+        std::vector<GltfLoader::Material> materials;
+        std::vector<GltfLoader::GltfLight> lights;
+        std::vector<GltfLoader::ImageSource> imageSources;
+        std::vector<int> textureSources;
+
+    private:
+        VulSceneCache(std::unique_ptr<VulMappedFile> mappedFile);
+        // Returns false if a section or anything pointing into one is out of bounds
+        bool readSections();
+
+        // The spans point into this, so it has to stay mapped for as long as the cache is alive
+        std::unique_ptr<VulMappedFile> m_mappedFile;
+};
+
+}
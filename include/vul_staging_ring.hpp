@@ -0,0 +1,98 @@
+#pragma once
+
+#include "vul_allocator.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vulkan/vulkan_core.h>
+
+namespace vul {
+
+// One persistently mapped host visible buffer that every upload to device local memory stages through, so host memory used
+// for uploads is bounded by the size of the ring instead of growing with the scene. Staging space is taken in the order it's
+// asked for and handed back once the command buffer that used it has finished, which the ring learns from the fence that
+// command buffer was submitted with. VulCmdPool and VulSwapChain report their submits on their own, anything else that submits
+// a command buffer with staged copies has to call onSubmit. Space staged into a command buffer that is never submitted is
+// never handed back.
+//
+// When the ring is full it waits for the oldest submitted work, and if that isn't enough, or the upload is bigger than the
+// whole ring, the data gets a temporary buffer of its own that is freed the same way. Every function is thread safe.
+class VulStagingRing {
+    public:
+        struct Allocation {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceSize offset = 0;
+            void *mapped = nullptr;
+        };
+
+        static constexpr VkDeviceSize DEFAULT_SIZE = 64ull * 1024 * 1024;
+        // Satisfies the texel size and optimalBufferCopyOffsetAlignment of everything that isn't block compressed
+        static constexpr VkDeviceSize DEFAULT_ALIGNMENT = 16;
+
+        VulStagingRing(VkDevice device, VulAllocator &allocator, VkDeviceSize size = DEFAULT_SIZE);
+        ~VulStagingRing();
+
+        VulStagingRing(const VulStagingRing &) = delete;
+        VulStagingRing &operator=(const VulStagingRing &) = delete;
+        VulStagingRing(VulStagingRing &&) = delete;
+        VulStagingRing &operator=(VulStagingRing &&) = delete;
+
+        // The space stays valid until cmdBuf has finished executing after its submit
+        Allocation allocate(VkDeviceSize size, VkDeviceSize alignment, VkCommandBuffer cmdBuf);
+        // Like allocate, but the space is only handed back once cmdBuf has finished and release was called, for copies from the
+        // device that get read on the host after the submit. Otherwise another thread could retire and reuse the space in between
+        Allocation allocateForReadback(VkDeviceSize size, VkDeviceSize alignment, VkCommandBuffer cmdBuf);
+        void release(const Allocation &allocation);
+        // Destroys the buffer and frees its memory once cmdBuf has finished executing, for resources that recorded commands
+        // still read from
+        void destroyAfterUse(VkBuffer buffer, VulAllocator::Allocation &allocation, VkCommandBuffer cmdBuf);
+
+        // Call right after vkQueueSubmit with the fence the command buffer was submitted with
+        void onSubmit(VkCommandBuffer cmdBuf, VkFence fence);
+        // Hands back the space of all finished work. Allocate does this on its own
+        void retire();
+
+        VkDeviceSize getSize() const {return m_size;}
+        VkDeviceSize getUsedBytes() const;
+
+    private:
+        struct Entry {
+            VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+            VkDeviceSize start = 0;
+            VkDeviceSize end = 0;
+            // Bytes of the ring taken including alignment padding and the unused tail skipped when wrapping around
+            VkDeviceSize consumedBytes = 0;
+            bool complete = false;
+            bool awaitsRelease = false;
+
+            // Set for uploads that didn't fit and for buffers passed to destroyAfterUse
+            VkBuffer ownedBuffer = VK_NULL_HANDLE;
+            VulAllocator::Allocation ownedAllocation;
+        };
+
+        Allocation allocateEntry(VkDeviceSize size, VkDeviceSize alignment, VkCommandBuffer cmdBuf, bool awaitsRelease);
+        bool tryReserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &outOffset, VkDeviceSize &outConsumedBytes);
+        void pollFences();
+        void popCompleted();
+        // Waits for the oldest submitted entry, returns false if the oldest entry hasn't been submitted or released yet
+        bool waitForOldest();
+        VkResult createBuffer(VkDeviceSize size, VkBuffer &outBuffer, VulAllocator::Allocation &outAllocation) const;
+        void releaseEntry(Entry &entry);
+
+        VkDevice m_device;
+        VulAllocator &m_allocator;
+        VkDeviceSize m_size;
+
+        VkBuffer m_buffer = VK_NULL_HANDLE;
+        VulAllocator::Allocation m_allocation;
+
+        VkDeviceSize m_head = 0;
+        VkDeviceSize m_tail = 0;
+        VkDeviceSize m_usedBytes = 0;
+        std::deque<Entry> m_entries;
+        mutable std::mutex m_mutex;
+};
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vul_device.hpp"
+#include "vul_image.hpp"
+
+#include <cstdint>
+#include <memory>
+
+namespace vul {
+
+// Process wide lookup of fully loaded textures by their contents, so byte identical ktx files used by different materials,
+// scenes or meshlet scenes share one VulImage and one copy in VRAM. Only weak references are kept, so a texture is freed
+// as soon as nothing else uses it.
+class VulTextureRegistry {
+    public:
+        struct Key {
+            uint64_t contentHash = 0;
+            VulImage::KtxCompressionFormat format{};
+            const VulDevice *device = nullptr;
+
+            bool operator==(const Key &other) const = default;
+        };
+
+        // Returns nullptr if no live texture matches the key
+        static std::shared_ptr<VulImage> find(const Key &key);
+        // The image has to be fully uploaded by the time it's added, since anyone finding it will use it right away
+        static void add(const Key &key, const std::shared_ptr<VulImage> &image);
+        // Whether the image can be handed out by find, in which case other users may hold it too
+        static bool contains(const VulImage *image);
+};
+
+}
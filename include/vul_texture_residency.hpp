@@ -0,0 +1,102 @@
+#pragma once
+
+#include "vul_completion_queue.hpp"
+#include "vul_device.hpp"
+#include "vul_image.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace vul {
+
+// Keeps the detail mips of ktx textures in VRAM only while they are being used. Every texture has a baseline, which is
+// everything but its detailMipCount largest mips and which always stays resident. Each frame the user marks the textures
+// it drew with and calls update. Used textures get their detail mips streamed in by priority for as long as they fit in
+// the budget, and when the budget is exceeded the least recently used ones get evicted back to the baseline.
+class VulTextureResidency {
+    public:
+        VulTextureResidency(uint64_t vramBudget, uint32_t detailMipCount, uint32_t threadCount, const VulDevice &vulDevice);
+        ~VulTextureResidency();
+
+        VulTextureResidency(const VulTextureResidency &) = delete;
+        VulTextureResidency &operator=(const VulTextureResidency &) = delete;
+        VulTextureResidency(VulTextureResidency &&) = delete;
+        VulTextureResidency &operator=(VulTextureResidency &&) = delete;
+
+        // The images must be loaded from compressed ktx files with their file path as the name. Set isFullyLoaded to false if
+        // they were loaded with the detail mips left out, like GltfLoader::importBaselineTextures does. Returns the texture
+        // index of every image, and images that are already registered keep their old index.
+        // Streaming swaps the vk image, which only the caller of update learns about, so images shared through
+        // VulTextureRegistry are refused. Neither may the images be streamed by GltfLoader::importPartialTexturesAsync, which
+        // adds the same mips on its own
+        std::vector<uint32_t> registerTextures(const std::vector<std::shared_ptr<VulImage>> &images, bool isFullyLoaded);
+
+        void markUsed(uint32_t textureIdx, uint64_t frame);
+
+        // Records the uploads of finished streaming work into cmdBuf, frees images the gpu is done with and starts new streaming
+        // work. cmdBuf should be the command buffer of the frame, and the textures can be sampled by commands recorded after the
+        // update. Returns the textures whose image views changed, and their descriptors must be updated before they're used
+        std::vector<uint32_t> update(uint64_t frame, VkCommandBuffer cmdBuf);
+
+        void setVramBudget(uint64_t vramBudget) {m_vramBudget = vramBudget;}
+        uint64_t getVramBudget() const {return m_vramBudget;}
+        // Bytes the textures take once every started streaming job has finished
+        uint64_t getCommittedBytes() const {return m_committedBytes;}
+
+        // Textures used within this many frames count as hot. Hot textures are streamed in and never evicted
+        uint64_t hotFrameCount = 8;
+
+    private:
+        struct Texture {
+            std::shared_ptr<VulImage> image;
+            VulImage::KtxCompressionFormat format{};
+            uint64_t fullBytes = 0;
+            uint64_t baselineBytes = 0;
+            uint64_t lastUsedFrame = 0;
+            bool wantsDetail = false;
+            bool hasDetail = false;
+            bool isPending = false;
+        };
+        struct Job {
+            uint32_t textureIdx = 0;
+            bool loadDetail = false;
+            std::string fileName;
+            VulImage::KtxCompressionFormat format{};
+            // Loaded by the worker, since the texture's own image may be in use by the gpu, and moved into it by update
+            std::unique_ptr<VulImage> loadedImage;
+            std::exception_ptr error;
+        };
+        struct RetiredImage {
+            uint64_t frame = 0;
+            std::unique_ptr<VulImage::OldVkImageStuff> oldVkImageStuff;
+            std::unique_ptr<VulBuffer> stagingBuffer;
+        };
+
+        static constexpr uint32_t MAX_PENDING_JOBS = 64;
+
+        static uint64_t calculateImageBytes(uint32_t width, uint32_t height, uint32_t depth, uint32_t mipCount, uint32_t layerCount, uint32_t bitsPerTexel);
+        bool isHot(const Texture &texture, uint64_t frame) const;
+        void startJob(uint32_t textureIdx, bool loadDetail);
+
+        std::vector<Texture> m_textures;
+        std::unordered_map<const VulImage *, uint32_t> m_textureIndices;
+        uint64_t m_vramBudget;
+        uint32_t m_detailMipCount;
+        uint64_t m_committedBytes = 0;
+        uint32_t m_pendingJobCount = 0;
+
+        std::unique_ptr<VulCompletionQueue<Job>> m_jobQueue;
+        std::unique_ptr<VulCompletionQueue<Job>> m_finishedJobs;
+        std::vector<std::jthread> m_workers;
+        std::deque<RetiredImage> m_retiredImages;
+
+        const VulDevice &m_vulDevice;
+};
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "vul_buffer.hpp"
+#include "vul_command_pool.hpp"
+#include "vul_device.hpp"
+#include "vul_image.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace vul {
+
+// Collects many buffer and image writes and records them together. The data is staged through the staging ring in chunks of
+// at most the ring's size, every destination gets one copy command per chunk with a region per write, and the images are
+// transitioned for the copies and everything is made visible with one barrier before and one after all of them. Buffer writes
+// bigger than the ring are split up, an image write bigger than the ring gets a temporary staging buffer of its own.
+//
+// Nothing is read from the data pointers before record, so they have to stay valid until then. Writes to host visible
+// buffers, dynamic local ones included, are done right away and need no recording. Destinations must not be used by commands
+// recorded before record without a barrier of their own.
+class VulUploadBatch {
+    public:
+        struct ImageRegion {
+            VkOffset3D offset;
+            VkExtent3D extent;
+            uint32_t mipLevel;
+            uint32_t arrayLayer;
+        };
+
+        VulUploadBatch(const VulDevice &vulDevice);
+
+        VulUploadBatch(const VulUploadBatch &) = delete;
+        VulUploadBatch &operator=(const VulUploadBatch &) = delete;
+
+        void writeBuffer(VulBuffer &buffer, const void *data, VkDeviceSize size, VkDeviceSize offset);
+        template<typename T> void writeVector(VulBuffer &buffer, const std::vector<T> &vector, VkDeviceSize offset) {writeBuffer(buffer, vector.data(), sizeof(T) * vector.size(), sizeof(T) * offset);}
+        // Grows the buffer with appendEmpty in cmdBuf and writes the data after the old elements
+        void appendBuffer(VulBuffer &buffer, const void *data, uint32_t elementCount, VkCommandBuffer cmdBuf);
+        // The data is tightly packed, so size is the byte size of the region in the format of the image, which also works for
+        // block compressed formats. Every write to the same image must ask for the same final layout
+        void writeImage(VulImage &image, const ImageRegion &region, const void *data, VkDeviceSize size, VkImageLayout finalLayout);
+
+        // Records everything collected so far into cmdBuf and empties the batch. The staging space is handed back once cmdBuf
+        // has finished, so all chunks are in use at the same time and batches bigger than the ring need temporary staging
+        // buffers. Meant for small batches such as per frame updates
+        void record(VkCommandBuffer cmdBuf);
+        // Same, but every full chunk is submitted to cmdPool and recording goes on in a new command buffer from it, so the ring
+        // can reuse the space of earlier chunks and staging memory stays bounded by the ring no matter how big the batch is.
+        // cmdBuf is replaced by the command buffer the last chunk is recorded into, which the caller still has to submit
+        void record(VkCommandBuffer &cmdBuf, VulCmdPool &cmdPool);
+
+        bool isEmpty() const {return m_bufferDestinations.empty() && m_imageDestinations.empty();}
+        VkDeviceSize getStagedBytes() const {return m_stagedBytes;}
+
+    private:
+        struct Write {
+            const void *data;
+            VkDeviceSize size;
+            // Offset in the staged data of the whole batch
+            VkDeviceSize stagingOffset;
+            bool toImage;
+            size_t destinationIndex;
+            size_t regionIndex;
+        };
+        struct BufferDestination {
+            VulBuffer *buffer;
+            std::vector<VkBufferCopy> regions;
+        };
+        struct ImageDestination {
+            VulImage *image;
+            VkImageLayout finalLayout;
+            std::vector<VkBufferImageCopy> regions;
+        };
+
+        VkDeviceSize stage(const void *data, VkDeviceSize size, bool toImage, size_t destinationIndex, size_t regionIndex);
+        void recordChunks(VkCommandBuffer &cmdBuf, VulCmdPool *cmdPool);
+        void recordChunk(size_t firstWrite, size_t writeCount, VkCommandBuffer cmdBuf);
+
+        std::vector<Write> m_writes;
+        std::vector<BufferDestination> m_bufferDestinations;
+        std::vector<ImageDestination> m_imageDestinations;
+        std::unordered_map<const VulBuffer *, size_t> m_bufferDestinationIndices;
+        std::unordered_map<const VulImage *, size_t> m_imageDestinationIndices;
+        VkDeviceSize m_stagedBytes = 0;
+
+        const VulDevice &m_vulDevice;
+};
+
+}
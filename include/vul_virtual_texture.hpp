@@ -0,0 +1,151 @@
+#pragma once
+
+#include "vul_buffer.hpp"
+#include "vul_command_pool.hpp"
+#include "vul_completion_queue.hpp"
+#include "vul_device.hpp"
+#include "vul_image.hpp"
+#include "vul_swap_chain.hpp"
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace vul {
+
+// Texture array that is far bigger than VRAM, backed by a sparse image whose pages are bound to a fixed size physical pool
+// on demand. The texture is stored pre-tiled on disk as one compressed ktx file per page, named
+// "<layer>_<mip>_<pageX>_<pageY>.ktx2", where a page is as big as the sparse block extent of the format. Mips in the mip tail
+// are stored as a single page each, and they are loaded at creation and stay resident.
+//
+// Shaders find out what they need through the feedback buffer of the frame and sample through the min lod map:
+// - Feedback buffer: a uint counter followed by FEEDBACK_CAPACITY uint page indices. Shaders atomically add to the counter and
+//   write the index of a page they would have liked to sample there, and they should only do it for a fraction of their pixels.
+//   The index of page (layer, mip, x, y) is getMipPageOffset(mip) + (layer * getPageCountY(mip) + y) * getPageCountX(mip) + x.
+// - Min lod map: one byte per mip 0 page, at index (layer * getPageCountY(0) + y) * getPageCountX(0) + x, packed four to a
+//   uint. It holds the finest resident mip of that area, and sampling with the lod clamped to it only ever touches resident
+//   pages, since a page is only made resident after the page above it.
+// After the last pass that writes the feedback of a frame, recordFeedbackBarrier has to be recorded into that frame's command
+// buffer, so that the writes are visible when update reads them on the host.
+//
+// Every frame the user calls update with the index of the frame whose fence it just waited on, which reads back that frame's
+// feedback, uploads the pages that finished transcoding in one batch of sparse binds and starts transcoding the new requests.
+// Nothing in update waits for the gpu. The binds signal a semaphore that the upload waits on, and the upload has to be on the
+// main queue, since its staging memory is freed once the fence of a later frame has signaled. An evicted page keeps its memory
+// until the frames in flight at the time are done, as they can still sample it.
+class VulVirtualTexture {
+    public:
+        static constexpr uint32_t FEEDBACK_CAPACITY = 16384;
+
+        VulVirtualTexture(const std::string &tileDirectory, VulImage::KtxCompressionFormat compressionFormat, uint32_t width,
+                uint32_t height, uint32_t layerCount, uint32_t physicalPageCount, uint32_t threadCount, const VulDevice &vulDevice,
+                VulCmdPool &cmdPool);
+        ~VulVirtualTexture();
+
+        VulVirtualTexture(const VulVirtualTexture &) = delete;
+        VulVirtualTexture &operator=(const VulVirtualTexture &) = delete;
+        VulVirtualTexture(VulVirtualTexture &&) = delete;
+        VulVirtualTexture &operator=(VulVirtualTexture &&) = delete;
+
+        void update(uint32_t frameIndex, uint64_t frame, VulCmdPool &cmdPool);
+        // Makes the shader writes to the feedback buffer of the frame visible to the host
+        void recordFeedbackBarrier(VkCommandBuffer cmdBuf, uint32_t frameIndex) const;
+
+        const VulImage &getImage() const {return *m_image;}
+        VkDescriptorImageInfo getDescriptorInfo() const {return m_image->getDescriptorInfo();}
+        VkDescriptorBufferInfo getFeedbackDescriptorInfo(uint32_t frameIndex) const {return m_feedbackBuffers[frameIndex]->getDescriptorInfo();}
+        VkDescriptorBufferInfo getMinLodMapDescriptorInfo() const {return m_minLodMapBuffer->getDescriptorInfo();}
+
+        VkExtent3D getPageExtent() const {return m_pageExtent;}
+        // Mips starting from this one are in the always resident mip tail
+        uint32_t getPagedMipCount() const {return m_pagedMipCount;}
+        uint32_t getMipPageOffset(uint32_t mip) const {return m_mips[mip].pageOffset;}
+        uint32_t getPageCountX(uint32_t mip) const {return m_mips[mip].pageCountX;}
+        uint32_t getPageCountY(uint32_t mip) const {return m_mips[mip].pageCountY;}
+        uint32_t getResidentPageCount() const {return m_residentPages.size();}
+        uint32_t getPhysicalPageCount() const {return m_physicalPages.size();}
+
+    private:
+        struct Page {
+            uint32_t layer = 0;
+            uint32_t mip = 0;
+            uint32_t x = 0;
+            uint32_t y = 0;
+        };
+        struct Mip {
+            uint32_t pageOffset = 0;
+            uint32_t pageCountX = 0;
+            uint32_t pageCountY = 0;
+        };
+        struct PhysicalPage {
+            uint32_t pageIdx = UINT32_MAX;
+            uint64_t lastUsedFrame = 0;
+        };
+        struct RetiringPage {
+            uint32_t physicalIdx = 0;
+            uint32_t pageIdx = 0;
+            uint64_t evictedFrame = 0;
+        };
+        struct Job {
+            uint32_t pageIdx = 0;
+            Page page;
+            std::unique_ptr<VulImage> tile;
+            std::exception_ptr error;
+        };
+
+        static constexpr uint32_t MAX_PENDING_JOBS = 64;
+
+        uint32_t getPageIdx(const Page &page) const {return m_mips[page.mip].pageOffset + (page.layer * m_mips[page.mip].pageCountY + page.y) * m_mips[page.mip].pageCountX + page.x;}
+        Page getPage(uint32_t pageIdx) const;
+        std::string getTileFileName(const Page &page) const;
+        VulImage::SparseBindInfo getBindInfo(const Page &page, uint32_t physicalIdx, bool unbind) const;
+        VulImage::DataSection getDataSection(const Page &page, VulImage &tile) const;
+
+        bool isResident(const Page &page) const;
+        bool isPending(const Page &page) const;
+        bool hasResidentOrPendingChildren(const Page &page) const;
+        void loadMipTail(uint32_t threadCount, VulCmdPool &cmdPool);
+        void requestPages(uint32_t frameIndex, uint64_t frame);
+        void uploadFinishedPages(uint32_t frameIndex, uint64_t frame, VulCmdPool &cmdPool);
+        void evictPages(size_t count, uint64_t frame);
+        void updateMinLodMap(const Page &page);
+        void uploadMinLodMap(VkCommandBuffer cmdBuf);
+
+        std::string m_tileDirectory;
+        VulImage::KtxCompressionFormat m_compressionFormat;
+        std::unique_ptr<VulImage> m_image;
+        VkExtent3D m_pageExtent{};
+        uint32_t m_pagedMipCount = 0;
+        std::vector<Mip> m_mips;
+        uint32_t m_pageCount = 0;
+
+        std::vector<PhysicalPage> m_physicalPages;
+        std::vector<uint32_t> m_freePhysicalPages;
+        std::unordered_map<uint32_t, uint32_t> m_residentPages;
+        std::unordered_set<uint32_t> m_pendingPages;
+        std::vector<RetiringPage> m_retiringPages;
+        // Transcoded pages that are waiting for a retiring physical page
+        std::vector<Job> m_waitingJobs;
+        std::array<VkSemaphore, VulSwapChain::MAX_FRAMES_IN_FLIGHT> m_bindSemaphores{};
+        std::array<std::unique_ptr<VulBuffer>, VulSwapChain::MAX_FRAMES_IN_FLIGHT> m_uploadStagingBuffers;
+
+        std::array<std::unique_ptr<VulBuffer>, VulSwapChain::MAX_FRAMES_IN_FLIGHT> m_feedbackBuffers;
+        std::vector<uint8_t> m_minLodMap;
+        std::unique_ptr<VulBuffer> m_minLodMapBuffer;
+        size_t m_minLodMapDirtyBegin = SIZE_MAX;
+        size_t m_minLodMapDirtyEnd = 0;
+
+        std::unique_ptr<VulCompletionQueue<Job>> m_jobQueue;
+        std::unique_ptr<VulCompletionQueue<Job>> m_finishedJobs;
+        std::vector<std::jthread> m_workers;
+
+        const VulDevice &m_vulDevice;
+};
+
+}
@@ -0,0 +1,126 @@
+#include "vul_gltf_loader.hpp"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Every primitive is its own grid with its own accessors, so nothing gets shared between them and the loader has to decode
+// and bound each one. The positions have no min and max, which makes the loader compute the bounds from the vertices
+constexpr uint32_t GRID_SIDE = 8;
+constexpr uint32_t VERTS_PER_PRIM = GRID_SIDE * GRID_SIDE;
+constexpr uint32_t INDICES_PER_PRIM = (GRID_SIDE - 1) * (GRID_SIDE - 1) * 6;
+
+void writeSyntheticScene(const std::string &fileName, uint32_t primCount)
+{
+    std::vector<uint8_t> bin;
+    const auto append = [&bin](const void *data, size_t size) {
+        const size_t offset = bin.size();
+        bin.resize(offset + size);
+        memcpy(bin.data() + offset, data, size);
+        return offset;
+    };
+
+    nlohmann::json bufferViews = nlohmann::json::array();
+    nlohmann::json accessors = nlohmann::json::array();
+    nlohmann::json meshes = nlohmann::json::array();
+    nlohmann::json nodes = nlohmann::json::array();
+    nlohmann::json sceneNodes = nlohmann::json::array();
+    const auto addAccessor = [&](const void *data, size_t size, uint32_t count, uint32_t componentType, const std::string &type) {
+        bufferViews.push_back({{"buffer", 0}, {"byteOffset", append(data, size)}, {"byteLength", size}});
+        accessors.push_back({{"bufferView", bufferViews.size() - 1}, {"componentType", componentType}, {"count", count}, {"type", type}});
+        return accessors.size() - 1;
+    };
+
+    std::vector<float> positions(VERTS_PER_PRIM * 3);
+    std::vector<float> normals(VERTS_PER_PRIM * 3);
+    std::vector<float> uvs(VERTS_PER_PRIM * 2);
+    std::vector<uint32_t> indices;
+    for (uint32_t y = 0; y + 1 < GRID_SIDE; y++) for (uint32_t x = 0; x + 1 < GRID_SIDE; x++) {
+        const uint32_t corner = y * GRID_SIDE + x;
+        indices.insert(indices.end(), {corner, corner + GRID_SIDE, corner + 1, corner + 1, corner + GRID_SIDE, corner + GRID_SIDE + 1});
+    }
+    for (uint32_t i = 0; i < primCount; i++) {
+        for (uint32_t v = 0; v < VERTS_PER_PRIM; v++) {
+            const float u = static_cast<float>(v % GRID_SIDE) / (GRID_SIDE - 1);
+            const float w = static_cast<float>(v / GRID_SIDE) / (GRID_SIDE - 1);
+            positions[v * 3] = static_cast<float>(i % 256) + u;
+            positions[v * 3 + 1] = 0.0f;
+            positions[v * 3 + 2] = static_cast<float>(i / 256) + w;
+            normals[v * 3] = 0.0f;
+            normals[v * 3 + 1] = 1.0f;
+            normals[v * 3 + 2] = 0.0f;
+            uvs[v * 2] = u;
+            uvs[v * 2 + 1] = w;
+        }
+        const size_t positionAccessor = addAccessor(positions.data(), positions.size() * sizeof(float), VERTS_PER_PRIM, 5126, "VEC3");
+        const size_t normalAccessor = addAccessor(normals.data(), normals.size() * sizeof(float), VERTS_PER_PRIM, 5126, "VEC3");
+        const size_t uvAccessor = addAccessor(uvs.data(), uvs.size() * sizeof(float), VERTS_PER_PRIM, 5126, "VEC2");
+        const size_t indexAccessor = addAccessor(indices.data(), indices.size() * sizeof(uint32_t), INDICES_PER_PRIM, 5125, "SCALAR");
+
+        nlohmann::json primitive = {{"attributes", {{"POSITION", positionAccessor}, {"NORMAL", normalAccessor}, {"TEXCOORD_0", uvAccessor}}},
+                {"indices", indexAccessor}, {"mode", 4}};
+        meshes.push_back({{"primitives", nlohmann::json::array({primitive})}});
+        nodes.push_back({{"mesh", i}});
+        sceneNodes.push_back(i);
+    }
+
+    const std::filesystem::path binPath = std::filesystem::path(fileName).replace_extension(".bin");
+    nlohmann::json gltf = {
+        {"asset", {{"version", "2.0"}}},
+        {"scene", 0},
+        {"scenes", nlohmann::json::array({{{"nodes", sceneNodes}}})},
+        {"nodes", nodes},
+        {"meshes", meshes},
+        {"accessors", accessors},
+        {"bufferViews", bufferViews},
+        {"buffers", nlohmann::json::array({{{"uri", binPath.filename().string()}, {"byteLength", bin.size()}}})}
+    };
+
+    std::ofstream binFile(binPath, std::ios::binary | std::ios::trunc);
+    binFile.write(reinterpret_cast<const char *>(bin.data()), bin.size());
+    std::ofstream gltfFile(fileName, std::ios::trunc);
+    gltfFile << gltf.dump();
+    if (!binFile.good() || !gltfFile.good()) throw std::runtime_error("Failed to write synthetic scene: " + fileName);
+}
+
+// Imports scenes of N synthetic primitives the same way Scene::loadSceneSync does, textures aside, and prints the import time
+// against N. The time per primitive should stay flat as N grows
+int main(int argc, char **argv) {
+    const uint32_t maxPrimCount = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 65536;
+    const uint32_t repeatCount = 3;
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "vulLoaderBenchmark";
+    std::filesystem::create_directories(directory);
+
+    std::cout << "primitives, import ms, us per primitive\n";
+    for (uint32_t primCount = 1024; primCount <= maxPrimCount; primCount *= 2) {
+        const std::string fileName = (directory / ("scene" + std::to_string(primCount) + ".gltf")).string();
+        writeSyntheticScene(fileName, primCount);
+
+        // The best of a few runs, so that the first run paying for cold page cache doesn't skew the curve
+        double bestSeconds = std::numeric_limits<double>::max();
+        for (uint32_t i = 0; i < repeatCount; i++) {
+            const auto start = std::chrono::steady_clock::now();
+            vul::GltfLoader gltfLoader(fileName);
+            gltfLoader.importMaterials();
+            gltfLoader.importDrawableNodes(vul::GltfLoader::gltfAttribOr(vul::GltfLoader::gltfAttribOr(vul::GltfLoader::GltfAttributes::Normal,
+                            vul::GltfLoader::GltfAttributes::Tangent), vul::GltfLoader::GltfAttributes::TexCoord));
+            const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+            bestSeconds = std::min(bestSeconds, duration.count());
+            if (gltfLoader.primMeshes.size() != primCount) throw std::runtime_error("Loader imported the wrong amount of primitives");
+        }
+        std::cout << primCount << ", " << bestSeconds * 1000.0 << ", " << bestSeconds * 1000000.0 / primCount << "\n";
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
@@ -47,7 +47,7 @@ MeshResources createMeshShadingResources(const vul::VulRenderer &vulRenderer, co
     meshResources.chunksBuf->writeVector(chunkDatas, 0, cmdBuf);
 
     for (int i = 0; i < vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT; i++) {
-        meshResources.ubos[i] = std::make_unique<vul::VulBuffer>(sizeof(MeshUbo), 1, false, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
+        meshResources.ubos[i] = vul::VulBuffer::createDynamicLocal(sizeof(MeshUbo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
 
         std::vector<vul::VulDescriptorSet::Descriptor> descs;
         vul::VulDescriptorSet::Descriptor desc;
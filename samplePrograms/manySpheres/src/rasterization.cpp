@@ -46,7 +46,7 @@ RasResources createRasterizationResources(const vul::VulRenderer &vulRenderer, c
     res.drawData.pushDataSize = 0;
 
     for (int i = 0; i < vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT; i++) {
-        res.ubos[i] = std::make_unique<vul::VulBuffer>(sizeof(RasUbo), 1, false, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
+        res.ubos[i] = vul::VulBuffer::createDynamicLocal(sizeof(RasUbo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
 
         std::vector<vul::VulDescriptorSet::Descriptor> descs;
         vul::VulDescriptorSet::Descriptor desc;
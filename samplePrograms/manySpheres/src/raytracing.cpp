@@ -56,7 +56,7 @@ RtResources createRaytracingResources(const vul::VulRenderer &vulRenderer, const
         res.rtImgs[i]->keepRegularRaw2d32bitRgbaEmpty(vulRenderer.getSwapChainExtent().width, vulRenderer.getSwapChainExtent().height);
         res.rtImgs[i]->createDefaultImage(vul::VulImage::ImageType::storage2d, cmdBuf);
 
-        res.ubos[i] = std::make_unique<vul::VulBuffer>(sizeof(RtUbo), 1, false, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
+        res.ubos[i] = vul::VulBuffer::createDynamicLocal(sizeof(RtUbo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
 
         std::vector<vul::VulDescriptorSet::Descriptor> descriptors;
         vul::VulDescriptorSet::Descriptor desc{};
@@ -8,15 +8,18 @@
 #include <vul_descriptors.hpp>
 #include <vul_GUI.hpp>
 #include <vul_meshlet_scene.hpp>
+#include <vul_virtual_texture.hpp>
 #include <mesh_shading.hpp>
 
 #include<imgui.h>
+#include <filesystem>
 #include <iostream>
 #include <vulkan/vulkan_core.h>
 
-void GuiStuff(double frameTime) {
+void GuiStuff(double frameTime, const vul::VulVirtualTexture *virtualTexture) {
     ImGui::Begin("Menu");
     ImGui::Text("Fps: %f\nTotal frame time: %fms", 1.0f / frameTime, frameTime * 1000.0f);
+    if (virtualTexture != nullptr) ImGui::Text("Virtual texture pages: %u/%u", virtualTexture->getResidentPageCount(), virtualTexture->getPhysicalPageCount());
     ImGui::End();
 }
 
@@ -46,7 +49,7 @@ int main() {
 
     VkCommandBuffer commandBuffer = cmdPool.getPrimaryCommandBuffer();
     vul::VulImage cubeMap(vulDevice);
-    cubeMap.loadCubemapFromEXR( "../enviromentMaps/sunsetCube.exr");
+    cubeMap.loadCubemapFromEXR("../enviromentMaps/sunsetCube.exr", true);
     cubeMap.createDefaultImage(vul::VulImage::ImageType::hdrCube, commandBuffer);
     cubeMap.vulSampler = vul::VulSampler::createDefaultTexSampler(vulDevice);
 
@@ -79,12 +82,19 @@ int main() {
     shadowMapDir.vulSampler = cubeMap.vulSampler;
     cmdPool.submit(commandBuffer, true);
 
+    // Smoke test of the virtual texture streaming. Nothing samples it yet, so only the mip tail gets loaded and update runs
+    // every frame with empty feedback
+    std::unique_ptr<vul::VulVirtualTexture> virtualTexture;
+    if (std::filesystem::exists("../Models/virtualTexture/")) virtualTexture = std::make_unique<vul::VulVirtualTexture>("../Models/virtualTexture",
+            vul::VulImage::KtxCompressionFormat::bc7rgbaNonLinear, 16384, 16384, 1, 256, 2, vulDevice, cmdPool);
+
     asyncImageLoadingInfo->pauseMutex.lock();
     MeshResources meshRes = createMeshShadingResources(scene, cubeMap, shadowMapPoint, shadowMapDir, vulRenderer, *descPool.get(), vulDevice);
     renderShadowMaps(vulRenderer, shadowMapPoint, shadowMapDir, scene, meshRes);
     asyncImageLoadingInfo->pauseMutex.unlock();
 
     double frameStartTime = glfwGetTime();
+    uint64_t frame = 0;
     bool imagesFullyLoaded = false;
     while (!vulWindow.shouldClose()) {
         if (!imagesFullyLoaded && asyncImageLoadingInfo->fullyProcessedImageCount >= scene.images.size()) {
@@ -101,12 +111,13 @@ int main() {
         glfwPollEvents();
         commandBuffer = vulRenderer.beginFrame();
         if (commandBuffer == nullptr) continue;
+        if (virtualTexture != nullptr) virtualTexture->update(vulRenderer.getFrameIndex(), frame, cmdPool);
         vulGui.startFrame();
 
         while (glfwGetTime() - frameStartTime < MIN_FRAME_TIME);
         const double frameTime = glfwGetTime() - frameStartTime;
         frameStartTime = glfwGetTime();
-        if (!camera.shouldHideGui()) GuiStuff(frameTime);
+        if (!camera.shouldHideGui()) GuiStuff(frameTime, virtualTexture.get());
 
         camera.applyInputs(vulWindow.getGLFWwindow(), frameTime, vulRenderer.getSwapChainExtent().height);
         camera.updateXYZ();
@@ -118,7 +129,9 @@ int main() {
 
         vulGui.endFrame(commandBuffer); 
         vulRenderer.stopRendering(commandBuffer);
+        if (virtualTexture != nullptr) virtualTexture->recordFeedbackBarrier(commandBuffer, vulRenderer.getFrameIndex());
         vulRenderer.endFrame();
+        frame++;
     }
     vulDevice.waitForIdle();
 
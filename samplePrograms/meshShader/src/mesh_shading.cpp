@@ -17,7 +17,7 @@ MeshResources createMeshShadingResources(const vul::VulMeshletScene &scene, vul:
     MeshResources meshResources;
 
     for (int i = 0; i < vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT; i++) {
-        meshResources.ubos[i] = std::make_unique<vul::VulBuffer>(sizeof(Ubo), 1, false, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
+        meshResources.ubos[i] = vul::VulBuffer::createDynamicLocal(sizeof(Ubo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
 
         std::vector<vul::VulDescriptorSet::Descriptor> descs;
         vul::VulDescriptorSet::Descriptor desc;
@@ -72,7 +72,7 @@ MeshResources createMeshShadingResources(const vul::VulMeshletScene &scene, vul:
         descs.push_back(desc);
         meshResources.descSets[i] = vul::VulDescriptorSet::createDescriptorSet(descs, descPool);
 
-        meshResources.shadowUbos[i] = std::make_unique<vul::VulBuffer>(sizeof(ShadowUbo), 1, false, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
+        meshResources.shadowUbos[i] = vul::VulBuffer::createDynamicLocal(sizeof(ShadowUbo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
 
         descs.clear();
         desc.stages = VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_TASK_BIT_EXT;
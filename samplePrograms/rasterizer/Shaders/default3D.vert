@@ -15,15 +15,20 @@ layout (location = 2) out vec4 fragTangentWorld;
 layout (location = 3) out vec2 fragTexCoord;
 
 layout(set = 0, binding = 0) uniform Ubo {GlobalUbo ubo;};
+layout(set = 0, binding = 5) readonly buffer InstanceTransforms {mat4 instanceTransforms[];};
 
 layout (push_constant) uniform Push{DefaultPushConstant push;};
 
 void main()
 {
-    vec4 worldPosition = push.modelMatrix * vec4(position, 1.0);
-    gl_Position = ubo.projectionMatrix * ubo.viewMatrix * push.modelMatrix * vec4(position, 1.0f);
-    fragNormalWorld = normalize(mat3(push.normalMatrix) * normal);
-    fragTangentWorld = vec4(normalize(mat3(push.normalMatrix) * tangent.xyz), tangent.w);
+    // Instance transforms already include the matrix of their node
+    const mat4 modelMatrix = push.instanced != 0 ? instanceTransforms[gl_InstanceIndex] : push.modelMatrix;
+    const mat3 normalMatrix = push.instanced != 0 ? transpose(inverse(mat3(modelMatrix))) : mat3(push.normalMatrix);
+
+    vec4 worldPosition = modelMatrix * vec4(position, 1.0);
+    gl_Position = ubo.projectionMatrix * ubo.viewMatrix * worldPosition;
+    fragNormalWorld = normalize(normalMatrix * normal);
+    fragTangentWorld = vec4(normalize(normalMatrix * tangent.xyz), tangent.w);
     fragPosWorld = worldPosition.xyz;
     fragTexCoord = uv;
 }
@@ -34,12 +34,14 @@ struct DefaultPushConstant{
     mat4 modelMatrix;
     mat4 normalMatrix;
     int matIdx;
+    int instanced; // When not 0 the model matrix comes from the instance transform buffer
 };
 
 struct OitPushConstant{
     mat4 modelMatrix;
     mat4 normalMatrix;
     int matIdx;
+    int instanced;
     uint depthImageIdx;
     float width;
     float height;
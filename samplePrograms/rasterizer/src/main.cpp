@@ -10,10 +10,12 @@
 #include <vul_swap_chain.hpp>
 #include <vul_image.hpp>
 #include <vul_command_pool.hpp>
+#include <vul_readback.hpp>
 #include<host_device.hpp>
 #include<vul_debug_tools.hpp>
 
 #include<imgui.h>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <array>
@@ -25,7 +27,10 @@ struct Resources {
     std::unique_ptr<vul::VulBuffer> aBuffer = nullptr;
     std::unique_ptr<vul::VulImage> aBufferHeads = nullptr;
     std::unique_ptr<vul::VulBuffer> aBufferCounter = nullptr;
+    std::unique_ptr<vul::VulReadback> readback = nullptr;
     std::array<std::unique_ptr<vul::VulBuffer>, vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT> ubos;
+    // Bound instead of the scene's instance transforms when it has no instanced nodes
+    std::unique_ptr<vul::VulBuffer> emptyInstanceTransforms = nullptr;
     std::array<std::unique_ptr<vul::VulDescriptorSet>, vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT> mainDescSets;
     std::array<std::unique_ptr<vul::VulDescriptorSet>, vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT> oitDescSets;
     std::unique_ptr<vul::VulPipeline> mainPipeline;
@@ -146,14 +151,12 @@ Resources createReources(vul::VulCmdPool &cmdPool, const vul::VulDevice &vulDevi
     output.aBufferHeads->createDefaultImage(vul::VulImage::ImageType::storage2d, cmdBuf);
     
     output.aBufferCounter = std::make_unique<vul::VulBuffer>(sizeof(uint32_t), 1, true, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, vulDevice);
-    output.aBufferCounter->addStagingBuffer();
+    output.readback = std::make_unique<vul::VulReadback>(256, vulDevice);
 
     for (int i = 0; i < vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT; i++){
-        output.ubos[i] = std::make_unique<vul::VulBuffer>(sizeof(GlobalUbo), 1, false, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
-        output.ubos[i]->mapAll();
+        output.ubos[i] = vul::VulBuffer::createDynamicLocal(sizeof(GlobalUbo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
 
         VUL_NAME_VK(output.ubos[i]->getBuffer())
-        VUL_NAME_VK(output.ubos[i]->getMemory())
     }
     cmdPool.submit(cmdBuf, true);
 
@@ -168,6 +171,12 @@ Resources createReources(vul::VulCmdPool &cmdPool, const vul::VulDevice &vulDevi
 
 void createDescriptors(Resources &resources, const vul::Scene &scene, const vul::VulRenderer &vulRendered, const vul::VulDescriptorPool &descPool, const vul::VulDevice &vulDevice)
 {
+    if (scene.instanceTransformBuffer.get() == nullptr) {
+        const glm::mat4 identity(1.0f);
+        resources.emptyInstanceTransforms = std::make_unique<vul::VulBuffer>(sizeof(glm::mat4), 1, false, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, vulDevice);
+        resources.emptyInstanceTransforms->writeData(&identity, sizeof(identity), 0, VK_NULL_HANDLE);
+    }
+
     for (int i = 0; i < vul::VulSwapChain::MAX_FRAMES_IN_FLIGHT; i++){
         std::vector<vul::VulDescriptorSet::Descriptor> descs;
         vul::VulDescriptorSet::Descriptor ubo{}; 
@@ -201,6 +210,12 @@ void createDescriptors(Resources &resources, const vul::Scene &scene, const vul:
         mb1dImg.stages = VK_SHADER_STAGE_FRAGMENT_BIT;
         descs.push_back(mb1dImg);
 
+        vul::VulDescriptorSet::Descriptor instanceTransforms{};
+        instanceTransforms.type = vul::VulDescriptorSet::DescriptorType::storageBuffer;
+        instanceTransforms.content = scene.instanceTransformBuffer.get() != nullptr ? scene.instanceTransformBuffer.get() : resources.emptyInstanceTransforms.get();
+        instanceTransforms.stages = VK_SHADER_STAGE_VERTEX_BIT;
+        descs.push_back(instanceTransforms);
+
         resources.mainDescSets[i] = vul::VulDescriptorSet::createDescriptorSet(descs, descPool);
 
         VUL_NAME_VK(resources.mainDescSets[i]->getSet())
@@ -273,6 +288,11 @@ void createPipelines(Resources &resources, const vul::Scene &scene, const vul::V
         drawData.firstIndex = mesh.firstIndex;
         drawData.indexCount = mesh.indexCount;
         drawData.vertexOffset = mesh.vertexOffset;
+        // Instanced nodes are drawn once with their whole range of the instance transform buffer
+        if (node.instanceCount > 0) {
+            drawData.instanceCount = node.instanceCount;
+            drawData.firstInstance = node.firstInstance;
+        }
         if (material.alphaMode != vul::GltfLoader::GltfAlphaMode::blend) {
             drawData.pPushData = std::make_shared<DefaultPushConstant>();
             drawData.pushDataSize = sizeof(DefaultPushConstant);
@@ -303,7 +323,7 @@ void createPipelines(Resources &resources, const vul::Scene &scene, const vul::V
     VUL_NAME_VK(resources.oitCompositingPipeline->getPipeline())
 }
 
-size_t updateShaderInputs(const Resources &resources, const vul::Scene &scene, const vul::VulCamera &camera, const vul::VulRenderer &vulRenderer, vul::VulCmdPool &cmdPool, VkCommandBuffer cmdBuf)
+size_t updateShaderInputs(const Resources &resources, const vul::Scene &scene, const vul::VulCamera &camera, const vul::VulRenderer &vulRenderer, uint32_t &transparentFragmentsCount, VkCommandBuffer cmdBuf)
 {
     VUL_PROFILE_FUNC()
 
@@ -332,12 +352,14 @@ size_t updateShaderInputs(const Resources &resources, const vul::Scene &scene, c
             pushData->modelMatrix = node.worldMatrix;
             pushData->normalMatrix = node.normalMatrix;
             pushData->matIdx = mesh.materialIndex;
+            pushData->instanced = node.instanceCount > 0;
             mainIdx++;
         } else {
             OitPushConstant *pushData = static_cast<OitPushConstant *>(resources.oitColoringDrawDatas[oitIdx].pPushData.get());
             pushData->modelMatrix = node.worldMatrix;
             pushData->normalMatrix = node.normalMatrix;
             pushData->matIdx = mesh.materialIndex;
+            pushData->instanced = node.instanceCount > 0;
             pushData->depthImageIdx = vulRenderer.getImageIndex();
             pushData->width = static_cast<float>(vulRenderer.getSwapChainExtent().width);
             pushData->height = static_cast<float>(vulRenderer.getSwapChainExtent().height);
@@ -345,8 +367,9 @@ size_t updateShaderInputs(const Resources &resources, const vul::Scene &scene, c
         }
     }
 
-    uint32_t transparentFragmentsCount;
-    resources.aBufferCounter->readData(&transparentFragmentsCount, sizeof(transparentFragmentsCount), 0, cmdPool);
+    // The count arrives a few frames late, which is plenty for sizing the a-buffer and doesn't stall the frame
+    resources.readback->readBuffer(*resources.aBufferCounter, sizeof(uint32_t), 0, vulRenderer.getFrameIndex(), cmdBuf,
+            [&transparentFragmentsCount](const void *data, VkDeviceSize size) {memcpy(&transparentFragmentsCount, data, size);});
     vkCmdFillBuffer(cmdBuf, resources.aBufferCounter->getBuffer(), 0, sizeof(uint32_t), 0);
 
     VkDeviceSize transFragSize = transparentFragmentsCount * sizeof(ABuffer);
@@ -411,14 +434,16 @@ int main() {
     createDescriptors(resources, mainScene, vulRenderer, *descPool.get(), vulDevice);
     createPipelines(resources, mainScene, vulRenderer, vulDevice);
 
+    uint32_t transparentFragmentsCount = 0;
     double frameStartTime = glfwGetTime();
     while (!vulWindow.shouldClose()) {
         glfwPollEvents();
         VkCommandBuffer cmdBuf = vulRenderer.beginFrame();
         vulGui.startFrame();
         if (cmdBuf == nullptr) continue;
+        resources.readback->resolve(vulRenderer.getFrameIndex());
 
-        size_t requiredABufferSize = updateShaderInputs(resources, mainScene, camera, vulRenderer, cmdPool, cmdBuf);
+        size_t requiredABufferSize = updateShaderInputs(resources, mainScene, camera, vulRenderer, transparentFragmentsCount, cmdBuf);
 
         double frameTime = glfwGetTime() - frameStartTime;
         frameStartTime = glfwGetTime();
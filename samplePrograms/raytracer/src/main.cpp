@@ -181,7 +181,7 @@ int main() {
         rtImgs[i]->keepRegularRaw2d32bitRgbaEmpty(vulRenderer.getSwapChainExtent().width, vulRenderer.getSwapChainExtent().height);
         rtImgs[i]->createDefaultImage(vul::VulImage::ImageType::storage2d, commandBuffer);
 
-        ubos[i] = std::make_unique<vul::VulBuffer>(sizeof(GlobalUbo), 1, false, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
+        ubos[i] = vul::VulBuffer::createDynamicLocal(sizeof(GlobalUbo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, vulDevice);
         descSets[i] = createRtDescSet(mainScene, as, rtImgs[i], ubos[i], enviromentMap, descPool);
     }
     cmdPool.submit(commandBuffer, true);
@@ -42,19 +42,48 @@ void VulAs::loadScene(const Scene &scene, const std::vector<AsNode> &nodes, cons
         nodeCountPerBlas[i] = nodeCount;
     }
 
+    // Instanced nodes stay in their blas without any triangles, so the geometry indices of the other nodes don't change, and
+    // get a blas of their own that every one of their instances points to
+    struct InstancedNode {
+        uint32_t nodeIndex;
+        uint32_t blasIndex;
+        uint32_t geometryIndex;
+    };
+    std::vector<InstancedNode> instancedNodes;
+    std::vector<uint32_t> instancedNodeIndices;
     std::unique_ptr<VulBuffer> transformsBuf = createTransformsBuffer(scene, orderedNodes);
     std::vector<BlasInput> blasInputs;
     uint32_t usedNodeCount = 0;
-    for (uint32_t nodeCount : nodeCountPerBlas) {
-        blasInputs.emplace_back(gltfNodesToBlasInput(scene, orderedNodes, usedNodeCount, nodeCount, transformsBuf));
-        usedNodeCount += nodeCount;
+    for (uint32_t i = 0; i < nodeCountPerBlas.size(); i++) {
+        blasInputs.emplace_back(gltfNodesToBlasInput(scene, orderedNodes, usedNodeCount, nodeCountPerBlas[i], transformsBuf));
+        for (uint32_t j = 0; j < nodeCountPerBlas[i]; j++) {
+            const uint32_t nodeIndex = orderedNodes[usedNodeCount + j];
+            if (scene.nodes[nodeIndex].instanceCount == 0) continue;
+            instancedNodes.push_back({nodeIndex, i, j});
+            instancedNodeIndices.push_back(nodeIndex);
+        }
+        usedNodeCount += nodeCountPerBlas[i];
     }
+    const uint32_t instancedBlasesStart = static_cast<uint32_t>(blasInputs.size());
+    for (uint32_t i = 0; i < instancedNodeIndices.size(); i++) blasInputs.emplace_back(gltfNodesToBlasInput(scene, instancedNodeIndices, i, 1, nullptr));
     buildBlases(blasInputs, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR, cmdPool);
 
     for (size_t i = 0; i < instanceInfos.size(); i++) {
         const InstanceInfo &instInf = instanceInfos[i];
         m_instances.push_back(blasToAsInstance(instInf.customIndex, instInf.shaderBindingTableRecordOffset, instInf.transform, m_blases[instInf.blasIdx]));
     }
+    // Added after the asked for instances so their indices stay the same for updateInstanceTransforms. The custom index points
+    // at the same prim info as it would have through the geometry index in the original blas
+    for (const InstanceInfo &instInf : instanceInfos) {
+        for (size_t i = 0; i < instancedNodes.size(); i++) {
+            if (instancedNodes[i].blasIndex != instInf.blasIdx) continue;
+            const GltfLoader::GltfNode &node = scene.nodes[instancedNodes[i].nodeIndex];
+            for (uint32_t j = 0; j < node.instanceCount; j++) {
+                m_instances.push_back(blasToAsInstance(instInf.customIndex + instancedNodes[i].geometryIndex, instInf.shaderBindingTableRecordOffset,
+                            instInf.transform * scene.instanceTransforms[node.firstInstance + j], m_blases[instancedBlasesStart + i]));
+            }
+        }
+    }
 
     m_tlasBuildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
     if (allowUpdating) m_tlasBuildFlags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
@@ -334,7 +363,7 @@ VulAs::BlasInput VulAs::gltfNodesToBlasInput(const Scene &scene, const std::vect
         triangles.maxVertex = mesh.vertexCount - 1;
         triangles.indexType = VK_INDEX_TYPE_UINT32;
         triangles.indexData.deviceAddress = scene.indexBuffer->getBufferAddress();
-        triangles.transformData.deviceAddress = transformsBuffer->getBufferAddress();
+        if (transformsBuffer != nullptr) triangles.transformData.deviceAddress = transformsBuffer->getBufferAddress();
 
         VkAccelerationStructureGeometryKHR asGeom{};
         asGeom.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
@@ -344,9 +373,10 @@ VulAs::BlasInput VulAs::gltfNodesToBlasInput(const Scene &scene, const std::vect
 
         VkAccelerationStructureBuildRangeInfoKHR offsetInfo{};
         offsetInfo.firstVertex = mesh.vertexOffset;
-        offsetInfo.primitiveCount = mesh.indexCount / 3;
+        // Instanced nodes are placed by their instances, so with a transforms buffer they only keep their geometry index
+        offsetInfo.primitiveCount = transformsBuffer != nullptr && scene.nodes[orderedNodesIndices[i]].instanceCount > 0 ? 0 : mesh.indexCount / 3;
         offsetInfo.primitiveOffset = mesh.firstIndex * sizeof(uint32_t);
-        offsetInfo.transformOffset = i * sizeof(VkTransformMatrixKHR);
+        if (transformsBuffer != nullptr) offsetInfo.transformOffset = i * sizeof(VkTransformMatrixKHR);
 
         blasInput.asGeometries.push_back(asGeom);
         blasInput.asBuildOffsetInfos.push_back(offsetInfo);
@@ -0,0 +1,388 @@
+#include <vul_allocator.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+namespace vul {
+
+// Every size and offset is a multiple of this, which keeps the smallest sizes in the first level that has all its second
+// level bins
+static constexpr VkDeviceSize MIN_RANGE_SIZE = 16;
+static constexpr uint32_t SL_LOG2 = 4;
+static constexpr uint32_t SL_COUNT = 1 << SL_LOG2;
+static constexpr uint32_t FL_COUNT = 48;
+// Heaps this small get blocks of an eighth of their size instead of the default
+static constexpr VkDeviceSize SMALL_HEAP_SIZE = 1024ull * 1024 * 1024;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Sizes from 2^fl to 2^(fl + 1) are split into SL_COUNT bins of equal width
+static void getBin(VkDeviceSize size, uint32_t &fl, uint32_t &sl)
+{
+    fl = std::bit_width(size) - 1;
+    sl = static_cast<uint32_t>(size >> (fl - SL_LOG2)) - SL_COUNT;
+}
+
+struct VulAllocator::Range {
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    bool isFree = true;
+    Range *prevPhysical = nullptr;
+    Range *nextPhysical = nullptr;
+    Range *prevFree = nullptr;
+    Range *nextFree = nullptr;
+};
+
+struct VulAllocator::Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    void *mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+    ResourceType resourceType = ResourceType::linear;
+    VkDeviceSize usedBytes = 0;
+    uint32_t allocationCount = 0;
+
+    Range *firstRange = nullptr;
+    uint64_t flBitmap = 0;
+    std::array<uint32_t, FL_COUNT> slBitmaps{};
+    std::array<std::array<Range *, SL_COUNT>, FL_COUNT> freeLists{};
+
+    Block(VkDeviceMemory memory, VkDeviceSize size, void *mapped, uint32_t memoryTypeIndex, ResourceType resourceType)
+        : memory{memory}, size{size}, mapped{mapped}, memoryTypeIndex{memoryTypeIndex}, resourceType{resourceType}
+    {
+        firstRange = new Range{0, size};
+        insertFree(firstRange);
+    }
+
+    ~Block()
+    {
+        for (Range *range = firstRange; range != nullptr;) {
+            Range *next = range->nextPhysical;
+            delete range;
+            range = next;
+        }
+    }
+
+    Block(const Block &) = delete;
+    Block &operator=(const Block &) = delete;
+
+    void insertFree(Range *range)
+    {
+        uint32_t fl, sl;
+        getBin(range->size, fl, sl);
+        range->isFree = true;
+        range->prevFree = nullptr;
+        range->nextFree = freeLists[fl][sl];
+        if (range->nextFree != nullptr) range->nextFree->prevFree = range;
+        freeLists[fl][sl] = range;
+        flBitmap |= 1ull << fl;
+        slBitmaps[fl] |= 1u << sl;
+    }
+
+    void removeFree(Range *range)
+    {
+        uint32_t fl, sl;
+        getBin(range->size, fl, sl);
+        if (range->prevFree != nullptr) range->prevFree->nextFree = range->nextFree;
+        else freeLists[fl][sl] = range->nextFree;
+        if (range->nextFree != nullptr) range->nextFree->prevFree = range->prevFree;
+        if (freeLists[fl][sl] == nullptr) {
+            slBitmaps[fl] &= ~(1u << sl);
+            if (slBitmaps[fl] == 0) flBitmap &= ~(1ull << fl);
+        }
+        range->isFree = false;
+    }
+
+    Range *findFree(VkDeviceSize size) const
+    {
+        // Rounding up to the start of the next bin means that any range in the bin found is big enough
+        uint32_t fl, sl;
+        getBin(size, fl, sl);
+        getBin(size + (1ull << (fl - SL_LOG2)) - 1, fl, sl);
+        if (fl >= FL_COUNT) return nullptr;
+
+        uint32_t slMap = slBitmaps[fl] & (~0u << sl);
+        if (slMap == 0) {
+            const uint64_t flMap = fl + 1 < FL_COUNT ? flBitmap & (~0ull << (fl + 1)) : 0;
+            if (flMap == 0) return nullptr;
+            fl = std::countr_zero(flMap);
+            slMap = slBitmaps[fl];
+        }
+        return freeLists[fl][std::countr_zero(slMap)];
+    }
+
+    // Splits the end of the range off as a new range right after it
+    Range *split(Range *range, VkDeviceSize size)
+    {
+        Range *rest = new Range{range->offset + size, range->size - size};
+        rest->prevPhysical = range;
+        rest->nextPhysical = range->nextPhysical;
+        if (rest->nextPhysical != nullptr) rest->nextPhysical->prevPhysical = rest;
+        range->nextPhysical = rest;
+        range->size = size;
+        return rest;
+    }
+
+    // Merges the range after this one into it
+    void mergeNext(Range *range)
+    {
+        Range *next = range->nextPhysical;
+        range->size += next->size;
+        range->nextPhysical = next->nextPhysical;
+        if (range->nextPhysical != nullptr) range->nextPhysical->prevPhysical = range;
+        delete next;
+    }
+
+    Range *allocate(VkDeviceSize size, VkDeviceSize alignment)
+    {
+        size = alignUp(size, MIN_RANGE_SIZE);
+        alignment = std::max(alignment, MIN_RANGE_SIZE);
+        // Offsets are already multiples of MIN_RANGE_SIZE, so that much of the alignment never needs padding
+        Range *range = findFree(size + alignment - MIN_RANGE_SIZE);
+        if (range == nullptr) return nullptr;
+        removeFree(range);
+
+        const VkDeviceSize padding = alignUp(range->offset, alignment) - range->offset;
+        if (padding > 0) {
+            // The range before is never free, since free neighbours are always merged, so the padding stays its own range
+            Range *aligned = split(range, padding);
+            insertFree(range);
+            range = aligned;
+        }
+        if (range->size > size) insertFree(split(range, size));
+
+        range->isFree = false;
+        usedBytes += range->size;
+        allocationCount++;
+        return range;
+    }
+
+    void free(Range *range)
+    {
+        usedBytes -= range->size;
+        allocationCount--;
+        if (range->nextPhysical != nullptr && range->nextPhysical->isFree) {
+            removeFree(range->nextPhysical);
+            mergeNext(range);
+        }
+        if (range->prevPhysical != nullptr && range->prevPhysical->isFree) {
+            Range *prev = range->prevPhysical;
+            removeFree(prev);
+            mergeNext(prev);
+            range = prev;
+        }
+        insertFree(range);
+    }
+
+    void addStats(Stats &stats) const
+    {
+        stats.blockCount++;
+        stats.allocationCount += allocationCount;
+        stats.blockBytes += size;
+        stats.usedBytes += usedBytes;
+        for (const Range *range = firstRange; range != nullptr; range = range->nextPhysical) {
+            if (!range->isFree) continue;
+            stats.freeRangeCount++;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, range->size);
+        }
+    }
+};
+
+VulAllocator::VulAllocator(VkDevice device, VkPhysicalDevice physicalDevice, bool bufferDeviceAddress, VkDeviceSize blockSize)
+    : m_device{device}, m_bufferDeviceAddress{bufferDeviceAddress}, m_blockSize{blockSize}
+{
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+    m_pools.resize(m_memoryProperties.memoryTypeCount);
+    m_dedicatedStats.resize(m_memoryProperties.memoryTypeCount);
+}
+
+VulAllocator::~VulAllocator()
+{
+    for (std::array<Pool, 2> &pools : m_pools) {
+        for (Pool &pool : pools) {
+            for (std::unique_ptr<Block> &block : pool.blocks) vkFreeMemory(m_device, block->memory, nullptr);
+        }
+    }
+}
+
+VkResult VulAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+        ResourceType resourceType, Allocation &outAllocation)
+{
+    const uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+    outAllocation = Allocation{};
+    outAllocation.memoryTypeIndex = memoryTypeIndex;
+    outAllocation.size = requirements.size;
+
+    // Twice the size is enough for the alignment padding and the rounding up of the bin search, so anything that fits in a
+    // block by that measure is guaranteed to fit in an empty one
+    const VkDeviceSize neededBlockSize = 2 * (requirements.size + requirements.alignment);
+    const VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+    if (neededBlockSize > blockSize) return allocateDedicated(requirements.size, memoryTypeIndex, resourceType, outAllocation);
+
+    std::unique_lock lock(m_mutex);
+    Pool &pool = m_pools[memoryTypeIndex][static_cast<size_t>(resourceType)];
+    Block *block = nullptr;
+    Range *range = nullptr;
+    for (std::unique_ptr<Block> &candidate : pool.blocks) {
+        range = candidate->allocate(requirements.size, requirements.alignment);
+        if (range != nullptr) {
+            block = candidate.get();
+            break;
+        }
+    }
+
+    if (range == nullptr) {
+        // Smaller blocks are tried when the heap is too full for a whole one
+        VkDeviceSize newBlockSize = blockSize;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void *mapped = nullptr;
+        VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        for (; newBlockSize >= neededBlockSize; newBlockSize /= 2) {
+            result = allocateMemory(newBlockSize, memoryTypeIndex, resourceType, memory, mapped);
+            if (result == VK_SUCCESS) break;
+        }
+        if (result != VK_SUCCESS) {
+            // The request itself might still fit when not even the smallest block does
+            lock.unlock();
+            return allocateDedicated(requirements.size, memoryTypeIndex, resourceType, outAllocation);
+        }
+        pool.blocks.push_back(std::make_unique<Block>(memory, newBlockSize, mapped, memoryTypeIndex, resourceType));
+        block = pool.blocks.back().get();
+        range = block->allocate(requirements.size, requirements.alignment);
+        if (range == nullptr) {
+            // Can't happen with the size checked above, but an unusable block must not be left behind either way
+            vkFreeMemory(m_device, memory, nullptr);
+            pool.blocks.pop_back();
+            lock.unlock();
+            return allocateDedicated(requirements.size, memoryTypeIndex, resourceType, outAllocation);
+        }
+    }
+
+    outAllocation.memory = block->memory;
+    outAllocation.offset = range->offset;
+    outAllocation.mapped = block->mapped != nullptr ? static_cast<uint8_t *>(block->mapped) + range->offset : nullptr;
+    outAllocation.block = block;
+    outAllocation.range = range;
+    return VK_SUCCESS;
+}
+
+VkResult VulAllocator::allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex, ResourceType resourceType,
+        Allocation &outAllocation)
+{
+    VkResult result = allocateMemory(size, memoryTypeIndex, resourceType, outAllocation.memory, outAllocation.mapped);
+    if (result != VK_SUCCESS) return result;
+    std::scoped_lock lock(m_mutex);
+    m_dedicatedStats[memoryTypeIndex].allocationCount++;
+    m_dedicatedStats[memoryTypeIndex].bytes += size;
+    return VK_SUCCESS;
+}
+
+void VulAllocator::free(Allocation &allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE) return;
+
+    if (allocation.block == nullptr) {
+        vkFreeMemory(m_device, allocation.memory, nullptr);
+        std::scoped_lock lock(m_mutex);
+        m_dedicatedStats[allocation.memoryTypeIndex].allocationCount--;
+        m_dedicatedStats[allocation.memoryTypeIndex].bytes -= allocation.size;
+        allocation = Allocation{};
+        return;
+    }
+
+    std::scoped_lock lock(m_mutex);
+    Block *block = allocation.block;
+    block->free(allocation.range);
+    allocation = Allocation{};
+    if (block->allocationCount > 0) return;
+
+    // One empty block is kept around per pool, so that allocating and freeing at its edge doesn't keep hitting the driver
+    Pool &pool = m_pools[block->memoryTypeIndex][static_cast<size_t>(block->resourceType)];
+    const bool hasOtherEmptyBlock = std::any_of(pool.blocks.begin(), pool.blocks.end(), [block](const std::unique_ptr<Block> &candidate) {
+        return candidate.get() != block && candidate->allocationCount == 0;});
+    if (!hasOtherEmptyBlock) return;
+    vkFreeMemory(m_device, block->memory, nullptr);
+    std::erase_if(pool.blocks, [block](const std::unique_ptr<Block> &candidate) {return candidate.get() == block;});
+}
+
+uint32_t VulAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) return i;
+    }
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool VulAllocator::hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) return true;
+    }
+    return false;
+}
+
+VulAllocator::Stats VulAllocator::getStats() const
+{
+    std::scoped_lock lock(m_mutex);
+    Stats stats{};
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) addStats(i, stats);
+    return stats;
+}
+
+VulAllocator::Stats VulAllocator::getStats(uint32_t memoryTypeIndex) const
+{
+    std::scoped_lock lock(m_mutex);
+    Stats stats{};
+    addStats(memoryTypeIndex, stats);
+    return stats;
+}
+
+VkDeviceSize VulAllocator::getBlockSize(uint32_t memoryTypeIndex) const
+{
+    const VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+    if (heapSize <= SMALL_HEAP_SIZE) return alignUp(std::min(m_blockSize, heapSize / 8), MIN_RANGE_SIZE);
+    return m_blockSize;
+}
+
+VkResult VulAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, ResourceType resourceType,
+        VkDeviceMemory &outMemory, void *&outMapped) const
+{
+    // Any buffer in a linear block could want its device address
+    VkMemoryAllocateFlagsInfo allocFlagsInfo{};
+    allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    if (m_bufferDeviceAddress && resourceType == ResourceType::linear) allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &allocFlagsInfo;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+    VkResult result = vkAllocateMemory(m_device, &allocInfo, nullptr, &outMemory);
+    if (result != VK_SUCCESS) return result;
+
+    outMapped = nullptr;
+    if (m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(m_device, outMemory, 0, VK_WHOLE_SIZE, 0, &outMapped);
+        if (result != VK_SUCCESS) {
+            vkFreeMemory(m_device, outMemory, nullptr);
+            outMemory = VK_NULL_HANDLE;
+            return result;
+        }
+    }
+    return VK_SUCCESS;
+}
+
+void VulAllocator::addStats(uint32_t memoryTypeIndex, Stats &stats) const
+{
+    for (const Pool &pool : m_pools[memoryTypeIndex]) {
+        for (const std::unique_ptr<Block> &block : pool.blocks) block->addStats(stats);
+    }
+    stats.dedicatedAllocationCount += m_dedicatedStats[memoryTypeIndex].allocationCount;
+    stats.dedicatedBytes += m_dedicatedStats[memoryTypeIndex].bytes;
+}
+
+}
@@ -0,0 +1,164 @@
+#include <vul_bc6h.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace vul {
+
+// Mode 11 of BC6H: a single region with both endpoints stored as unsigned 10 bit values and 4 bit indices
+static constexpr uint32_t BC6H_MODE_11 = 0x03;
+static constexpr int32_t MAX_FINITE_HALF = 0x7bff;
+static constexpr std::array<int32_t, 16> BC6H_WEIGHTS = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// BC6H interpolates the bit patterns of the halfs as integers, and for positive halfs those grow monotonically with the value,
+// so all of the fitting happens on the bit patterns
+static int32_t getEncodableHalf(uint16_t half)
+{
+    if (half & 0x8000) return 0;
+    return std::min(static_cast<int32_t>(half), MAX_FINITE_HALF);
+}
+
+static int32_t unquantizeEndpoint(int32_t endpoint)
+{
+    if (endpoint == 0) return 0;
+    if (endpoint == 1023) return 0xffff;
+    return ((endpoint << 16) + 0x8000) >> 10;
+}
+
+static int32_t quantizeEndpoint(float half)
+{
+    // Inverse of unquantizing followed by the final scale by 31/64 that the decoder does
+    return std::clamp(static_cast<int32_t>(std::lround(half / 31.0f)), 0, 1023);
+}
+
+static int32_t decodeHalf(int32_t unquantized0, int32_t unquantized1, int32_t weight)
+{
+    return ((unquantized0 * (64 - weight) + unquantized1 * weight + 32) >> 6) * 31 >> 6;
+}
+
+struct Bc6hFit {
+    std::array<std::array<int32_t, 3>, 2> endpoints;
+    std::array<uint8_t, 16> indices;
+    int64_t error;
+};
+
+static Bc6hFit fitIndices(const std::array<std::array<int32_t, 3>, 16> &texels, const std::array<std::array<float, 3>, 2> &endpoints)
+{
+    Bc6hFit fit{};
+    std::array<std::array<int32_t, 3>, 16> palette;
+    for (uint32_t c = 0; c < 3; c++) {
+        fit.endpoints[0][c] = quantizeEndpoint(endpoints[0][c]);
+        fit.endpoints[1][c] = quantizeEndpoint(endpoints[1][c]);
+        const int32_t unquantized0 = unquantizeEndpoint(fit.endpoints[0][c]);
+        const int32_t unquantized1 = unquantizeEndpoint(fit.endpoints[1][c]);
+        for (uint32_t i = 0; i < 16; i++) palette[i][c] = decodeHalf(unquantized0, unquantized1, BC6H_WEIGHTS[i]);
+    }
+
+    for (uint32_t i = 0; i < 16; i++) {
+        int64_t bestError = INT64_MAX;
+        for (uint32_t j = 0; j < 16; j++) {
+            int64_t error = 0;
+            for (uint32_t c = 0; c < 3; c++) {
+                const int64_t difference = palette[j][c] - texels[i][c];
+                error += difference * difference;
+            }
+            if (error < bestError) {
+                bestError = error;
+                fit.indices[i] = j;
+            }
+        }
+        fit.error += bestError;
+    }
+    return fit;
+}
+
+static void compressBc6hBlock(const std::array<std::array<int32_t, 3>, 16> &texels, uint8_t *block)
+{
+    std::array<float, 3> mean{};
+    for (const std::array<int32_t, 3> &texel : texels) for (uint32_t c = 0; c < 3; c++) mean[c] += texel[c] / 16.0f;
+    std::array<float, 6> covariance{};
+    for (const std::array<int32_t, 3> &texel : texels) {
+        const float r = texel[0] - mean[0];
+        const float g = texel[1] - mean[1];
+        const float b = texel[2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    // Power iteration for the principal axis, and the endpoints are where the texels' projections onto it end
+    std::array<float, 3> axis = {1.0f, 1.0f, 1.0f};
+    for (uint32_t i = 0; i < 8; i++) {
+        const std::array<float, 3> next = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]};
+        const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f) break;
+        axis = {next[0] / length, next[1] / length, next[2] / length};
+    }
+    float minProjection = INFINITY;
+    float maxProjection = -INFINITY;
+    for (const std::array<int32_t, 3> &texel : texels) {
+        const float projection = (texel[0] - mean[0]) * axis[0] + (texel[1] - mean[1]) * axis[1] + (texel[2] - mean[2]) * axis[2];
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+    std::array<std::array<float, 3>, 2> axisEndpoints;
+    std::array<std::array<float, 3>, 2> boxEndpoints = {{{INFINITY, INFINITY, INFINITY}, {-INFINITY, -INFINITY, -INFINITY}}};
+    for (uint32_t c = 0; c < 3; c++) {
+        axisEndpoints[0][c] = mean[c] + axis[c] * minProjection;
+        axisEndpoints[1][c] = mean[c] + axis[c] * maxProjection;
+        for (const std::array<int32_t, 3> &texel : texels) {
+            boxEndpoints[0][c] = std::min(boxEndpoints[0][c], static_cast<float>(texel[c]));
+            boxEndpoints[1][c] = std::max(boxEndpoints[1][c], static_cast<float>(texel[c]));
+        }
+    }
+
+    // The principal axis fits most blocks better, but the bounding box diagonal wins on some with little variation
+    Bc6hFit fit = fitIndices(texels, axisEndpoints);
+    const Bc6hFit boxFit = fitIndices(texels, boxEndpoints);
+    if (boxFit.error < fit.error) fit = boxFit;
+
+    // The first index only has 3 bits, so its top bit has to be zero, which swapping the endpoints guarantees
+    if (fit.indices[0] & 0x8) {
+        std::swap(fit.endpoints[0], fit.endpoints[1]);
+        for (uint8_t &index : fit.indices) index = 15 - index;
+    }
+
+    std::array<uint64_t, 2> bits{};
+    uint32_t bitPos = 0;
+    auto writeBits = [&](uint64_t value, uint32_t bitCount) {
+        for (uint32_t i = 0; i < bitCount; i++, bitPos++) bits[bitPos / 64] |= ((value >> i) & 1) << (bitPos % 64);
+    };
+    writeBits(BC6H_MODE_11, 5);
+    for (uint32_t e = 0; e < 2; e++) for (uint32_t c = 0; c < 3; c++) writeBits(fit.endpoints[e][c], 10);
+    writeBits(fit.indices[0], 3);
+    for (uint32_t i = 1; i < 16; i++) writeBits(fit.indices[i], 4);
+    memcpy(block, bits.data(), sizeof(bits));
+}
+
+void compressBc6hBlockRows(const uint16_t *rgbaHalfs, uint32_t width, uint32_t height, uint32_t firstBlockRow,
+        uint32_t blockRowCount, uint8_t *blocks)
+{
+    const uint32_t blocksPerRow = (width + 3) / 4;
+    for (uint32_t blockY = firstBlockRow; blockY < firstBlockRow + blockRowCount; blockY++) {
+        for (uint32_t blockX = 0; blockX < blocksPerRow; blockX++) {
+            std::array<std::array<int32_t, 3>, 16> texels;
+            for (uint32_t i = 0; i < 16; i++) {
+                const uint32_t x = std::min(blockX * 4 + i % 4, width - 1);
+                const uint32_t y = std::min(blockY * 4 + i / 4, height - 1);
+                const uint16_t *texel = rgbaHalfs + (static_cast<size_t>(y) * width + x) * 4;
+                for (uint32_t c = 0; c < 3; c++) texels[i][c] = getEncodableHalf(texel[c]);
+            }
+            compressBc6hBlock(texels, blocks + (static_cast<size_t>(blockY) * blocksPerRow + blockX) * 16);
+        }
+    }
+}
+
+}
@@ -1,12 +1,16 @@
 #include "vul_command_pool.hpp"
 #include <vul_debug_tools.hpp>
 #include<vul_buffer.hpp>
+#include <vul_staging_ring.hpp>
 
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
+#include <string>
 #include <iostream>
 #include <vulkan/vulkan_core.h>
 #include <cassert>
+#include <utility>
 
 namespace vul {
 
@@ -20,17 +24,52 @@ VulBuffer::VulBuffer(const VulDevice &vulDevice) : m_vulDevice{vulDevice}
 {
 }
 
+VulBuffer::VulBuffer(VulBuffer &&other) noexcept
+    : m_vulDevice{other.m_vulDevice}, m_elementSize{other.m_elementSize}, m_elementCount{other.m_elementCount},
+    m_capacityCount{other.m_capacityCount}, m_elementStride{other.m_elementStride}, m_mapped{std::exchange(other.m_mapped, nullptr)},
+    m_mappedOffset{std::exchange(other.m_mappedOffset, 0)}, m_buffer{std::exchange(other.m_buffer, VK_NULL_HANDLE)},
+    m_allocation{std::exchange(other.m_allocation, VulAllocator::Allocation{})}, m_bufferSize{other.m_bufferSize},
+    m_usageFlags{other.m_usageFlags}, m_memoryPropertyFlags{other.m_memoryPropertyFlags}, m_isDeviceLocal{other.m_isDeviceLocal},
+    m_isDynamicLocal{other.m_isDynamicLocal}
+{
+}
+
 VulBuffer::~VulBuffer()
 {
     unmap();
     vkDestroyBuffer(m_vulDevice.device(), m_buffer, nullptr);
-    vkFreeMemory(m_vulDevice.device(), m_memory, nullptr);
+    m_vulDevice.getAllocator().free(m_allocation);
 }
 
 VkResult VulBuffer::createBuffer(uint32_t elementSize, uint32_t elementCount, bool isLocal, VkBufferUsageFlags usage)
 {
     VUL_PROFILE_FUNC()
 
+    m_isDynamicLocal = false;
+    return initBuffer(elementSize, elementCount, isLocal, usage);
+}
+
+VkResult VulBuffer::createDynamicLocalBuffer(uint32_t elementSize, uint32_t elementCount, VkBufferUsageFlags usage)
+{
+    VUL_PROFILE_FUNC()
+
+    m_isDynamicLocal = true;
+    VkResult result = initBuffer(elementSize, elementCount, false, usage);
+    if (result != VK_SUCCESS) return result;
+    return mapAll();
+}
+
+std::unique_ptr<VulBuffer> VulBuffer::createDynamicLocal(uint32_t elementSize, uint32_t elementCount, VkBufferUsageFlags usage,
+        const VulDevice &vulDevice)
+{
+    std::unique_ptr<VulBuffer> buffer = std::make_unique<VulBuffer>(vulDevice);
+    VkResult result = buffer->createDynamicLocalBuffer(elementSize, elementCount, usage);
+    if (result != VK_SUCCESS) throw std::runtime_error("Failed to create dynamic local buffer. Error: " + std::to_string(result));
+    return buffer;
+}
+
+VkResult VulBuffer::initBuffer(uint32_t elementSize, uint32_t elementCount, bool isLocal, VkBufferUsageFlags usage)
+{
     if ((usage & (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) == (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
         throw std::runtime_error("Buffer can't be both storage and uniform buffer");
     if ((usage & (VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)) == (VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT))
@@ -38,18 +77,25 @@ VkResult VulBuffer::createBuffer(uint32_t elementSize, uint32_t elementCount, bo
     m_usageFlags = usage; 
     m_memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     if (!isLocal) m_memoryPropertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (m_isDynamicLocal) m_memoryPropertyFlags |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     m_isDeviceLocal = isLocal;
     m_elementSize = elementSize;
     m_elementCount = elementCount;
 
     VkDeviceSize minOffsetAlignment = 1;
     if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) minOffsetAlignment = m_vulDevice.properties.limits.minUniformBufferOffsetAlignment;
-    VkDeviceSize alignment = (m_elementSize + minOffsetAlignment - 1) & ~(minOffsetAlignment - 1);
-    m_bufferSize = alignment * m_elementCount;
+    m_elementStride = (m_elementSize + minOffsetAlignment - 1) & ~(minOffsetAlignment - 1);
+    m_bufferSize = m_elementStride * m_elementCount;
+    m_capacityCount = m_elementCount;
+
+    return allocateBuffer(m_bufferSize);
+}
 
+VkResult VulBuffer::allocateBuffer(VkDeviceSize size)
+{
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = m_bufferSize;
+    bufferInfo.size = size;
     bufferInfo.usage = m_usageFlags;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
@@ -59,26 +105,16 @@ VkResult VulBuffer::createBuffer(uint32_t elementSize, uint32_t elementCount, bo
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(m_vulDevice.device(), m_buffer, &memRequirements);
 
-    VkMemoryAllocateFlagsInfo memAllocFlagsInfo{};
-    memAllocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    if ((usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) == VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) memAllocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.pNext = &memAllocFlagsInfo;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_vulDevice.findMemoryType(memRequirements.memoryTypeBits, m_memoryPropertyFlags);
-    
-    result = vkAllocateMemory(m_vulDevice.device(), &allocInfo, nullptr, &m_memory);
+    if (m_isDynamicLocal && !m_vulDevice.getAllocator().hasMemoryType(memRequirements.memoryTypeBits, m_memoryPropertyFlags))
+        m_memoryPropertyFlags &= ~VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    result = m_vulDevice.getAllocator().allocate(memRequirements, m_memoryPropertyFlags, VulAllocator::ResourceType::linear, m_allocation);
     if (result != VK_SUCCESS) return result;
-    result = vkBindBufferMemory(m_vulDevice.device(), m_buffer, m_memory, 0);
+    result = vkBindBufferMemory(m_vulDevice.device(), m_buffer, m_allocation.memory, m_allocation.offset);
     if (result != VK_SUCCESS) return result;
 
     VUL_NAME_VK(m_buffer)
-    VUL_NAME_VK(m_memory)
 
     return VK_SUCCESS;
-
 }
 
 VkResult VulBuffer::writeData(const void *data, VkDeviceSize size, VkDeviceSize offset, VkCommandBuffer commandBuffer)
@@ -89,11 +125,16 @@ VkResult VulBuffer::writeData(const void *data, VkDeviceSize size, VkDeviceSize
 
     if (m_buffer == nullptr) throw std::runtime_error("Tried to write to buffer before it was created");
     if (m_isDeviceLocal) {
-        VkResult result = addStagingBuffer();
-        if (result != VK_SUCCESS) return result;
-        result = m_stagingBuffer->writeData(data, size, offset, commandBuffer);
-        if (result != VK_SUCCESS) return result;
-        copyDataFromBuffer(*m_stagingBuffer, size, offset, offset, commandBuffer);
+        if (!(m_usageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT)) throw std::runtime_error("Writing to device local buffer needs transfer dst usage flag");
+        if (size + offset > m_bufferSize) throw std::runtime_error("Size + offset of the written data must be at most equal to the size of the buffer");
+        VulStagingRing::Allocation staging = m_vulDevice.getStagingRing().allocate(size, VulStagingRing::DEFAULT_ALIGNMENT, commandBuffer);
+        memcpy(staging.mapped, data, size);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = staging.offset;
+        copyRegion.dstOffset = offset;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(commandBuffer, staging.buffer, m_buffer, 1, &copyRegion);
     }
     else {
         bool needUnmapping = false;
@@ -102,8 +143,7 @@ VkResult VulBuffer::writeData(const void *data, VkDeviceSize size, VkDeviceSize
             VkResult result = map(size, offset);
             if (result != VK_SUCCESS) return result;
         }
-        VkDeviceSize neededOffset = (m_mapped == nullptr) ? offset : 0;
-        memcpy(reinterpret_cast<char *>(m_mapped) + neededOffset, data, size);
+        memcpy(reinterpret_cast<char *>(m_mapped) + offset - m_mappedOffset, data, size);
         if (needUnmapping) unmap();
     }
     return VK_SUCCESS;
@@ -115,16 +155,23 @@ VkResult VulBuffer::readData(void *data, VkDeviceSize size, VkDeviceSize offset,
     if (size == 0) return VK_SUCCESS;
 
     if (m_isDeviceLocal) {
-        VkResult result = addStagingBuffer();
-        if (result != VK_SUCCESS) return result;
+        if (!(m_usageFlags & VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) throw std::runtime_error("Reading from device local buffer needs transfer src usage flag");
         VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
-        m_stagingBuffer->copyDataFromBuffer(*this, size, offset, 0, cmdBuf);
+        VulStagingRing &stagingRing = m_vulDevice.getStagingRing();
+        VulStagingRing::Allocation staging = stagingRing.allocateForReadback(size, VulStagingRing::DEFAULT_ALIGNMENT, cmdBuf);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = offset;
+        copyRegion.dstOffset = staging.offset;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(cmdBuf, m_buffer, staging.buffer, 1, &copyRegion);
         cmdPool.submit(cmdBuf, true);
-        memcpy(data, m_stagingBuffer->getMappedMemory(), size);
+        memcpy(data, staging.mapped, size);
+        stagingRing.release(staging);
     } else {
         VkResult result = map(size, offset);
         if (result != VK_SUCCESS) return result;
-        memcpy(data, m_mapped, size);
+        memcpy(data, reinterpret_cast<char *>(m_mapped) + offset - m_mappedOffset, size);
     }
     return VK_SUCCESS;
 }
@@ -155,17 +202,20 @@ VkResult VulBuffer::map(VkDeviceSize size, VkDeviceSize offset)
 
     if (m_buffer == nullptr) throw std::runtime_error("Tried to map buffer before it was created");
     if (m_isDeviceLocal) throw std::runtime_error("Cannot map device local buffer");
-    return vkMapMemory(m_vulDevice.device(), m_memory, offset, size, 0, &m_mapped);
+    // The memory block stays mapped for its whole life, so mapping only picks the pointer
+    if (m_allocation.mapped == nullptr) return VK_ERROR_MEMORY_MAP_FAILED;
+    if (size != VK_WHOLE_SIZE && size + offset > m_bufferSize) throw std::runtime_error("Tried to map past the end of the buffer");
+    m_mapped = static_cast<char *>(m_allocation.mapped) + offset;
+    m_mappedOffset = offset;
+    return VK_SUCCESS;
 }
 
 void VulBuffer::unmap()
 {
     VUL_PROFILE_FUNC()
 
-    if (m_mapped){
-        vkUnmapMemory(m_vulDevice.device(), m_memory);
-        m_mapped = nullptr;
-    }
+    m_mapped = nullptr;
+    m_mappedOffset = 0;
 }
 
 VkResult VulBuffer::resizeBufferWithData(const void *data, uint32_t elementSize, uint32_t elementCount, VkCommandBuffer commandBuffer)
@@ -174,12 +224,13 @@ VkResult VulBuffer::resizeBufferWithData(const void *data, uint32_t elementSize,
 
     unmap();
     vkDestroyBuffer(m_vulDevice.device(), m_buffer, nullptr);
-    vkFreeMemory(m_vulDevice.device(), m_memory, nullptr);
+    m_vulDevice.getAllocator().free(m_allocation);
 
     m_elementSize = elementSize;
     m_elementCount = elementCount;
 
-    VkResult result = createBuffer(elementSize, elementCount, m_isDeviceLocal, m_usageFlags);
+    VkResult result = m_isDynamicLocal ? createDynamicLocalBuffer(elementSize, elementCount, m_usageFlags) :
+        createBuffer(elementSize, elementCount, m_isDeviceLocal, m_usageFlags);
     if (result != VK_SUCCESS) return result;
     return writeData(data, m_bufferSize, 0, commandBuffer);
 }
@@ -188,53 +239,101 @@ VkResult VulBuffer::reallocElsewhere(bool isLocal, VkCommandBuffer commandBuffer
 {
     VUL_PROFILE_FUNC()
 
-    VkResult result = addStagingBuffer();
-    if (result != VK_SUCCESS) return result;
-    copyDataFromBuffer(*this, m_bufferSize, 0, 0, commandBuffer);
+    if ((m_usageFlags & (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT))
+        throw std::runtime_error("Reallocating buffer needs transfer src and dst usage flags");
 
-    m_isDeviceLocal = isLocal;
-    result = resizeBufferWithData(nullptr, m_elementSize, m_elementCount, commandBuffer);
+    unmap();
+    VkBuffer oldBuffer = m_buffer;
+    VulAllocator::Allocation oldAllocation = m_allocation;
+    m_allocation = VulAllocator::Allocation{};
+    VkResult result = createBuffer(m_elementSize, m_elementCount, isLocal, m_usageFlags);
     if (result != VK_SUCCESS) return result;
 
-    copyDataFromBuffer(*m_stagingBuffer.get(), m_bufferSize, 0, 0, commandBuffer);
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = 0;
+    copyRegion.dstOffset = 0;
+    copyRegion.size = m_bufferSize;
+    vkCmdCopyBuffer(commandBuffer, oldBuffer, m_buffer, 1, &copyRegion);
+    m_vulDevice.getStagingRing().destroyAfterUse(oldBuffer, oldAllocation, commandBuffer);
     return VK_SUCCESS;
 }
 
-VkResult VulBuffer::appendData(const void *data, uint32_t elementCount, VulCmdPool &cmdPool)
+VkResult VulBuffer::appendData(const void *data, uint32_t elementCount, VkCommandBuffer commandBuffer)
 {
     VUL_PROFILE_FUNC()
 
     if (elementCount == 0) return VK_SUCCESS;
 
-    std::vector<uint8_t> newData(m_bufferSize + m_elementSize * elementCount);
-
-    if (hasStagingBuffer()) {
-        VkResult result = m_stagingBuffer->resizeBufferAsEmpty(m_elementSize, m_elementCount + elementCount);
-        if (result != VK_SUCCESS) return result;
-        result = m_stagingBuffer->mapAll();
+    const uint32_t requiredCount = m_elementCount + elementCount;
+    if (requiredCount > m_capacityCount) {
+        VkResult result = reserve(std::max(requiredCount, m_capacityCount * 2), commandBuffer);
         if (result != VK_SUCCESS) return result;
     }
 
-    VkResult result = readData(newData.data(), m_bufferSize, 0, cmdPool);
-    if (result != VK_SUCCESS) return result;
-    if (data != nullptr) memcpy(newData.data() + m_bufferSize, data, m_elementSize * elementCount);
+    const VkDeviceSize oldSize = m_bufferSize;
+    m_elementCount = requiredCount;
+    m_bufferSize = m_elementStride * m_elementCount;
+    return writeData(data, static_cast<VkDeviceSize>(m_elementSize) * elementCount, oldSize, commandBuffer);
+}
 
+VkResult VulBuffer::appendData(const void *data, uint32_t elementCount, VulCmdPool &cmdPool)
+{
     VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
-    result = resizeBufferWithData(newData.data(), m_elementSize, elementCount + m_elementCount, cmdBuf);
+    VkResult result = appendData(data, elementCount, cmdBuf);
     cmdPool.submit(cmdBuf, true);
     return result;
 }
 
-VkResult VulBuffer::addStagingBuffer()
+VkResult VulBuffer::reserve(uint32_t elementCount, VkCommandBuffer commandBuffer)
 {
     VUL_PROFILE_FUNC()
 
-    if (m_stagingBuffer.get()) return VK_SUCCESS;
+    if (elementCount <= m_capacityCount) return VK_SUCCESS;
+    if (m_buffer == nullptr) throw std::runtime_error("Tried to grow buffer before it was created");
+    if (m_isDeviceLocal && (m_usageFlags & (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT))
+        throw std::runtime_error("Growing device local buffer needs transfer src and dst usage flags");
+    if (m_isDeviceLocal && commandBuffer == VK_NULL_HANDLE) throw std::runtime_error("Growing device local buffer needs a command buffer to copy in");
 
-    m_stagingBuffer = std::make_unique<VulBuffer>(m_vulDevice);
-    VkResult result = m_stagingBuffer->createBuffer(m_elementSize, m_elementCount, false, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-    if (result != VK_SUCCESS) return result;
-    return m_stagingBuffer->mapAll();
+    const bool wasMapped = m_mapped != nullptr;
+    const VkDeviceSize mappedOffset = m_mappedOffset;
+    unmap();
+    VkBuffer oldBuffer = m_buffer;
+    VulAllocator::Allocation oldAllocation = m_allocation;
+    m_buffer = VK_NULL_HANDLE;
+    m_allocation = VulAllocator::Allocation{};
+    VkResult result = allocateBuffer(m_elementStride * elementCount);
+    if (result != VK_SUCCESS) {
+        vkDestroyBuffer(m_vulDevice.device(), m_buffer, nullptr);
+        m_vulDevice.getAllocator().free(m_allocation);
+        m_buffer = oldBuffer;
+        m_allocation = oldAllocation;
+        return result;
+    }
+
+    if (m_bufferSize > 0 && m_isDeviceLocal) {
+        // Writes to the old buffer recorded earlier must land before they are copied over
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = 0;
+        copyRegion.dstOffset = 0;
+        copyRegion.size = m_bufferSize;
+        vkCmdCopyBuffer(commandBuffer, oldBuffer, m_buffer, 1, &copyRegion);
+    } else if (m_bufferSize > 0) memcpy(m_allocation.mapped, oldAllocation.mapped, m_bufferSize);
+
+    if (commandBuffer != VK_NULL_HANDLE) m_vulDevice.getStagingRing().destroyAfterUse(oldBuffer, oldAllocation, commandBuffer);
+    else {
+        vkDestroyBuffer(m_vulDevice.device(), oldBuffer, nullptr);
+        m_vulDevice.getAllocator().free(oldAllocation);
+    }
+    m_capacityCount = elementCount;
+
+    if (wasMapped) return map(VK_WHOLE_SIZE, mappedOffset);
+    return VK_SUCCESS;
 }
 
 }
@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <iostream>
 #include <vul_command_pool.hpp>
+#include <vul_staging_ring.hpp>
 #include <vulkan/vulkan_core.h>
 
 namespace vul {
@@ -114,6 +115,7 @@ void VulCmdPool::submit(VkCommandBuffer commandBuffer, bool wait)
             submitInfo.pCommandBuffers = &commandBuffer;
             result = vkQueueSubmit(m_queue, 1, &submitInfo, m_fences[i]);
             assert(result == VK_SUCCESS);
+            m_vulDevice.getStagingRing().onSubmit(commandBuffer, m_fences[i]);
 
                 result = vkWaitForFences(m_vulDevice.device(), 1, &m_fences[i], VK_TRUE, UINT64_MAX);
                 assert(result == VK_SUCCESS);
@@ -163,6 +165,7 @@ VkSemaphore VulCmdPool::submitAndSynchronize(VkCommandBuffer commandBuffer, VkSe
             }
             result = vkQueueSubmit(m_queue, 1, &submitInfo, m_fences[i]);
             assert(result == VK_SUCCESS);
+            m_vulDevice.getStagingRing().onSubmit(commandBuffer, m_fences[i]);
 
             if (wait) {
                 result = vkWaitForFences(m_vulDevice.device(), 1, &m_fences[i], VK_TRUE, UINT64_MAX);
@@ -125,4 +125,12 @@ void VulCompPipeline::end(bool waitForSubmitToFinish)
     m_frame = (m_frame + 1) % m_maxFramesInFlight;
 }
 
+void VulCompPipeline::recordDispatch(VkCommandBuffer cmdBuf, const std::vector<VkDescriptorSet> &sets, uint32_t x, uint32_t y, uint32_t z)
+{
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_layout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+    vkCmdPushConstants(cmdBuf, m_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, pushSize, pPushData);
+    vkCmdDispatch(cmdBuf, x, y, z);
+}
+
 }
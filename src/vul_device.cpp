@@ -2,6 +2,8 @@
 #include <cassert>
 #include <vul_debug_tools.hpp>
 #include<vul_device.hpp>
+#include <vul_allocator.hpp>
+#include <vul_staging_ring.hpp>
 #include <vul_extensions.hpp>
 
 // std headers
@@ -63,6 +65,7 @@ VulDevice::VulDevice(VulWindow &window, uint32_t maxSideQueueCount, bool enableM
     createSurface();
     pickPhysicalDevice();
     createLogicalDevice(maxSideQueueCount, enableMeshShading, enableRayTracing);
+    m_allocator = std::make_unique<VulAllocator>(device_, physicalDevice, m_bufferDeviceAddressEnabled);
 
     DebugNamer::initialize(*this);
     VUL_NAME_VK(instance)
@@ -73,9 +76,13 @@ VulDevice::VulDevice(VulWindow &window, uint32_t maxSideQueueCount, bool enableM
     VUL_NAME_VK(m_computeQueue)
     VUL_NAME_VK(m_transferQueue);
     for (size_t i = 0; i < m_sideQueues.size(); i++) VUL_NAME_VK_IDX(m_sideQueues[i], i)
+
+    m_stagingRing = std::make_unique<VulStagingRing>(device_, *m_allocator);
 }
 
 VulDevice::~VulDevice() {
+    m_stagingRing.reset();
+    m_allocator.reset();
     vkDestroyDevice(device_, nullptr);
 
     if (enableValidationLayers) {
@@ -243,6 +250,7 @@ void VulDevice::createLogicalDevice(uint32_t maxSideQueueCount, bool enableMeshS
             VK_SUCCESS) {
         throw std::runtime_error("failed to create logical device!");
     }
+    m_bufferDeviceAddressEnabled = physicalFeaturesVulkan12.bufferDeviceAddress;
 
     vkGetDeviceQueue(device_, m_queueFamilyIndices.mainFamily, 0, &m_mainQueue);
     vkGetDeviceQueue(device_, m_queueFamilyIndices.computeFamily, 0, &m_computeQueue);
@@ -1,10 +1,17 @@
 #include "vul_command_pool.hpp"
 #include "vul_device.hpp"
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <cstdlib>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/quaternion_float.hpp>
 #include <glm/ext/quaternion_transform.hpp>
@@ -13,6 +20,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <numeric>
 #include <ratio>
 #include <set>
 #include <functional>
@@ -24,24 +32,504 @@
 #include <future>
 
 #include <thread>
+#include <type_traits>
 #include <unordered_set>
 #include<vul_gltf_loader.hpp>
-#include<vul_transform.hpp>
+#include<vul_completion_queue.hpp>
+#include<vul_hash.hpp>
+#include<vul_texture_registry.hpp>
+#include<vul_debug_tools.hpp>
 #include <vulkan/vulkan_core.h>
 
 #include <tiny_gltf.h>
+#include <json.hpp>
+#include <meshoptimizer/src/meshoptimizer.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 
 namespace vul
 {
 
+// Goes through the positions as a flat float array in blocks of 4 vertices. A block is 12 floats which is exactly three
+// 4 wide vector registers, so the inner loop compiles into packed min and max instructions without any shuffling
+static void calculatePositionBounds(const glm::vec3 *positions, size_t count, glm::vec3 &outMin, glm::vec3 &outMax)
+{
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float));
+    constexpr size_t BLOCK_VERTEX_COUNT = 4;
+    constexpr size_t BLOCK_FLOAT_COUNT = BLOCK_VERTEX_COUNT * 3;
+
+    float blockMin[BLOCK_FLOAT_COUNT];
+    float blockMax[BLOCK_FLOAT_COUNT];
+    std::fill(std::begin(blockMin), std::end(blockMin), std::numeric_limits<float>::max());
+    std::fill(std::begin(blockMax), std::end(blockMax), -std::numeric_limits<float>::max());
+
+    const float *data = reinterpret_cast<const float *>(positions);
+    const size_t blockCount = count / BLOCK_VERTEX_COUNT;
+    for (size_t block = 0; block < blockCount; block++) {
+        const float *blockData = data + block * BLOCK_FLOAT_COUNT;
+        for (size_t i = 0; i < BLOCK_FLOAT_COUNT; i++) {
+            blockMin[i] = blockData[i] < blockMin[i] ? blockData[i] : blockMin[i];
+            blockMax[i] = blockData[i] > blockMax[i] ? blockData[i] : blockMax[i];
+        }
+    }
+
+    outMin = glm::vec3(std::numeric_limits<float>::max());
+    outMax = glm::vec3(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < BLOCK_FLOAT_COUNT; i++) {
+        outMin[i % 3] = std::min(outMin[i % 3], blockMin[i]);
+        outMax[i % 3] = std::max(outMax[i % 3], blockMax[i]);
+    }
+    for (size_t i = blockCount * BLOCK_VERTEX_COUNT; i < count; i++) {
+        outMin = glm::min(outMin, positions[i]);
+        outMax = glm::max(outMax, positions[i]);
+    }
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define VUL_VECTOR_DECODE
+
+// Float, snorm16 and unorm8 elements of at least two components, which is what positions, normals, tangents, uvs and colors
+// are stored as almost always, get decoded with one vector load, convert, multiply and store each
+template<typename SrcT, size_t SRC_COMPONENTS, size_t DST_COMPONENTS>
+static constexpr bool hasVectorDecode()
+{
+    return (std::is_same_v<SrcT, float> || std::is_same_v<SrcT, int16_t> || std::is_same_v<SrcT, uint8_t>)
+        && SRC_COMPONENTS >= 2 && DST_COMPONENTS >= 2;
+}
+
+static uint32_t loadU32(const uint8_t *src)
+{
+    uint32_t bits;
+    memcpy(&bits, src, sizeof(bits));
+    return bits;
+}
+
+#if defined(__SSE2__)
+using Float4 = __m128;
+
+// Loads at most twice the size of the element, and the lanes past SRC_COMPONENTS hold whatever came after it
+template<typename SrcT, size_t SRC_COMPONENTS>
+static Float4 loadElement(const uint8_t *src)
+{
+    if constexpr (std::is_same_v<SrcT, float>) {
+        if constexpr (SRC_COMPONENTS == 2) return _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src)));
+        else return _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+    } else if constexpr (std::is_same_v<SrcT, int16_t>) {
+        const __m128i bits = SRC_COMPONENTS == 2 ? _mm_cvtsi32_si128(loadU32(src)) : _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src));
+        return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(bits, bits), 16));
+    } else {
+        const __m128i zero = _mm_setzero_si128();
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(loadU32(src)), zero), zero));
+    }
+}
+
+// The clamp value goes first so that nans stay nans like in the scalar path
+static Float4 scaleAndClamp(Float4 value, float scale, float minValue)
+{
+    return _mm_max_ps(_mm_set1_ps(minValue), _mm_mul_ps(value, _mm_set1_ps(scale)));
+}
+
+template<size_t COPIED_COMPONENTS>
+static Float4 fillMissingComponents(Float4 value)
+{
+    if constexpr (COPIED_COMPONENTS == 4) return value;
+    const __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, COPIED_COMPONENTS > 2 ? -1 : 0, 0));
+    return _mm_or_ps(_mm_and_ps(mask, value), _mm_andnot_ps(mask, _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+// Three component elements get four floats written, the last of which belongs to the next element
+template<size_t DST_COMPONENTS>
+static void storeElement(float *dst, Float4 value)
+{
+    if constexpr (DST_COMPONENTS == 2) _mm_storel_epi64(reinterpret_cast<__m128i *>(dst), _mm_castps_si128(value));
+    else _mm_storeu_ps(dst, value);
+}
+#else
+using Float4 = float32x4_t;
+
+template<typename SrcT, size_t SRC_COMPONENTS>
+static Float4 loadElement(const uint8_t *src)
+{
+    if constexpr (std::is_same_v<SrcT, float>) {
+        if constexpr (SRC_COMPONENTS == 2) return vcombine_f32(vreinterpret_f32_u8(vld1_u8(src)), vdup_n_f32(0.0f));
+        else return vreinterpretq_f32_u8(vld1q_u8(src));
+    } else if constexpr (std::is_same_v<SrcT, int16_t>) {
+        const int16x4_t bits = SRC_COMPONENTS == 2 ? vreinterpret_s16_u32(vdup_n_u32(loadU32(src))) : vreinterpret_s16_u8(vld1_u8(src));
+        return vcvtq_f32_s32(vmovl_s16(bits));
+    } else {
+        const uint8x8_t bytes = vreinterpret_u8_u32(vdup_n_u32(loadU32(src)));
+        return vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(bytes))));
+    }
+}
+
+static Float4 scaleAndClamp(Float4 value, float scale, float minValue)
+{
+    return vmaxq_f32(vmulq_n_f32(value, scale), vdupq_n_f32(minValue));
+}
+
+template<size_t COPIED_COMPONENTS>
+static Float4 fillMissingComponents(Float4 value)
+{
+    if constexpr (COPIED_COMPONENTS == 4) return value;
+    const uint32_t maskBits[4] = {~0u, ~0u, COPIED_COMPONENTS > 2 ? ~0u : 0u, 0u};
+    const float fill[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    return vbslq_f32(vld1q_u32(maskBits), value, vld1q_f32(fill));
+}
+
+template<size_t DST_COMPONENTS>
+static void storeElement(float *dst, Float4 value)
+{
+    if constexpr (DST_COMPONENTS == 2) vst1_f32(dst, vget_low_f32(value));
+    else vst1q_f32(dst, value);
+}
+#endif
+#endif
+
+// Decodes count elements of SRC_COMPONENTS components each into tightly packed floats, which also works for interleaved and
+// strided views. The common vertex formats go through the vector path above, everything else through the scalar loop
+template<typename SrcT, size_t SRC_COMPONENTS, size_t DST_COMPONENTS>
+static void decodeElements(const uint8_t *src, size_t stride, float *dst, size_t count, float scale, float minValue)
+{
+    constexpr size_t COPIED_COMPONENTS = std::min(SRC_COMPONENTS, DST_COMPONENTS);
+    size_t i = 0;
+#ifdef VUL_VECTOR_DECODE
+    if constexpr (hasVectorDecode<SrcT, SRC_COMPONENTS, DST_COMPONENTS>()) {
+        // Loads and stores can reach into the following element, so the last one is left to the scalar loop
+        for (; i + 1 < count; i++) {
+            const Float4 element = scaleAndClamp(loadElement<SrcT, SRC_COMPONENTS>(src + stride * i), scale, minValue);
+            storeElement<DST_COMPONENTS>(dst + DST_COMPONENTS * i, fillMissingComponents<COPIED_COMPONENTS>(element));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        SrcT element[SRC_COMPONENTS];
+        memcpy(element, src + stride * i, sizeof(element));
+        float *out = dst + DST_COMPONENTS * i;
+        for (size_t c = 0; c < COPIED_COMPONENTS; c++) out[c] = std::max(static_cast<float>(element[c]) * scale, minValue);
+        for (size_t c = COPIED_COMPONENTS; c < DST_COMPONENTS; c++) out[c] = c == 3 ? 1.0f : 0.0f;
+    }
+}
+
+template<typename SrcT, size_t DST_COMPONENTS>
+static void decodeComponents(size_t srcComponents, const uint8_t *src, size_t stride, float *dst, size_t count, float scale, float minValue)
+{
+    switch (srcComponents) {
+        case 1: decodeElements<SrcT, 1, DST_COMPONENTS>(src, stride, dst, count, scale, minValue); break;
+        case 2: decodeElements<SrcT, 2, DST_COMPONENTS>(src, stride, dst, count, scale, minValue); break;
+        case 3: decodeElements<SrcT, 3, DST_COMPONENTS>(src, stride, dst, count, scale, minValue); break;
+        case 4: decodeElements<SrcT, 4, DST_COMPONENTS>(src, stride, dst, count, scale, minValue); break;
+        default: throw std::runtime_error("Unsupported accessor component count: " + std::to_string(srcComponents));
+    }
+}
+
+template<size_t DST_COMPONENTS>
+static void decodeAccessorElements(const tinygltf::Accessor &accessor, size_t srcComponents, const uint8_t *src, size_t stride, float *dst, size_t count)
+{
+    const float noClamp = -std::numeric_limits<float>::infinity();
+    switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+            decodeComponents<float, DST_COMPONENTS>(srcComponents, src, stride, dst, count, 1.0f, noClamp);
+            break;
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+            decodeComponents<int8_t, DST_COMPONENTS>(srcComponents, src, stride, dst, count,
+                    accessor.normalized ? 1.0f / 127.0f : 1.0f, accessor.normalized ? -1.0f : noClamp);
+            break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            decodeComponents<uint8_t, DST_COMPONENTS>(srcComponents, src, stride, dst, count,
+                    accessor.normalized ? 1.0f / 255.0f : 1.0f, noClamp);
+            break;
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+            decodeComponents<int16_t, DST_COMPONENTS>(srcComponents, src, stride, dst, count,
+                    accessor.normalized ? 1.0f / 32767.0f : 1.0f, accessor.normalized ? -1.0f : noClamp);
+            break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            decodeComponents<uint16_t, DST_COMPONENTS>(srcComponents, src, stride, dst, count,
+                    accessor.normalized ? 1.0f / 65535.0f : 1.0f, noClamp);
+            break;
+        default:
+            throw std::runtime_error(std::string("Accessor component type not supported. Its type is ") + std::to_string(accessor.componentType));
+    }
+}
+
+// Order in which the texture workers should pick up the files, largest first. File size is a good enough estimate of the
+// transcoding work
+static std::vector<uint32_t> getLargestFirstOrder(const std::vector<std::string> &files)
+{
+    std::vector<uintmax_t> fileSizes(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        std::error_code error;
+        fileSizes[i] = files[i].empty() ? 0 : std::filesystem::file_size(files[i], error);
+        if (error) fileSizes[i] = 0;
+    }
+    std::vector<uint32_t> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&fileSizes](uint32_t a, uint32_t b) {return fileSizes[a] > fileSizes[b];});
+    return order;
+}
+
+// Hands the images of one load to a pool of threads, largest file first. startLoad returns a big UASTC texture split into
+// transcode tasks over bands of its block rows, and the threads run those before opening any further image, so the biggest
+// texture gets spread over every thread instead of setting the load time on one of them. onLoaded is called from whichever
+// thread completed an image, and returning false from it stops that thread
+class TextureLoadPool {
+    public:
+        using StartLoad = std::function<std::unique_ptr<VulImage::KtxLoad>(uint32_t imgIdx)>;
+        using OnLoaded = std::function<bool(uint32_t imgIdx, std::stop_token stoken)>;
+
+        TextureLoadPool(const std::vector<std::string> &files, uint32_t threadCount, StartLoad startLoad, OnLoaded onLoaded)
+            : m_order{getLargestFirstOrder(files)}, m_loads(files.size()), m_startLoad{startLoad}, m_onLoaded{onLoaded}
+        {
+            m_threads.resize(threadCount);
+            for (std::jthread &thread : m_threads) thread = std::jthread([this](std::stop_token stoken) {work(stoken);});
+        }
+    private:
+        struct Task {
+            uint32_t imgIdx;
+            uint32_t taskIdx;
+        };
+
+        void work(std::stop_token stoken)
+        {
+            while (!stoken.stop_requested()) {
+                Task task{};
+                bool isSplitTask = false;
+                {
+                    // With no tasks and no images left to open, an image that another thread is still opening may yet split
+                    std::unique_lock lock(m_mutex);
+                    const bool hasWork = m_tasksAdded.wait(lock, stoken, [this] {
+                        return !m_tasks.empty() || m_nextOrderIdx < m_order.size() || m_startedImgCount == m_order.size();});
+                    if (!hasWork) return;
+                    if (!m_tasks.empty()) {
+                        task = m_tasks.front();
+                        m_tasks.pop_front();
+                        isSplitTask = true;
+                    } else if (m_nextOrderIdx < m_order.size()) task.imgIdx = m_order[m_nextOrderIdx++];
+                    else return;
+                }
+
+                if (isSplitTask) {
+                    if (m_loads[task.imgIdx]->runTask(task.taskIdx)) {
+                        m_loads[task.imgIdx].reset();
+                        if (!m_onLoaded(task.imgIdx, stoken)) return;
+                    }
+                    continue;
+                }
+
+                std::unique_ptr<VulImage::KtxLoad> load = m_startLoad(task.imgIdx);
+                const bool isSplit = load != nullptr;
+                {
+                    std::scoped_lock lock(m_mutex);
+                    m_startedImgCount++;
+                    if (isSplit) {
+                        for (uint32_t i = 0; i < load->getTaskCount(); i++) m_tasks.push_back({task.imgIdx, i});
+                        m_loads[task.imgIdx] = std::move(load);
+                    }
+                }
+                m_tasksAdded.notify_all();
+                if (!isSplit && !m_onLoaded(task.imgIdx, stoken)) return;
+            }
+        }
+
+        const std::vector<uint32_t> m_order;
+        std::vector<std::unique_ptr<VulImage::KtxLoad>> m_loads;
+        StartLoad m_startLoad;
+        OnLoaded m_onLoaded;
+        std::mutex m_mutex;
+        std::condition_variable_any m_tasksAdded;
+        std::deque<Task> m_tasks;
+        uint32_t m_nextOrderIdx = 0;
+        uint32_t m_startedImgCount = 0;
+        // Last, so that the threads are joined before anything they use is destroyed
+        std::vector<std::jthread> m_threads;
+};
+
 GltfLoader::GltfLoader(std::string fileName)
 {
+    VUL_PROFILE_FUNC()
+
+    m_mappedFiles.push_back(std::make_unique<VulMappedFile>(fileName));
+    const uint8_t *fileData = m_mappedFiles[0]->getData();
+    const size_t fileSize = m_mappedFiles[0]->getSize();
+    const std::string baseDir = fileName.substr(0, fileName.find_last_of('/') + 1);
+
+    const char *json = reinterpret_cast<const char *>(fileData);
+    size_t jsonSize = fileSize;
+    const uint8_t *binChunk = nullptr;
+    size_t binChunkSize = 0;
+    if (fileSize >= 12 && memcmp(fileData, "glTF", 4) == 0) {
+        constexpr uint32_t JSON_CHUNK_TYPE = 0x4E4F534A;
+        constexpr uint32_t BIN_CHUNK_TYPE = 0x004E4942;
+        uint32_t version = 0;
+        uint32_t totalLength = 0;
+        memcpy(&version, fileData + 4, sizeof(version));
+        memcpy(&totalLength, fileData + 8, sizeof(totalLength));
+        if (version != 2) throw std::runtime_error("Unsupported glb version " + std::to_string(version) + ". File: " + fileName);
+        if (totalLength > fileSize) throw std::runtime_error("Glb header claims more data than the file has. File: " + fileName);
+
+        json = nullptr;
+        jsonSize = 0;
+        size_t offset = 12;
+        while (offset + 8 <= totalLength) {
+            uint32_t chunkLength = 0;
+            uint32_t chunkType = 0;
+            memcpy(&chunkLength, fileData + offset, sizeof(chunkLength));
+            memcpy(&chunkType, fileData + offset + 4, sizeof(chunkType));
+            offset += 8;
+            if (offset + chunkLength > totalLength) throw std::runtime_error("Glb chunk goes past the end of the file. File: " + fileName);
+            if (chunkType == JSON_CHUNK_TYPE && json == nullptr) {
+                json = reinterpret_cast<const char *>(fileData + offset);
+                jsonSize = chunkLength;
+            } else if (chunkType == BIN_CHUNK_TYPE && binChunk == nullptr) {
+                binChunk = fileData + offset;
+                binChunkSize = chunkLength;
+            }
+            offset += chunkLength;
+        }
+        if (json == nullptr) throw std::runtime_error("Glb file doesn't have a json chunk. File: " + fileName);
+    }
+
+    // Tinygltf copies every buffer it loads into m_model.buffers, so the buffers that live in files are swapped to a tiny
+    // placeholder before parsing and the accessors read them straight from the mapped files instead
+    nlohmann::json root = nlohmann::json::parse(json, json + jsonSize);
+    std::vector<size_t> dataUriBuffers;
+    if (root.contains("buffers")) for (size_t i = 0; i < root["buffers"].size(); i++) {
+        nlohmann::json &buffer = root["buffers"][i];
+        const size_t byteLength = buffer.value("byteLength", static_cast<size_t>(0));
+        const std::string uri = buffer.value("uri", std::string());
+        m_bufferSizes.push_back(byteLength);
+        if (!uri.empty() && tinygltf::IsDataURI(uri)) {
+            dataUriBuffers.push_back(i);
+            m_bufferData.push_back(nullptr);
+            continue;
+        }
+
+        const uint8_t *data = nullptr;
+        if (uri.empty()) {
+            if (i == 0 && binChunk != nullptr) {
+                if (byteLength > binChunkSize) throw std::runtime_error("Glb buffer is larger than the bin chunk. File: " + fileName);
+                data = binChunk;
+            }
+        } else {
+            std::string decodedUri;
+            tinygltf::URIDecode(uri, &decodedUri, nullptr);
+            m_mappedFiles.push_back(std::make_unique<VulMappedFile>(baseDir + decodedUri));
+            if (m_mappedFiles.back()->getSize() < byteLength) throw std::runtime_error("Buffer file is smaller than its byteLength. File: " + baseDir + decodedUri);
+            data = m_mappedFiles.back()->getData();
+        }
+        m_bufferData.push_back(data);
+        buffer["uri"] = "data:application/octet-stream;base64,AA==";
+        buffer["byteLength"] = 1;
+    }
+    // Tinygltf also hands images in buffer views to the image loader straight from the buffer, which is now the placeholder,
+    // so those images get a placeholder of their own and their view is put back after parsing
+    std::vector<std::pair<size_t, int>> bufferViewImages;
+    if (root.contains("images")) for (size_t i = 0; i < root["images"].size(); i++) {
+        nlohmann::json &image = root["images"][i];
+        if (!image.contains("bufferView")) continue;
+        bufferViewImages.emplace_back(i, image["bufferView"].get<int>());
+        image.erase("bufferView");
+        image["uri"] = "data:application/octet-stream;base64,AA==";
+    }
+    const std::string rewrittenJson = root.dump();
+
     tinygltf::TinyGLTF context;
+    context.SetImageLoader([](tinygltf::Image *, const int, std::string *, std::string *, int, int, const unsigned char *, int, void *)
+            {return true;}, nullptr);
     std::string warn, err;
-    
-    if (!context.LoadASCIIFromFile(&m_model, &err, &warn, fileName)) 
+    if (!context.LoadASCIIFromString(&m_model, &err, &warn, rewrittenJson.c_str(), static_cast<unsigned int>(rewrittenJson.size()), baseDir))
         throw std::runtime_error("Failed to load scene from file: " + err);
+
+    for (size_t bufferIdx : dataUriBuffers) m_bufferData[bufferIdx] = m_model.buffers[bufferIdx].data.data();
+    for (const auto &[imageIdx, bufferView] : bufferViewImages) {
+        m_model.images[imageIdx].bufferView = bufferView;
+        m_model.images[imageIdx].uri.clear();
+        m_model.images[imageIdx].image.clear();
+    }
+
+    findMeshoptBufferViews();
+}
+
+void GltfLoader::findMeshoptBufferViews()
+{
+    // Nothing is decoded here. A decoded view is as big as the uncompressed data, so views only get decoded when they're read
+    // and are freed once the primitives reading them are done
+    for (size_t i = 0; i < m_model.bufferViews.size(); i++){
+        if (m_model.bufferViews[i].extensions.find("EXT_meshopt_compression") == m_model.bufferViews[i].extensions.end()) continue;
+        if (m_decodedBufferViews.empty()) m_decodedBufferViews.resize(m_model.bufferViews.size());
+        m_decodedBufferViews[i] = std::make_unique<DecodedBufferView>();
+    }
+}
+
+void GltfLoader::addCompressedViews(int accessorIdx, std::vector<int> &outViews) const
+{
+    if (accessorIdx < 0 || m_decodedBufferViews.empty()) return;
+    const tinygltf::Accessor &accessor = m_model.accessors[accessorIdx];
+    const int views[3] = {accessor.bufferView, accessor.sparse.isSparse ? accessor.sparse.indices.bufferView : -1,
+            accessor.sparse.isSparse ? accessor.sparse.values.bufferView : -1};
+    for (int view : views){
+        if (view < 0 || m_decodedBufferViews[view] == nullptr) continue;
+        if (std::find(outViews.begin(), outViews.end(), view) == outViews.end()) outViews.push_back(view);
+    }
+}
+
+void GltfLoader::releaseDecodedBufferViews(const std::vector<int> &views)
+{
+    for (int view : views){
+        DecodedBufferView &decodedView = *m_decodedBufferViews[view];
+        if (--decodedView.pendingPrims > 0) continue;
+        std::scoped_lock lock(decodedView.mutex);
+        std::vector<uint8_t>().swap(decodedView.data);
+    }
+}
+
+std::vector<uint8_t> GltfLoader::decodeMeshoptBufferView(int bufferViewIdx) const
+{
+    const tinygltf::BufferView &bufferView = m_model.bufferViews[bufferViewIdx];
+    const tinygltf::Value &extension = bufferView.extensions.find("EXT_meshopt_compression")->second;
+    const auto getNumber = [&extension](const std::string &name, size_t defaultValue) {
+        return extension.Has(name) ? static_cast<size_t>(extension.Get(name).GetNumberAsDouble()) : defaultValue;
+    };
+    const auto getString = [&extension](const std::string &name, const std::string &defaultValue) {
+        return extension.Has(name) ? extension.Get(name).Get<std::string>() : defaultValue;
+    };
+    const size_t buffer = getNumber("buffer", m_bufferData.size());
+    const size_t byteOffset = getNumber("byteOffset", 0);
+    const size_t byteLength = getNumber("byteLength", 0);
+    const size_t byteStride = getNumber("byteStride", 0);
+    const size_t count = getNumber("count", 0);
+    const std::string mode = getString("mode", "");
+    const std::string filter = getString("filter", "NONE");
+
+    if (buffer >= m_bufferData.size() || m_bufferData[buffer] == nullptr)
+        throw std::runtime_error("Meshopt compressed buffer view " + std::to_string(bufferViewIdx) + " points to a buffer that has no data");
+    if (byteOffset + byteLength > m_bufferSizes[buffer])
+        throw std::runtime_error("Meshopt compressed buffer view " + std::to_string(bufferViewIdx) + " goes past the end of its buffer");
+    if (count * byteStride < bufferView.byteLength)
+        throw std::runtime_error("Meshopt compressed buffer view " + std::to_string(bufferViewIdx) + " decodes into less data than the view has");
+
+    std::vector<uint8_t> decoded(count * byteStride);
+    const uint8_t *src = m_bufferData[buffer] + byteOffset;
+    int result = -1;
+    if (mode == "ATTRIBUTES"){
+        if (byteStride == 0 || byteStride > 256 || byteStride % 4 != 0) throw std::runtime_error("Invalid meshopt attribute stride: " + std::to_string(byteStride));
+        result = meshopt_decodeVertexBuffer(decoded.data(), count, byteStride, src, byteLength);
+    } else if (mode == "TRIANGLES" || mode == "INDICES"){
+        if (byteStride != 2 && byteStride != 4) throw std::runtime_error("Invalid meshopt index stride: " + std::to_string(byteStride));
+        if (mode == "TRIANGLES") result = meshopt_decodeIndexBuffer(decoded.data(), count, byteStride, src, byteLength);
+        else result = meshopt_decodeIndexSequence(decoded.data(), count, byteStride, src, byteLength);
+    } else throw std::runtime_error("Unknown meshopt compression mode: " + mode);
+    if (result != 0) throw std::runtime_error("Failed to decode meshopt compressed buffer view " + std::to_string(bufferViewIdx) + ". Error: " + std::to_string(result));
+
+    if (filter == "OCTAHEDRAL") meshopt_decodeFilterOct(decoded.data(), count, byteStride);
+    else if (filter == "QUATERNION") meshopt_decodeFilterQuat(decoded.data(), count, byteStride);
+    else if (filter == "EXPONENTIAL") meshopt_decodeFilterExp(decoded.data(), count, byteStride);
+    else if (filter != "NONE") throw std::runtime_error("Unknown meshopt filter: " + filter);
+    return decoded;
 }
 
 void GltfLoader::importMaterials()
@@ -91,6 +579,13 @@ void GltfLoader::importFullTexturesSync(const std::string &textureDirectory, con
     for (size_t i = 0; i < images.size(); i++) images[i]->deleteCpuData();
 }
 
+void GltfLoader::importBaselineTextures(const std::string &textureDirectory, uint32_t detailMipCount, const VulDevice &device, VulCmdPool &cmdPool)
+{
+    if (m_model.images.size() == 0) return;
+    importTextures(textureDirectory, detailMipCount, std::max(std::thread::hardware_concurrency() - 1, 1u), device, cmdPool);
+    for (size_t i = 0; i < images.size(); i++) images[i]->deleteCpuData();
+}
+
 std::unique_ptr<GltfLoader::AsyncImageLoadingInfo> GltfLoader::importPartialTexturesAsync(const std::string &textureDirectory, uint32_t asyncMipLoadCount, const VulDevice &device, VulCmdPool &transferPool, VulCmdPool &destinationPool)
 {
     std::unique_ptr<AsyncImageLoadingInfo> asyncImageLoadingInfo = std::make_unique<AsyncImageLoadingInfo>();
@@ -103,65 +598,62 @@ std::unique_ptr<GltfLoader::AsyncImageLoadingInfo> GltfLoader::importPartialText
     std::function<void(std::stop_token, std::vector<std::shared_ptr<vul::VulImage>>)> imgUpdaterFunc = [&device, &transferPool, &destinationPool, asyncMipLoadCount, &asyncImageLoadingInfo]
         (std::stop_token stoken, std::vector<std::shared_ptr<vul::VulImage>> images) {
 
-        std::unordered_set<std::string> uniqueImagePaths;
+        // Textures with identical contents already share one VulImage, which must only get its mips added once
+        std::unordered_set<const vul::VulImage *> uniqueImages;
         for (std::shared_ptr<vul::VulImage> &img : images) {
-            if (uniqueImagePaths.find(img->name) != uniqueImagePaths.end()) img = nullptr;
-            else uniqueImagePaths.insert(img->name);
+            if (uniqueImages.find(img.get()) != uniqueImages.end()) img = nullptr;
+            else uniqueImages.insert(img.get());
         }
 
-        std::atomic_uint32_t imgIdx = 0;
-        std::vector<std::atomic_bool> imgHasFinished(images.size());
-        std::function<void(std::stop_token)> loadData = [asyncMipLoadCount, &imgIdx, &images, &imgHasFinished](std::stop_token stoken) {
-            while (!stoken.stop_requested()) {
-                const uint32_t idx = imgIdx++;
-                if (idx >= images.size()) break;
-                const std::shared_ptr<vul::VulImage> &img = images[idx];
-                if (img == nullptr) {
-                    imgHasFinished[idx] = true;
-                    continue;
-                }
-                vul::VulImage::KtxCompressionFormat fromat;
-                if (img->getFormat() == VK_FORMAT_BC1_RGB_SRGB_BLOCK) fromat = vul::VulImage::KtxCompressionFormat::bc1rgbNonLinear;
-                else if (img->getFormat() == VK_FORMAT_BC7_SRGB_BLOCK) fromat = vul::VulImage::KtxCompressionFormat::bc7rgbaNonLinear;
-                else fromat = vul::VulImage::KtxCompressionFormat::bc7rgbaLinear;
-                img->addMipLevelsToStartFromCompressedKtxFile(img->name, fromat, asyncMipLoadCount);
-                imgHasFinished[idx] = true;
-            }
+        std::vector<std::string> imgFiles(images.size());
+        for (size_t i = 0; i < images.size(); i++) if (images[i] != nullptr) imgFiles[i] = images[i]->name;
+
+        VulCompletionQueue<uint32_t> finishedImgs(images.size());
+        const TextureLoadPool::StartLoad startLoad = [asyncMipLoadCount, &images](uint32_t idx) -> std::unique_ptr<vul::VulImage::KtxLoad> {
+            const std::shared_ptr<vul::VulImage> &img = images[idx];
+            if (img == nullptr) return nullptr;
+            vul::VulImage::KtxCompressionFormat fromat;
+            if (img->getFormat() == VK_FORMAT_BC1_RGB_SRGB_BLOCK) fromat = vul::VulImage::KtxCompressionFormat::bc1rgbNonLinear;
+            else if (img->getFormat() == VK_FORMAT_BC7_SRGB_BLOCK) fromat = vul::VulImage::KtxCompressionFormat::bc7rgbaNonLinear;
+            else fromat = vul::VulImage::KtxCompressionFormat::bc7rgbaLinear;
+            return img->startAddingMipLevelsFromCompressedKtxFile(img->name, fromat, asyncMipLoadCount);
         };
-        std::vector<std::jthread> threads(std::max(std::jthread::hardware_concurrency() - 2, 1u));
-        for (size_t i = 0; i < threads.size(); i++) threads[i] = std::jthread(loadData);
+        TextureLoadPool loadPool(imgFiles, std::max(std::jthread::hardware_concurrency() - 2, 1u), startLoad,
+                [&finishedImgs](uint32_t idx, std::stop_token stoken) {return finishedImgs.push(idx, stoken);});
 
+        // All images that are ready get uploaded with one transfer submit and handed to the destination queue with one more,
+        // instead of two synchronized submits per image
         uint32_t finishedImgCount = 0;
-        while (!stoken.stop_requested() && finishedImgCount < images.size()) {
-            int idx = -1;
-            for (size_t i = 0; i < imgHasFinished.size(); i++) if (imgHasFinished[i]) {
-                imgHasFinished[i] = false;
-                idx = i;
-                break;
-            }
-            if (idx < 0) {
-                using namespace std::chrono_literals;
-                std::this_thread::sleep_for(10ms);
-                continue;
-            }
-            std::shared_ptr<vul::VulImage> &img = images[idx];
-            if (img != nullptr) {
+        std::vector<uint32_t> readyImgs;
+        while (finishedImgCount < images.size()) {
+            readyImgs.clear();
+            if (!finishedImgs.popAll(readyImgs, stoken)) break;
+
+            std::vector<std::shared_ptr<vul::VulImage>> readyImages;
+            for (uint32_t idx : readyImgs) if (images[idx] != nullptr) readyImages.push_back(images[idx]);
+            if (readyImages.size() > 0) {
                 std::scoped_lock lock(asyncImageLoadingInfo->pauseMutex);
                 VkCommandBuffer commandBuffer = transferPool.getPrimaryCommandBuffer();
-                asyncImageLoadingInfo->oldVkImageStuff.push_back(img->createCustomImage(VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                            VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT, commandBuffer));
-                img->transitionQueueFamily(device.getQueueFamilies().transferFamily, device.getQueueFamilies().mainFamily, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, commandBuffer);
+                for (const std::shared_ptr<vul::VulImage> &img : readyImages) {
+                    asyncImageLoadingInfo->oldVkImageStuff.push_back(img->createCustomImage(VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT, commandBuffer));
+                    img->transitionQueueFamily(device.getQueueFamilies().transferFamily, device.getQueueFamilies().mainFamily, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, commandBuffer);
+                }
                 VkSemaphore semaphore = transferPool.submitAndSynchronize(commandBuffer, VK_NULL_HANDLE, true, false);
                 commandBuffer = destinationPool.getPrimaryCommandBuffer();
-                img->transitionQueueFamily(device.getQueueFamilies().transferFamily, device.getQueueFamilies().mainFamily, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, commandBuffer);
-                img->transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+                for (const std::shared_ptr<vul::VulImage> &img : readyImages) {
+                    img->transitionQueueFamily(device.getQueueFamilies().transferFamily, device.getQueueFamilies().mainFamily, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, commandBuffer);
+                    img->transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+                }
                 destinationPool.submitAndSynchronize(commandBuffer, semaphore, false, true);
-                img->deleteCpuData();
-                img->deleteStagingResources();
+                for (const std::shared_ptr<vul::VulImage> &img : readyImages) {
+                    img->deleteCpuData();
+                    img->deleteStagingResources();
+                }
             }
-            asyncImageLoadingInfo->fullyProcessedImageCount++;
-            finishedImgCount++;
+            asyncImageLoadingInfo->fullyProcessedImageCount += readyImgs.size();
+            finishedImgCount += readyImgs.size();
         }
     };
 
@@ -169,315 +661,669 @@ std::unique_ptr<GltfLoader::AsyncImageLoadingInfo> GltfLoader::importPartialText
     return asyncImageLoadingInfo;
 }
 
-void GltfLoader::importTextures(std::string textureDirectory, uint32_t mipOffset, uint32_t threadCount, const VulDevice &device, VulCmdPool &cmdPool)
+std::vector<GltfLoader::ImageSource> GltfLoader::getImageSources() const
 {
-    if (textureDirectory[textureDirectory.length() - 1] != '/') textureDirectory += '/';
-
     std::set<int> transparentColorTextures;
     std::set<int> opaqueColorTextures;
     std::set<int> normalMaps;
     std::set<int> roughnessMetallicTextures;
+    const auto insertSource = [this](std::set<int> &set, int textureIdx) {if (textureIdx >= 0) set.insert(m_model.textures[textureIdx].source);};
     for (const tinygltf::Material &mat : m_model.materials) {
-        if (mat.alphaMode == "OPAQUE") opaqueColorTextures.insert(m_model.textures[mat.pbrMetallicRoughness.baseColorTexture.index].source);
-        else transparentColorTextures.insert(m_model.textures[mat.pbrMetallicRoughness.baseColorTexture.index].source);
-        normalMaps.insert(m_model.textures[mat.normalTexture.index].source);
-        roughnessMetallicTextures.insert(m_model.textures[mat.pbrMetallicRoughness.metallicRoughnessTexture.index].source);
+        if (mat.alphaMode == "OPAQUE") insertSource(opaqueColorTextures, mat.pbrMetallicRoughness.baseColorTexture.index);
+        else insertSource(transparentColorTextures, mat.pbrMetallicRoughness.baseColorTexture.index);
+        insertSource(normalMaps, mat.normalTexture.index);
+        insertSource(roughnessMetallicTextures, mat.pbrMetallicRoughness.metallicRoughnessTexture.index);
     }
 
-    std::vector<std::jthread> threads(threadCount);
+    std::vector<ImageSource> imageSources(m_model.images.size());
+    for (size_t i = 0; i < imageSources.size(); i++) {
+        const int imgIdx = static_cast<int>(i);
+        if (transparentColorTextures.count(imgIdx) > 0) imageSources[i].format = VulImage::KtxCompressionFormat::bc7rgbaNonLinear;
+        else if (opaqueColorTextures.count(imgIdx) > 0) imageSources[i].format = VulImage::KtxCompressionFormat::bc1rgbNonLinear;
+        else if (normalMaps.count(imgIdx) > 0) imageSources[i].format = VulImage::KtxCompressionFormat::bc7rgbaLinear;
+        else if (roughnessMetallicTextures.count(imgIdx) > 0) imageSources[i].format = VulImage::KtxCompressionFormat::bc7rgbaLinear;
+        imageSources[i].uri = m_model.images[i].uri;
+    }
+    return imageSources;
+}
+
+std::vector<int> GltfLoader::getTextureSources() const
+{
+    std::vector<int> textureSources(m_model.textures.size());
+    for (size_t i = 0; i < textureSources.size(); i++) textureSources[i] = m_model.textures[i].source;
+    return textureSources;
+}
+
+std::vector<std::string> GltfLoader::getSourceFiles() const
+{
+    std::vector<std::string> sourceFiles(m_mappedFiles.size());
+    for (size_t i = 0; i < sourceFiles.size(); i++) sourceFiles[i] = m_mappedFiles[i]->getFileName();
+    return sourceFiles;
+}
+
+void GltfLoader::importTextures(std::string textureDirectory, uint32_t mipOffset, uint32_t threadCount, const VulDevice &device, VulCmdPool &cmdPool)
+{
+    images = loadTextures(getImageSources(), getTextureSources(), textureDirectory, mipOffset, threadCount, device, cmdPool);
+}
 
-    std::vector<std::shared_ptr<VulImage>> imgSources(m_model.images.size());
-    std::atomic<uint32_t> atomImgIdx = 0;
-    std::vector<std::atomic_bool> imgHasFinished(imgSources.size());
-    std::function<void(uint32_t)> importTexture = [&](uint32_t threadIdx)
+std::vector<std::shared_ptr<VulImage>> GltfLoader::loadTextures(const std::vector<ImageSource> &imageSources, const std::vector<int> &textureSources,
+        std::string textureDirectory, uint32_t mipOffset, uint32_t threadCount, const VulDevice &device, VulCmdPool &cmdPool)
+{
+    if (imageSources.empty()) return {};
+    if (textureDirectory[textureDirectory.length() - 1] != '/') textureDirectory += '/';
+
+    std::vector<std::shared_ptr<VulImage>> imgSources(imageSources.size());
+    std::vector<std::string> imgFiles(imageSources.size());
+    for (size_t i = 0; i < imageSources.size(); i++) imgFiles[i] = textureDirectory + imageSources[i].uri;
+
+    // Images are deduplicated by their contents. Within this call the first image with a given key loads it and the rest
+    // share its VulImage. Full loads also share with textures that are already loaded anywhere in the process, but partial
+    // loads don't, since their mips get replaced later
+    const bool useRegistry = mipOffset == 0;
+    std::vector<VulTextureRegistry::Key> imgKeys(imgSources.size());
+    std::vector<uint8_t> imgIsOwned(imgSources.size());
+    std::unordered_map<uint64_t, uint32_t> keyOwners;
+    std::mutex keyOwnersMutex;
+
+    VulCompletionQueue<uint32_t> finishedImgs(imgSources.size());
+    const TextureLoadPool::StartLoad importTexture = [&](uint32_t imgIdx) -> std::unique_ptr<VulImage::KtxLoad>
     {
-        while (true) {
-            uint32_t imgIdx = atomImgIdx++; 
-            if (imgIdx >= imgSources.size()) break;
-
-            VulImage::KtxCompressionFormat fromat{};
-            if (transparentColorTextures.count(imgIdx) > 0) fromat = VulImage::KtxCompressionFormat::bc7rgbaNonLinear;
-            else if (opaqueColorTextures.count(imgIdx) > 0) fromat = VulImage::KtxCompressionFormat::bc1rgbNonLinear;
-            else if (normalMaps.count(imgIdx) > 0) fromat = VulImage::KtxCompressionFormat::bc7rgbaLinear;
-            else if (roughnessMetallicTextures.count(imgIdx) > 0) fromat = VulImage::KtxCompressionFormat::bc7rgbaLinear;
-
-            const tinygltf::Image &image = m_model.images[imgIdx];
-            imgSources[imgIdx] = std::make_shared<VulImage>(device);
-            imgSources[imgIdx]->name = textureDirectory + image.uri;
-            imgSources[imgIdx]->loadCompressedKtxFromFile(textureDirectory + image.uri, fromat, mipOffset, 69);
-            imgHasFinished[imgIdx] = true;
+        const ImageSource &image = imageSources[imgIdx];
+        VulTextureRegistry::Key &key = imgKeys[imgIdx];
+        {
+            VulMappedFile file(imgFiles[imgIdx]);
+            key.contentHash = hashBytes(file.getData(), file.getSize());
+            key.format = image.format;
+            key.device = &device;
         }
-    };
 
-    for (size_t i = 0; i < threads.size(); i++) threads[i] = std::jthread(importTexture, i);
+        std::shared_ptr<VulImage> existing = useRegistry ? VulTextureRegistry::find(key) : nullptr;
+        if (existing == nullptr) {
+            std::scoped_lock lock(keyOwnersMutex);
+            const uint64_t localKey = hashCombine(key.contentHash, static_cast<uint64_t>(key.format));
+            const auto owner = keyOwners.find(localKey);
+            if (owner != keyOwners.end()) existing = imgSources[owner->second];
+            else {
+                keyOwners[localKey] = imgIdx;
+                imgSources[imgIdx] = std::make_shared<VulImage>(device);
+                imgIsOwned[imgIdx] = true;
+            }
+        }
+        if (existing != nullptr) {
+            imgSources[imgIdx] = existing;
+            return nullptr;
+        }
 
+        imgSources[imgIdx]->name = imgFiles[imgIdx];
+        // Partial loads keep the cpu data since the rest of the mips get added in front of it later
+        return imgSources[imgIdx]->startCompressedKtxLoad(imgFiles[imgIdx], image.format, mipOffset, 69, mipOffset == 0);
+    };
+    TextureLoadPool loadPool(imgFiles, threadCount, importTexture,
+            [&finishedImgs](uint32_t imgIdx, std::stop_token stoken) {return finishedImgs.push(imgIdx, stoken);});
+
+    // Every image that finished while the previous batch was being recorded goes into the same command buffer
     uint32_t finishedImages = 0;
-    bool needsSubmitting = false;
-    VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
+    std::vector<uint32_t> readyImgs;
     while (finishedImages < imgSources.size()) {
-        int idx = -1;
-        for (size_t i = 0; i < imgHasFinished.size(); i++) if (imgHasFinished[i]) {
-            imgHasFinished[i] = false;
-            idx = i;
-            break;
-        }
-        if (idx < 0) {
-            using namespace std::chrono_literals;
-            if (needsSubmitting) cmdPool.submit(cmdBuf, false);
-            needsSubmitting = false;
-            std::this_thread::sleep_for(1ms);
-            continue;
+        readyImgs.clear();
+        finishedImgs.popAll(readyImgs);
+        VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
+        for (uint32_t idx : readyImgs) {
+            if (!imgIsOwned[idx]) continue;
+            imgSources[idx]->createCustomImage(VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT, cmdBuf);
         }
-        if (!needsSubmitting) cmdBuf = cmdPool.getPrimaryCommandBuffer();
-        imgSources[idx]->createCustomImage(VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT, cmdBuf);
-        finishedImages++;
-        needsSubmitting = true;
-    }
-    assert(needsSubmitting);
-    cmdPool.submit(cmdBuf, true);
+        finishedImages += readyImgs.size();
+        cmdPool.submit(cmdBuf, finishedImages == imgSources.size());
+    }
     cmdPool.waitForAllCommandBuffers();
+    if (useRegistry) for (size_t i = 0; i < imgSources.size(); i++) if (imgIsOwned[i]) VulTextureRegistry::add(imgKeys[i], imgSources[i]);
 
-    images.resize(m_model.textures.size());
+    std::vector<std::shared_ptr<VulImage>> textures(textureSources.size());
     std::shared_ptr<VulSampler> sampler = VulSampler::createDefaultTexSampler(device);
-    for (size_t i = 0; i < images.size(); i++) {
-        images[i] = imgSources[m_model.textures[i].source];
-        images[i]->vulSampler = sampler;
-        images[i]->deleteStagingResources();
+    for (size_t i = 0; i < textures.size(); i++) {
+        textures[i] = imgSources[textureSources[i]];
+        if (textures[i]->vulSampler == nullptr) textures[i]->vulSampler = sampler;
+        textures[i]->deleteStagingResources();
     }
+    return textures;
 }
 
 void GltfLoader::importDrawableNodes(GltfAttributes requestedAttributes)
 {
+    VUL_PROFILE_FUNC()
+
     const int defaultScene = m_model.defaultScene > -1 ? m_model.defaultScene : 0;    
     const auto &scene = m_model.scenes[defaultScene];
 
+    flattenNodeHierarchy(scene.nodes);
     std::set<uint32_t> usedMeshes;
-    std::function<void(int)> findUsedMeshes = [&] (int nodeIdx)
-    {
-        const tinygltf::Node node = m_model.nodes[nodeIdx];
-        if (node.mesh >= 0) usedMeshes.insert(node.mesh);
-        for (int childIdx : node.children) findUsedMeshes(childIdx);
-    };
-    for (int nodeIdx : scene.nodes){
-        findUsedMeshes(nodeIdx);
+    for (int nodeIdx : m_flatNodes){
+        if (m_model.nodes[nodeIdx].mesh >= 0) usedMeshes.insert(m_model.nodes[nodeIdx].mesh);
     }
 
-    uint32_t indexCnt = 0;
-    uint32_t primCnt = 0;
+    const auto isRequested = [requestedAttributes](GltfAttributes attribute) {return gltfAttribAnd(requestedAttributes, attribute) == attribute;};
+    const auto findAttribute = [](const tinygltf::Primitive &prim, const std::string &attribName) {
+        const auto it = prim.attributes.find(attribName);
+        return it == prim.attributes.end() ? -1 : it->second;
+    };
+
+    // Counting pass. Every primitive gets its index and vertex ranges here, so the decoding pass below can write into the
+    // shared vectors from any number of threads without ever touching the same range
+    const size_t firstPrim = primMeshes.size();
+    size_t indexCnt = indices.size();
+    const size_t firstVertex = positions.size();
+    size_t vertexCnt = firstVertex;
+    std::vector<PrimImportJob> jobs;
+    std::unordered_map<std::string, uint32_t> primsByAttributes;
     for (uint32_t meshIdx : usedMeshes){
-        tinygltf::Mesh mesh = m_model.meshes[meshIdx]; 
+        const tinygltf::Mesh &mesh = m_model.meshes[meshIdx]; 
         std::vector<uint32_t> primitives;
-        for (tinygltf::Primitive prim: mesh.primitives){
+        for (const tinygltf::Primitive &prim : mesh.primitives){
             if (prim.mode != 4) throw std::runtime_error("Why is the primitive mode not 4? Find an answer to that."); // I think the mode 4 is triangle
-            if (prim.indices > -1){
-                tinygltf::Accessor indexAccessor = m_model.accessors[prim.indices];
-                indexCnt += static_cast<uint32_t>(indexAccessor.count);
+
+            PrimImportJob job{};
+            job.indexAccessor = prim.indices;
+            job.positionAccessor = findAttribute(prim, "POSITION");
+            if (job.positionAccessor < 0) throw std::runtime_error("The mesh doesnt have position");
+            const tinygltf::Accessor &posAccessor = m_model.accessors[job.positionAccessor];
+
+            GltfPrimMesh primMesh;
+            primMesh.name = mesh.name;
+            primMesh.materialIndex = std::max(0, prim.material);
+            primMesh.firstIndex = static_cast<uint32_t>(indexCnt);
+            primMesh.indexCount = static_cast<uint32_t>(prim.indices > -1 ? m_model.accessors[prim.indices].count : posAccessor.count);
+            indexCnt += primMesh.indexCount;
+
+            // By caching meshes, I can skip their position loading step, but I can still give them unique materials and indices
+            std::stringstream key;
+            for (const auto &attrib : prim.attributes){
+                key << attrib.first << attrib.second;
+            }
+            // Generated tangents depend on the triangles too, and their vertex splits remap the indices
+            if (isRequested(GltfAttributes::Tangent) && findAttribute(prim, "TANGENT") < 0) key << "indices" << prim.indices;
+            auto cacheIt = primsByAttributes.find(key.str());
+            if (cacheIt != primsByAttributes.end()){
+                job.vertexSourcePrim = static_cast<int>(cacheIt->second);
+                job.copiesSourceIndices = jobs[cacheIt->second - firstPrim].generateTangents;
+                primMesh.vertexOffset = primMeshes[cacheIt->second].vertexOffset;
+                primMesh.vertexCount = primMeshes[cacheIt->second].vertexCount;
             } else{
-                throw std::runtime_error("Is this okay? I dunno, figure it out");
-                tinygltf::Accessor posAccessor = m_model.accessors[prim.attributes.find("POSITION")->second];
-                indexCnt += static_cast<uint32_t>(posAccessor.count); 
+                if (isRequested(GltfAttributes::Normal)){
+                    job.normalAccessor = findAttribute(prim, "NORMAL");
+                    if (job.normalAccessor < 0) throw std::runtime_error("The mesh doesnt have normals");
+                }
+                if (isRequested(GltfAttributes::Tangent)){
+                    job.tangentAccessor = findAttribute(prim, "TANGENT");
+                    job.generateTangents = job.tangentAccessor < 0;
+                    if (job.generateTangents){
+                        job.tangentNormalAccessor = findAttribute(prim, "NORMAL");
+                        job.tangentUvAccessor = findAttribute(prim, "TEXCOORD_0");
+                        if (job.tangentNormalAccessor < 0 || job.tangentUvAccessor < 0)
+                            std::cout << "The mesh doesnt have tangents or the normals and uvs to generate them. Name: " << mesh.name << "\n";
+                    }
+                }
+                if (isRequested(GltfAttributes::TexCoord)){
+                    job.uvAccessor = findAttribute(prim, "TEXCOORD_0");
+                    if (job.uvAccessor < 0) job.uvAccessor = findAttribute(prim, "TEXCOORD");
+                    if (job.uvAccessor < 0) throw std::runtime_error("The mesh doesnt have tex coords");
+                }
+                if (isRequested(GltfAttributes::Color)){
+                    job.colorAccessor = findAttribute(prim, "COLOR_0");
+                    if (job.colorAccessor < 0) throw std::runtime_error("The mesh doesnt have colors");
+                }
+
+                primMesh.vertexOffset = static_cast<uint32_t>(vertexCnt);
+                primMesh.vertexCount = static_cast<uint32_t>(posAccessor.count);
+                job.vertexCapacity = primMesh.vertexCount;
+                // A vertex is split at most once, and only when it's in at least two triangles
+                if (job.generateTangents && job.tangentNormalAccessor >= 0 && job.tangentUvAccessor >= 0)
+                    job.vertexCapacity += std::min(primMesh.vertexCount, primMesh.indexCount / 2);
+                vertexCnt += job.vertexCapacity;
+                primsByAttributes[key.str()] = static_cast<uint32_t>(primMeshes.size());
             }
-            primitives.push_back(primCnt);
-            primCnt++;
+
+            primitives.push_back(static_cast<uint32_t>(primMeshes.size()));
+            primMeshes.push_back(primMesh);
+            jobs.push_back(job);
         }
         m_meshToPrimMesh[meshIdx] = std::move(primitives);
     }
-    indices.reserve(indexCnt);
-    for (uint32_t meshIdx : usedMeshes){
-        tinygltf::Mesh mesh = m_model.meshes[meshIdx];
-        for (tinygltf::Primitive prim : mesh.primitives){
-            processMesh(prim, requestedAttributes, mesh.name);
+    if (indexCnt > std::numeric_limits<uint32_t>::max() || vertexCnt > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("The scene has too many indices or vertices for 32 bit offsets");
+
+    for (PrimImportJob &job : jobs){
+        addCompressedViews(job.indexAccessor, job.compressedViews);
+        if (job.vertexSourcePrim < 0) for (int accessorIdx : {job.positionAccessor, job.normalAccessor, job.tangentAccessor, job.uvAccessor,
+                job.colorAccessor, job.tangentNormalAccessor, job.tangentUvAccessor})
+            addCompressedViews(accessorIdx, job.compressedViews);
+        for (int view : job.compressedViews) m_decodedBufferViews[view]->pendingPrims++;
+    }
+
+    indices.resize(indexCnt);
+    positions.resize(vertexCnt);
+    if (isRequested(GltfAttributes::Normal)) normals.resize(vertexCnt);
+    if (isRequested(GltfAttributes::Tangent)) tangents.resize(vertexCnt);
+    if (isRequested(GltfAttributes::TexCoord)) uvCoords.resize(vertexCnt);
+    if (isRequested(GltfAttributes::Color)) colors.resize(vertexCnt);
+
+    // Decoding pass
+    std::atomic_uint32_t jobIdx = 0;
+    std::exception_ptr importError = nullptr;
+    std::mutex importErrorMutex;
+    std::function<void()> importPrimitives = [&]()
+    {
+        while (true) {
+            const uint32_t idx = jobIdx++;
+            if (idx >= jobs.size()) break;
+            try {
+                processMesh(jobs[idx], primMeshes[firstPrim + idx]);
+                releaseDecodedBufferViews(jobs[idx].compressedViews);
+            } catch (...) {
+                std::scoped_lock lock(importErrorMutex);
+                if (importError == nullptr) importError = std::current_exception();
+            }
         }
+    };
+    {
+        std::vector<std::jthread> threads(std::min(static_cast<size_t>(std::max(std::thread::hardware_concurrency() - 1, 1u)), std::max(jobs.size(), static_cast<size_t>(1))));
+        for (size_t i = 0; i < threads.size(); i++) threads[i] = std::jthread(importPrimitives);
     }
+    if (importError != nullptr) std::rethrow_exception(importError);
 
-    for (int nodeIdx : scene.nodes){
-        glm::quat quat{};
-        quat.x = 0.0f;
-        quat.y = 0.0f;
-        quat.z = 0.0f;
-        quat.w = 1.0f;
-        processNode(nodeIdx, {0.0f, 0.0f, 0.0f}, quat, {1.0f, 1.0f, 1.0f});
+    // Tangent generation rarely splits as many vertices as were reserved for it, so the vertex ranges are packed together again.
+    // Primitives sharing vertices with one that had its tangents generated also get its remapped indices here
+    size_t packedVertexCnt = firstVertex;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        GltfPrimMesh &primMesh = primMeshes[firstPrim + i];
+        if (jobs[i].vertexSourcePrim >= 0) {
+            const GltfPrimMesh &sourceMesh = primMeshes[jobs[i].vertexSourcePrim];
+            primMesh.vertexOffset = sourceMesh.vertexOffset;
+            primMesh.vertexCount = sourceMesh.vertexCount;
+            primMesh.posMin = sourceMesh.posMin;
+            primMesh.posMax = sourceMesh.posMax;
+            if (jobs[i].copiesSourceIndices) std::copy(indices.begin() + sourceMesh.firstIndex,
+                    indices.begin() + sourceMesh.firstIndex + sourceMesh.indexCount, indices.begin() + primMesh.firstIndex);
+            continue;
+        }
+        if (primMesh.vertexOffset != packedVertexCnt) {
+            const auto pack = [&](auto &attribute) {
+                if (attribute.size() != vertexCnt) return; // Not requested
+                const auto first = attribute.begin() + primMesh.vertexOffset;
+                std::copy(first, first + primMesh.vertexCount, attribute.begin() + packedVertexCnt);
+            };
+            pack(positions);
+            pack(normals);
+            pack(tangents);
+            pack(uvCoords);
+            pack(colors);
+            primMesh.vertexOffset = static_cast<uint32_t>(packedVertexCnt);
+        }
+        packedVertexCnt += primMesh.vertexCount;
     }
+    const auto shrink = [&](auto &attribute) {if (attribute.size() == vertexCnt) attribute.resize(packedVertexCnt);};
+    shrink(normals);
+    shrink(tangents);
+    shrink(uvCoords);
+    shrink(colors);
+    shrink(positions);
+
+    processNodes();
 
+    // Views read by something other than the primitives, such as instance transforms, are freed here
+    for (std::unique_ptr<DecodedBufferView> &decodedView : m_decodedBufferViews){
+        if (decodedView != nullptr) std::vector<uint8_t>().swap(decodedView->data);
+    }
     m_meshToPrimMesh.clear();
-    m_cachePrimMesh.clear();
+    m_flatNodes.clear();
+    m_flatNodeParents.clear();
 }
 
-void GltfLoader::processMesh(const tinygltf::Primitive &mesh, GltfAttributes requestedAttributes, const std::string &name)
+void GltfLoader::processMesh(const PrimImportJob &job, GltfPrimMesh &primMesh)
 {
-    if (mesh.mode != 4) return; 
-
-    GltfPrimMesh resultMesh;
-    resultMesh.name = name;
-    resultMesh.materialIndex = std::max(0, mesh.material);
-    resultMesh.vertexOffset = static_cast<uint32_t>(positions.size());
-    resultMesh.firstIndex = static_cast<uint32_t>(indices.size());
-
-    // By caching meshes, I can skip their position loading step, but I can still give them unique materials and indices
-    std::stringstream key;
-    for (const auto &attrib : mesh.attributes){
-        key << attrib.first << attrib.second;
-    }
-    bool primMeshCached = false;
-    auto cacheIt = m_cachePrimMesh.find(key.str());
-    if (cacheIt != m_cachePrimMesh.end()){
-        primMeshCached = true;
-        GltfPrimMesh cacheMesh = cacheIt->second;
-        resultMesh.vertexCount = cacheMesh.vertexCount;
-        resultMesh.vertexOffset = cacheMesh.vertexOffset;
-    }
-
-    if (mesh.indices > -1){
-        const tinygltf::Accessor &indexAccessor = m_model.accessors[mesh.indices];
-        resultMesh.indexCount = static_cast<uint32_t>(indexAccessor.count);
+    if (job.copiesSourceIndices) return;
+    if (job.indexAccessor > -1 && primMesh.indexCount > 0){
+        const tinygltf::Accessor &indexAccessor = m_model.accessors[job.indexAccessor];
 
         switch (indexAccessor.componentType) {
             case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:{
-                std::vector<uint32_t> primitiveIndices(indexAccessor.count);
-                copyAccessorData(primitiveIndices, 0, indexAccessor, 0, indexAccessor.count);
-                indices.insert(indices.end(), primitiveIndices.begin(), primitiveIndices.end());
+                copyAccessorData(indices, primMesh.firstIndex, indexAccessor, 0, primMesh.indexCount);
                 break;
             }
             case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:{
                 std::vector<uint16_t> primitiveIndices(indexAccessor.count);
                 copyAccessorData(primitiveIndices, 0, indexAccessor, 0, indexAccessor.count);
-                indices.insert(indices.end(), primitiveIndices.begin(), primitiveIndices.end());
+                std::copy(primitiveIndices.begin(), primitiveIndices.end(), indices.begin() + primMesh.firstIndex);
                 break;
             }
             case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE:{
                 std::vector<uint8_t> primitiveIndices(indexAccessor.count);
                 copyAccessorData(primitiveIndices, 0, indexAccessor, 0, indexAccessor.count);
-                indices.insert(indices.end(), primitiveIndices.begin(), primitiveIndices.end());
+                std::copy(primitiveIndices.begin(), primitiveIndices.end(), indices.begin() + primMesh.firstIndex);
                 break;
             }
             default:
                 throw std::runtime_error(std::string("Index component not supported. It's type is ") + std::to_string(indexAccessor.componentType));
         }
     }
-    else{
-        const tinygltf::Accessor accessor = m_model.accessors[mesh.attributes.find("POSITION")->second];
-        for (size_t i = 0; i < accessor.count; i++){
-            indices.push_back(i);
-        }
-        resultMesh.indexCount = static_cast<uint32_t>(accessor.count);
+    else if (job.indexAccessor < 0){
+        std::iota(indices.begin() + primMesh.firstIndex, indices.begin() + primMesh.firstIndex + primMesh.indexCount, 0u);
     }
 
-    if (!primMeshCached){
-        const bool hadPosition = getAttribute<glm::vec3>(mesh, positions, "POSITION");
-        if (!hadPosition) throw std::runtime_error("The mesh doesnt have position");
+    if (job.vertexSourcePrim >= 0 || primMesh.vertexCount == 0) return;
 
-        const tinygltf::Accessor accessor = m_model.accessors[mesh.attributes.find("POSITION")->second];
-        resultMesh.vertexCount = static_cast<uint32_t>(accessor.count);
-        if (!accessor.minValues.empty() && false){
-            resultMesh.posMin = glm::vec3(accessor.minValues[0], accessor.minValues[1], accessor.minValues[2]);
-        } else{
-            resultMesh.posMin = glm::vec3(std::numeric_limits<float>::max());
-            for (const glm::vec3 &pos : positions){
-                resultMesh.posMin = glm::min(resultMesh.posMin, pos);
-            }
-        }
-        if (!accessor.maxValues.empty() && false){
-            resultMesh.posMax = glm::vec3(accessor.maxValues[0], accessor.maxValues[1], accessor.maxValues[2]);
-        } else{
-            resultMesh.posMax = glm::vec3(-std::numeric_limits<float>::max());
-            for (const glm::vec3 &pos : positions){
-                resultMesh.posMax = glm::max(resultMesh.posMax, pos);
+    const tinygltf::Accessor &posAccessor = m_model.accessors[job.positionAccessor];
+    getAccessorData(posAccessor, positions, primMesh.vertexOffset, primMesh.vertexCount);
+    computeBounds(primMesh, posAccessor);
+
+    if (job.normalAccessor > -1) getAccessorData(m_model.accessors[job.normalAccessor], normals, primMesh.vertexOffset, primMesh.vertexCount);
+    if (job.tangentAccessor > -1) getAccessorData(m_model.accessors[job.tangentAccessor], tangents, primMesh.vertexOffset, primMesh.vertexCount);
+    if (job.uvAccessor > -1) getAccessorData(m_model.accessors[job.uvAccessor], uvCoords, primMesh.vertexOffset, primMesh.vertexCount);
+    if (job.colorAccessor > -1) getAccessorData(m_model.accessors[job.colorAccessor], colors, primMesh.vertexOffset, primMesh.vertexCount);
+    if (job.generateTangents) createTangents(job, primMesh);
+}
+
+void GltfLoader::flattenNodeHierarchy(const std::vector<int> &rootNodes)
+{
+    // Depth first pre-order, so nodes come out in the same order the old recursive traversal visited them in and every
+    // node is after its parent
+    m_flatNodes.clear();
+    m_flatNodeParents.clear();
+    std::vector<bool> visited(m_model.nodes.size());
+    std::vector<std::pair<int, int>> stack; // Node and the flat index of its parent
+    for (auto it = rootNodes.rbegin(); it != rootNodes.rend(); it++) stack.emplace_back(*it, -1);
+    while (!stack.empty()){
+        const auto [nodeIdx, parent] = stack.back();
+        stack.pop_back();
+        if (nodeIdx < 0 || static_cast<size_t>(nodeIdx) >= m_model.nodes.size()) throw std::runtime_error("Invalid node index " + std::to_string(nodeIdx));
+        if (visited[nodeIdx]) throw std::runtime_error("The node hierarchy isn't a tree. Node " + std::to_string(nodeIdx) + " is reached twice");
+        visited[nodeIdx] = true;
+
+        const int flatIdx = static_cast<int>(m_flatNodes.size());
+        m_flatNodes.push_back(nodeIdx);
+        m_flatNodeParents.push_back(parent);
+        const std::vector<int> &children = m_model.nodes[nodeIdx].children;
+        for (auto it = children.rbegin(); it != children.rend(); it++) stack.emplace_back(*it, flatIdx);
+    }
+}
+
+glm::mat4 GltfLoader::getLocalMatrix(const tinygltf::Node &node) const
+{
+    if (!node.matrix.empty()){
+        if (node.matrix.size() != 16) throw std::runtime_error("Node matrix doesn't have 16 elements. Node: " + node.name);
+        glm::mat4 matrix;
+        for (int i = 0; i < 16; i++) matrix[i / 4][i % 4] = static_cast<float>(node.matrix[i]);
+        return matrix;
+    }
+
+    glm::mat4 matrix{1.0f};
+    if (!node.translation.empty())
+        matrix = glm::translate(matrix, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+    if (!node.rotation.empty())
+        matrix *= glm::mat4_cast(glm::quat(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]));
+    if (!node.scale.empty())
+        matrix = glm::scale(matrix, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+    return matrix;
+}
+
+void GltfLoader::processNodes()
+{
+    VUL_PROFILE_FUNC()
+
+    std::vector<glm::mat4> worldMatrices(m_flatNodes.size());
+    for (size_t i = 0; i < m_flatNodes.size(); i++) worldMatrices[i] = getLocalMatrix(m_model.nodes[m_flatNodes[i]]);
+    for (size_t i = 0; i < m_flatNodes.size(); i++){
+        if (m_flatNodeParents[i] >= 0) worldMatrices[i] = worldMatrices[m_flatNodeParents[i]] * worldMatrices[i];
+    }
+
+    for (size_t i = 0; i < m_flatNodes.size(); i++){
+        const tinygltf::Node &node = m_model.nodes[m_flatNodes[i]];
+        const glm::mat4 &worldMatrix = worldMatrices[i];
+
+        if (node.mesh > -1){
+            // Instanced nodes still get one GltfNode per primitive, the instances only show up in instanceTransforms
+            uint32_t firstInstance = 0;
+            uint32_t instanceCount = 0;
+            const auto instancingIt = node.extensions.find("EXT_mesh_gpu_instancing");
+            if (instancingIt != node.extensions.end()){
+                firstInstance = static_cast<uint32_t>(instanceTransforms.size());
+                appendInstanceTransforms(instancingIt->second, worldMatrix);
+                instanceCount = static_cast<uint32_t>(instanceTransforms.size()) - firstInstance;
             }
-        }
 
-        if (gltfAttribAnd(requestedAttributes, GltfAttributes::Normal) == GltfAttributes::Normal){
-            bool normalCreated = getAttribute<glm::vec3>(mesh, normals, "NORMAL");
-            if (!normalCreated) throw std::runtime_error("The mesh doesnt have normals");
-        }
-        if (gltfAttribAnd(requestedAttributes, GltfAttributes::Tangent) == GltfAttributes::Tangent) {
-            if (!getAttribute<glm::vec4>(mesh, tangents, "TANGENT")) {
-                std::cout << "The mesh doesnt have tangents. Name: " << name << "\n";
-                createTangents(resultMesh.vertexCount);
+            const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(worldMatrix)));
+            const std::vector<uint32_t> &meshes = m_meshToPrimMesh[node.mesh];
+            for (uint32_t mesh : meshes){
+                GltfNode dunno;
+                dunno.name = node.name;
+                dunno.primMesh = mesh;
+                dunno.worldMatrix = worldMatrix;
+                dunno.normalMatrix = normalMatrix;
+                dunno.position = glm::vec3(worldMatrix[3]);
+                dunno.firstInstance = firstInstance;
+                dunno.instanceCount = instanceCount;
+                nodes.push_back(dunno);
             }
         }
-        if (gltfAttribAnd(requestedAttributes, GltfAttributes::TexCoord) == GltfAttributes::TexCoord){
-            bool texCoordCreated = getAttribute<glm::vec2>(mesh, uvCoords, "TEXCOORD_0");
-            if (!texCoordCreated)
-                texCoordCreated = getAttribute<glm::vec2>(mesh, uvCoords, "TEXCOORD");
-            if (!texCoordCreated) throw std::runtime_error("The mesh doesnt have tex coords");
+        else if (node.camera > -1) throw std::runtime_error("The node is a camera. Do something about it");
+        else if (node.extensions.find("KHR_lights_punctual") != node.extensions.end()){
+            const tinygltf::Light &light = m_model.lights[node.light];
+            GltfLight gltfLight{};
+            gltfLight.name = light.name;
+            gltfLight.position = glm::vec3(worldMatrix[3]);
+            gltfLight.direction = glm::normalize(glm::mat3(worldMatrix) * glm::vec3(0.0f, 0.0f, 1.0f));
+            gltfLight.color = {light.color[0], light.color[1], light.color[2]};
+            gltfLight.intensity = light.intensity;
+            gltfLight.range = light.range;
+            if (gltfLight.range < 0.01f) gltfLight.range = 10'000.0f;
+            if (light.type == "point") gltfLight.type = GltfLightType::point;
+            else if (light.type == "directional") gltfLight.type = GltfLightType::directional;
+            else if (light.type == "spot") gltfLight.type = GltfLightType::spot;
+            else throw std::runtime_error("Unrecognized gltf light type: " + light.type);
+            lights.push_back(gltfLight);
         }
-        if (gltfAttribAnd(requestedAttributes, GltfAttributes::Color) == GltfAttributes::Color){
-            bool colorCreated = getAttribute<glm::vec4>(mesh, colors, "COLOR_0");
-            if (!colorCreated) throw std::runtime_error("The mesh doesnt have colors");
+    }
+}
+
+void GltfLoader::appendInstanceTransforms(const tinygltf::Value &extension, const glm::mat4 &worldMatrix)
+{
+    if (!extension.Has("attributes")) throw std::runtime_error("EXT_mesh_gpu_instancing extension doesn't have attributes");
+    const tinygltf::Value &attributes = extension.Get("attributes");
+    const auto findAttribute = [&attributes](const std::string &attribName) {
+        return attributes.Has(attribName) ? attributes.Get(attribName).GetNumberAsInt() : -1;
+    };
+    const int translationAccessor = findAttribute("TRANSLATION");
+    const int rotationAccessor = findAttribute("ROTATION");
+    const int scaleAccessor = findAttribute("SCALE");
+
+    size_t instanceCount = 0;
+    for (int accessorIdx : {translationAccessor, rotationAccessor, scaleAccessor}){
+        if (accessorIdx < 0) continue;
+        const size_t count = m_model.accessors[accessorIdx].count;
+        if (instanceCount != 0 && count != instanceCount) throw std::runtime_error("EXT_mesh_gpu_instancing attributes have different instance counts");
+        instanceCount = count;
+    }
+
+    std::vector<glm::vec3> translations(instanceCount, glm::vec3(0.0f));
+    std::vector<glm::vec4> rotations(instanceCount, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    std::vector<glm::vec3> scales(instanceCount, glm::vec3(1.0f));
+    if (translationAccessor > -1) getAccessorData(m_model.accessors[translationAccessor], translations, 0, instanceCount);
+    if (rotationAccessor > -1) getAccessorData(m_model.accessors[rotationAccessor], rotations, 0, instanceCount);
+    if (scaleAccessor > -1) getAccessorData(m_model.accessors[scaleAccessor], scales, 0, instanceCount);
+
+    const size_t firstInstance = instanceTransforms.size();
+    instanceTransforms.resize(firstInstance + instanceCount);
+    for (size_t i = 0; i < instanceCount; i++){
+        const glm::vec4 &rotation = rotations[i];
+        glm::mat4 instanceMatrix = glm::translate(glm::mat4{1.0f}, translations[i]);
+        instanceMatrix *= glm::mat4_cast(glm::quat(rotation.w, rotation.x, rotation.y, rotation.z));
+        instanceMatrix = glm::scale(instanceMatrix, scales[i]);
+        instanceTransforms[firstInstance + i] = worldMatrix * instanceMatrix;
+    }
+}
+
+void GltfLoader::computeBounds(GltfPrimMesh &primMesh, const tinygltf::Accessor &posAccessor) const
+{
+    VUL_PROFILE_FUNC()
+
+    // The spec requires min and max for positions, but exporters get them wrong often enough that they are only trusted
+    // when they are well formed. Normalized accessors store them in the unnormalized integer range, so those are skipped
+    const auto isValidBound = [](const std::vector<double> &bound) {
+        return bound.size() == 3 && std::isfinite(bound[0]) && std::isfinite(bound[1]) && std::isfinite(bound[2]);
+    };
+    if (!posAccessor.normalized && isValidBound(posAccessor.minValues) && isValidBound(posAccessor.maxValues)) {
+        const glm::vec3 posMin(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
+        const glm::vec3 posMax(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
+        if (glm::all(glm::lessThanEqual(posMin, posMax))) {
+            primMesh.posMin = posMin;
+            primMesh.posMax = posMax;
+            return;
         }
     }
 
-    m_cachePrimMesh[key.str()] = resultMesh;
-    primMeshes.emplace_back(resultMesh);
+    calculatePositionBounds(positions.data() + primMesh.vertexOffset, primMesh.vertexCount, primMesh.posMin, primMesh.posMax);
 }
 
-void GltfLoader::processNode(int nodeIdx, const glm::vec3 &parentPos, const glm::quat &parentRot, const glm::vec3 &parentScale)
+void GltfLoader::createTangents(const PrimImportJob &job, GltfPrimMesh &primMesh)
 {
-    const tinygltf::Node &node = m_model.nodes[nodeIdx];
+    VUL_PROFILE_FUNC()
 
-    transform3D transform{};
-    transform.pos = parentPos;
-    transform.scale = parentScale;
-    glm::quat rotationQuaternion = parentRot;
+    const size_t vertexCount = primMesh.vertexCount;
+    glm::vec4 *primTangents = tangents.data() + primMesh.vertexOffset;
+    if (job.tangentNormalAccessor < 0 || job.tangentUvAccessor < 0){
+        std::fill(primTangents, primTangents + vertexCount, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+        return;
+    }
 
-    if (!node.translation.empty())
-        transform.pos += glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
-    if (!node.rotation.empty()) {
-        glm::quat localQuat{};
-        localQuat.x = node.rotation[0];
-        localQuat.y = node.rotation[1];
-        localQuat.z = node.rotation[2];
-        localQuat.w = node.rotation[3];
-        rotationQuaternion *= localQuat;
-    }
-    transform.rot = -glm::eulerAngles(rotationQuaternion); // Don't even ask about the minus sign
-    if (!node.scale.empty())
-        transform.scale *= glm::vec3(node.scale[0], node.scale[1], node.scale[2]); 
-    if (!node.matrix.empty()) throw std::runtime_error("The node has some sort of matrix. Handle it");
-
-    if (node.mesh > -1){
-        const std::vector<uint32_t> &meshes = m_meshToPrimMesh[node.mesh];
-        for (uint32_t mesh : meshes){
-            GltfNode dunno;
-            dunno.name = node.name;
-            dunno.primMesh = mesh;
-            dunno.worldMatrix = transform.transformMat();
-            dunno.normalMatrix = transform.normalMat();
-            dunno.position = transform.pos;
-            nodes.push_back(dunno);
+    // Normals and uvs might not have been requested, in which case they only get decoded for the duration of this function
+    std::vector<glm::vec3> localNormals;
+    std::vector<glm::vec2> localUvs;
+    const glm::vec3 *primNormals = normals.data() + primMesh.vertexOffset;
+    const glm::vec2 *primUvs = uvCoords.data() + primMesh.vertexOffset;
+    if (job.normalAccessor != job.tangentNormalAccessor){
+        localNormals.resize(vertexCount);
+        getAccessorData(m_model.accessors[job.tangentNormalAccessor], localNormals, 0, vertexCount);
+        primNormals = localNormals.data();
+    }
+    if (job.uvAccessor != job.tangentUvAccessor){
+        localUvs.resize(vertexCount);
+        getAccessorData(m_model.accessors[job.tangentUvAccessor], localUvs, 0, vertexCount);
+        primUvs = localUvs.data();
+    }
+    const glm::vec3 *primPositions = positions.data() + primMesh.vertexOffset;
+    uint32_t *primIndices = indices.data() + primMesh.firstIndex;
+    const size_t triangleCount = primMesh.indexCount / 3;
+    const auto isValidTriangle = [&](size_t triangle) {
+        return primIndices[triangle * 3] < vertexCount && primIndices[triangle * 3 + 1] < vertexCount && primIndices[triangle * 3 + 2] < vertexCount;
+    };
+
+    // A vertex used by triangles whose uvs are mirrored relative to each other gets split, so that both sides of a mirrored uv
+    // seam get their own tangent and handedness instead of averaging into a tangent that fits neither. This is an angle weighted
+    // per vertex average, not MikkTSpace, so normal maps baked against MikkTSpace tangents can be slightly off
+    std::vector<glm::vec3> faceTangents(triangleCount);
+    std::vector<glm::vec3> faceBitangents(triangleCount);
+    std::vector<int8_t> faceOrientations(triangleCount, -1); // 0 for positive uv area, 1 for negative, -1 for degenerate
+    std::vector<uint8_t> vertexOrientations(vertexCount, 0); // Bit mask of the orientations of the triangles using the vertex
+    for (size_t i = 0; i < triangleCount; i++){
+        if (!isValidTriangle(i)) continue;
+        const uint32_t *triangle = primIndices + i * 3;
+        const glm::vec3 edge1 = primPositions[triangle[1]] - primPositions[triangle[0]];
+        const glm::vec3 edge2 = primPositions[triangle[2]] - primPositions[triangle[0]];
+        const glm::vec2 uvEdge1 = primUvs[triangle[1]] - primUvs[triangle[0]];
+        const glm::vec2 uvEdge2 = primUvs[triangle[2]] - primUvs[triangle[0]];
+        const float determinant = uvEdge1.x * uvEdge2.y - uvEdge2.x * uvEdge1.y;
+        if (std::abs(determinant) <= std::numeric_limits<float>::min()) continue;
+
+        faceTangents[i] = (edge1 * uvEdge2.y - edge2 * uvEdge1.y) / determinant;
+        faceBitangents[i] = (edge2 * uvEdge1.x - edge1 * uvEdge2.x) / determinant;
+        faceOrientations[i] = determinant < 0.0f ? 1 : 0;
+        for (int corner = 0; corner < 3; corner++) vertexOrientations[triangle[corner]] |= 1 << faceOrientations[i];
+    }
+
+    // The mirrored side of a split vertex is a copy of it after the vertices of the primitive, which the counting pass left
+    // room for. Triangles with degenerate uvs stay with the original vertex
+    std::vector<uint32_t> splitSources;
+    std::vector<uint32_t> splitVertices(vertexCount, 0);
+    for (uint32_t i = 0; i < vertexCount; i++) if (vertexOrientations[i] == 3) {
+        splitVertices[i] = static_cast<uint32_t>(vertexCount + splitSources.size());
+        splitSources.push_back(i);
+    }
+    if (vertexCount + splitSources.size() > job.vertexCapacity) throw std::runtime_error("Tangent generation split more vertices than were reserved");
+    for (size_t i = 0; i < triangleCount; i++) if (faceOrientations[i] == 1) {
+        for (int corner = 0; corner < 3; corner++){
+            uint32_t &vertex = primIndices[i * 3 + corner];
+            if (splitVertices[vertex] != 0) vertex = splitVertices[vertex];
         }
     }
-    else if (node.camera > -1) throw std::runtime_error("The node is a camera. Do something about it");
-    else if (node.extensions.find("KHR_lights_punctual") != node.extensions.end()){
-        const tinygltf::Light &light = m_model.lights[node.light];
-        GltfLight gltfLight{};
-        gltfLight.name = light.name;
-        gltfLight.position = transform.pos;
-        gltfLight.direction = glm::rotate(rotationQuaternion, glm::vec3(0.0f, 0.0f, 1.0f));
-        gltfLight.color = {light.color[0], light.color[1], light.color[2]};
-        gltfLight.intensity = light.intensity;
-        gltfLight.range = light.range;
-        if (gltfLight.range < 0.01f) gltfLight.range = 10'000.0f;
-        if (light.type == "point") gltfLight.type = GltfLightType::point;
-        else if (light.type == "directional") gltfLight.type = GltfLightType::directional;
-        else if (light.type == "spot") gltfLight.type = GltfLightType::spot;
-        else throw std::runtime_error("Unrecognized gltf light type: " + light.type);
-        lights.push_back(gltfLight);
+    const auto sourceVertex = [&](size_t vertex) {return vertex < vertexCount ? vertex : splitSources[vertex - vertexCount];};
+
+    // Every triangle's tangent and bitangent are projected onto the tangent plane of each of its corners and weighted by the
+    // corner angle, then the sums are orthogonalized against the normal
+    const size_t splitVertexCount = vertexCount + splitSources.size();
+    std::vector<glm::vec3> tangentSums(splitVertexCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> bitangentSums(splitVertexCount, glm::vec3(0.0f));
+    for (size_t i = 0; i < triangleCount; i++){
+        if (faceOrientations[i] < 0) continue;
+        const uint32_t *triangle = primIndices + i * 3;
+        for (int corner = 0; corner < 3; corner++){
+            const uint32_t vertex = triangle[corner];
+            const glm::vec3 &position = primPositions[sourceVertex(vertex)];
+            const glm::vec3 toNext = primPositions[sourceVertex(triangle[(corner + 1) % 3])] - position;
+            const glm::vec3 toPrev = primPositions[sourceVertex(triangle[(corner + 2) % 3])] - position;
+            const float edgeLengths = glm::length(toNext) * glm::length(toPrev);
+            if (edgeLengths <= 0.0f) continue;
+            const float angle = std::acos(std::clamp(glm::dot(toNext, toPrev) / edgeLengths, -1.0f, 1.0f));
+
+            const glm::vec3 &normal = primNormals[sourceVertex(vertex)];
+            const glm::vec3 tangent = faceTangents[i] - normal * glm::dot(normal, faceTangents[i]);
+            const glm::vec3 bitangent = faceBitangents[i] - normal * glm::dot(normal, faceBitangents[i]);
+            if (glm::dot(tangent, tangent) > 0.0f) tangentSums[vertex] += glm::normalize(tangent) * angle;
+            if (glm::dot(bitangent, bitangent) > 0.0f) bitangentSums[vertex] += glm::normalize(bitangent) * angle;
+        }
     }
 
-    for (int child : node.children){
-        processNode(child, transform.pos, rotationQuaternion, transform.scale);
+    const size_t splitOffset = primMesh.vertexOffset + vertexCount;
+    for (size_t i = 0; i < splitSources.size(); i++){
+        const size_t source = primMesh.vertexOffset + splitSources[i];
+        positions[splitOffset + i] = positions[source];
+        if (job.normalAccessor > -1) normals[splitOffset + i] = normals[source];
+        if (job.uvAccessor > -1) uvCoords[splitOffset + i] = uvCoords[source];
+        if (job.colorAccessor > -1) colors[splitOffset + i] = colors[source];
     }
+
+    for (size_t i = 0; i < splitVertexCount; i++){
+        const glm::vec3 &normal = primNormals[sourceVertex(i)];
+        glm::vec3 tangent = tangentSums[i] - normal * glm::dot(normal, tangentSums[i]);
+        if (glm::dot(tangent, tangent) <= std::numeric_limits<float>::min()){
+            // Degenerate uvs, so any direction on the tangent plane will do
+            const glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            tangent = axis - normal * glm::dot(normal, axis);
+            if (glm::dot(tangent, tangent) <= std::numeric_limits<float>::min()) tangent = axis;
+        }
+        tangent = glm::normalize(tangent);
+        const float handedness = glm::dot(glm::cross(normal, tangent), bitangentSums[i]) < 0.0f ? -1.0f : 1.0f;
+        primTangents[i] = glm::vec4(tangent, handedness);
+    }
+    primMesh.vertexCount = static_cast<uint32_t>(splitVertexCount);
 }
 
-void GltfLoader::createTangents(size_t amount)
+const uint8_t *GltfLoader::getBufferViewData(int bufferViewIdx) const
 {
-    tangents.reserve(amount);
-    for (size_t i = 0; i < amount; i++) {
-        tangents.push_back({});     
+    if (!m_decodedBufferViews.empty() && m_decodedBufferViews[bufferViewIdx] != nullptr){
+        // The pointer stays valid after unlocking, since the data is only freed once nothing reads from the view anymore
+        DecodedBufferView &decodedView = *m_decodedBufferViews[bufferViewIdx];
+        std::scoped_lock lock(decodedView.mutex);
+        if (decodedView.data.empty()) decodedView.data = decodeMeshoptBufferView(bufferViewIdx);
+        return decodedView.data.data();
     }
+
+    const tinygltf::BufferView &bufferView = m_model.bufferViews[bufferViewIdx];
+    const uint8_t *bufferData = m_bufferData[bufferView.buffer];
+    if (bufferData == nullptr) throw std::runtime_error("Buffer view " + std::to_string(bufferViewIdx) + " points to a buffer that has no data");
+    if (bufferView.byteOffset + bufferView.byteLength > m_bufferSizes[bufferView.buffer])
+        throw std::runtime_error("Buffer view " + std::to_string(bufferViewIdx) + " goes past the end of its buffer");
+    return bufferData + bufferView.byteOffset;
 }
 
 float GltfLoader::getFloat(const tinygltf::Value &value, const std::string &name)
@@ -488,6 +1334,40 @@ float GltfLoader::getFloat(const tinygltf::Value &value, const std::string &name
     throw std::runtime_error("Couldn't get float from tinygltf. This probably should be handled, but I haven't figured out that yet");
 }
 
+const uint8_t *GltfLoader::getAccessorView(const tinygltf::Accessor &accessor, size_t elementSize, size_t &outStride) const
+{
+    const tinygltf::BufferView &bufferView = m_model.bufferViews[accessor.bufferView];
+    outStride = bufferView.byteStride == 0 ? elementSize : bufferView.byteStride;
+    if (accessor.count > 0 && accessor.byteOffset + outStride * (accessor.count - 1) + elementSize > bufferView.byteLength)
+        throw std::runtime_error("Accessor reads past the end of its buffer view");
+    return getBufferViewData(accessor.bufferView) + accessor.byteOffset;
+}
+
+template<typename Func>
+void GltfLoader::forEachSparseElement(const tinygltf::Accessor &accessor, size_t elementSize, Func func) const
+{
+    const size_t count = static_cast<size_t>(accessor.sparse.count);
+    const int indexSize = tinygltf::GetComponentSizeInBytes(accessor.sparse.indices.componentType);
+    if (indexSize != 1 && indexSize != 2 && indexSize != 4) throw std::runtime_error("Invalid sparse accessor index type: " + std::to_string(accessor.sparse.indices.componentType));
+    if (accessor.sparse.indices.byteOffset + count * indexSize > m_model.bufferViews[accessor.sparse.indices.bufferView].byteLength ||
+            accessor.sparse.values.byteOffset + count * elementSize > m_model.bufferViews[accessor.sparse.values.bufferView].byteLength)
+        throw std::runtime_error("Sparse accessor reads past the end of its buffer views");
+
+    const uint8_t *indices = getBufferViewData(accessor.sparse.indices.bufferView) + accessor.sparse.indices.byteOffset;
+    const uint8_t *values = getBufferViewData(accessor.sparse.values.bufferView) + accessor.sparse.values.byteOffset;
+    for (size_t i = 0; i < count; i++){
+        uint32_t elementIdx = 0;
+        if (indexSize == 1) elementIdx = indices[i];
+        else if (indexSize == 2){
+            uint16_t idx;
+            memcpy(&idx, indices + i * 2, sizeof(idx));
+            elementIdx = idx;
+        } else memcpy(&elementIdx, indices + i * 4, sizeof(elementIdx));
+        if (elementIdx >= accessor.count) throw std::runtime_error("Sparse accessor index is out of bounds");
+        func(elementIdx, values + i * elementSize);
+    }
+}
+
 template<class T>
 void GltfLoader::copyAccessorData(  std::vector<T> &outData, size_t outFirstElement, 
                         const tinygltf::Accessor &accessor, size_t accessorFirstElement, size_t numElementsToCopy)
@@ -495,46 +1375,66 @@ void GltfLoader::copyAccessorData(  std::vector<T> &outData, size_t outFirstElem
     if (outFirstElement >= outData.size()) throw std::runtime_error("Invalid outFirstElement");
     if (accessorFirstElement >= accessor.count) throw std::runtime_error("Invalid accessorFirstElement");
 
-    const tinygltf::BufferView &bufferView = m_model.bufferViews[accessor.bufferView];
-    const uint8_t *buffer = &m_model.buffers[bufferView.buffer].data[accessor.byteOffset + bufferView.byteOffset];
-
     const size_t maxSafeCopySize = std::min(accessor.count - accessorFirstElement, outData.size() - outFirstElement);
     numElementsToCopy = std::min(numElementsToCopy, maxSafeCopySize);
 
-    if (bufferView.byteStride == 0) 
-        memcpy(outData.data() + outFirstElement, reinterpret_cast<const T *>(buffer) + accessorFirstElement, numElementsToCopy * sizeof(T));
+    // Accessors without a buffer view are all zeros apart from their sparse elements
+    if (accessor.bufferView < 0)
+        std::fill(outData.begin() + outFirstElement, outData.begin() + outFirstElement + numElementsToCopy, T{});
     else{
-        for (size_t i = 0; i < numElementsToCopy; i++){
-            outData.data()[outFirstElement + i] = *reinterpret_cast<const T*>(buffer + bufferView.byteStride * i);
+        size_t stride = 0;
+        const uint8_t *buffer = getAccessorView(accessor, sizeof(T), stride);
+        if (stride == sizeof(T)) 
+            memcpy(outData.data() + outFirstElement, reinterpret_cast<const T *>(buffer) + accessorFirstElement, numElementsToCopy * sizeof(T));
+        else{
+            for (size_t i = 0; i < numElementsToCopy; i++){
+                memcpy(outData.data() + outFirstElement + i, buffer + stride * (accessorFirstElement + i), sizeof(T));
+            }
         }
     }
 
-    if (accessor.sparse.isSparse) throw std::runtime_error("It seems the accessor is sparse. Figure out how to handle it");
+    // The sparse elements get written on top of the base data in place, so there's never a dense copy of the deltas
+    if (accessor.sparse.isSparse){
+        forEachSparseElement(accessor, sizeof(T), [&](size_t elementIdx, const uint8_t *value) {
+            if (elementIdx < accessorFirstElement || elementIdx >= accessorFirstElement + numElementsToCopy) return;
+            memcpy(outData.data() + outFirstElement + elementIdx - accessorFirstElement, value, sizeof(T));
+        });
+    }
 };
 
 template<class T>
-bool GltfLoader::getAccessorData(const tinygltf::Accessor &accessor, std::vector<T> &attribVec)
+void GltfLoader::getAccessorData(const tinygltf::Accessor &accessor, std::vector<T> &attribVec, size_t outFirstElement, size_t elementCount)
 {
-    const size_t elemCnt = accessor.count;
-    const size_t oldElemCnt = attribVec.size();
-    attribVec.resize(oldElemCnt + elemCnt);
-    
-    if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT){
-        copyAccessorData<T>(attribVec, oldElemCnt, accessor, 0, accessor.count);
+    constexpr size_t DST_COMPONENTS = sizeof(T) / sizeof(float);
+    elementCount = std::min(elementCount, accessor.count);
+    if (elementCount == 0) return;
+    if (outFirstElement + elementCount > attribVec.size()) throw std::runtime_error("Accessor data doesn't fit into the output range");
+
+    const size_t srcComponents = static_cast<size_t>(tinygltf::GetNumComponentsInType(accessor.type));
+    if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && srcComponents == DST_COMPONENTS) {
+        copyAccessorData<T>(attribVec, outFirstElement, accessor, 0, elementCount);
+        return;
     }
+
+    // Everything else is either quantized (KHR_mesh_quantization) or has a different amount of components than the output
+    const int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+    if (componentSize < 0) throw std::runtime_error("Unknown accessor component type: " + std::to_string(accessor.componentType));
+    const size_t elementSize = static_cast<size_t>(componentSize) * srcComponents;
+    float *dst = reinterpret_cast<float *>(attribVec.data() + outFirstElement);
+
+    if (accessor.bufferView < 0) std::fill(dst, dst + elementCount * DST_COMPONENTS, 0.0f);
     else{
-        throw std::runtime_error(std::string("Yo, the accessor type isnt float. Do something about it. Its type btw is ") + std::to_string(accessor.componentType));
+        size_t stride = 0;
+        const uint8_t *src = getAccessorView(accessor, elementSize, stride);
+        decodeAccessorElements<DST_COMPONENTS>(accessor, srcComponents, src, stride, dst, elementCount);
     }
 
-    return true;
-}
-template <typename T>
-bool GltfLoader::getAttribute(const tinygltf::Primitive &primitive, std::vector<T> &attribVec, const std::string &attribName)
-{
-    const auto &it = primitive.attributes.find(attribName);
-    if (it == primitive.attributes.end()) return false;
-    const tinygltf::Accessor &accessor = m_model.accessors[it->second];
-    return getAccessorData(accessor, attribVec);
+    if (accessor.sparse.isSparse){
+        forEachSparseElement(accessor, elementSize, [&](size_t elementIdx, const uint8_t *value) {
+            if (elementIdx >= elementCount) return;
+            decodeAccessorElements<DST_COMPONENTS>(accessor, srcComponents, value, elementSize, dst + elementIdx * DST_COMPONENTS, 1);
+        });
+    }
 }
 
 }
@@ -0,0 +1,82 @@
+#include <vul_hash.hpp>
+
+#include <cstring>
+
+namespace vul {
+
+static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotl(uint64_t value, int amount) {return (value << amount) | (value >> (64 - amount));}
+static inline uint64_t read64(const uint8_t *data) {uint64_t value; memcpy(&value, data, sizeof(value)); return value;}
+static inline uint32_t read32(const uint8_t *data) {uint32_t value; memcpy(&value, data, sizeof(value)); return value;}
+
+static inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    const uint8_t *const end = ptr + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        const uint8_t *const limit = end - 32;
+        do {
+            v1 = round(v1, read64(ptr));
+            v2 = round(v2, read64(ptr + 8));
+            v3 = round(v3, read64(ptr + 16));
+            v4 = round(v4, read64(ptr + 24));
+            ptr += 32;
+        } while (ptr <= limit);
+
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = mergeRound(hash, v1);
+        hash = mergeRound(hash, v2);
+        hash = mergeRound(hash, v3);
+        hash = mergeRound(hash, v4);
+    } else hash = seed + PRIME5;
+
+    hash += static_cast<uint64_t>(size);
+    while (ptr + 8 <= end) {
+        hash ^= round(0, read64(ptr));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+        ptr += 8;
+    }
+    if (ptr + 4 <= end) {
+        hash ^= static_cast<uint64_t>(read32(ptr)) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        ptr += 4;
+    }
+    while (ptr < end) {
+        hash ^= static_cast<uint64_t>(*ptr) * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+        ptr++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+}
@@ -4,25 +4,66 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <array>
+#include <utility>
 #include <vul_image.hpp>
 #include <vul_device.hpp>
 #include <vul_buffer.hpp>
 #include <vul_debug_tools.hpp>
+#include <vul_bc6h.hpp>
+#include <vul_hash.hpp>
+#include <vul_mapped_file.hpp>
 
+#include <OpenEXR/ImfCompressor.h>
 #include <OpenEXR/ImfRgbaFile.h>
 #include <ktx.h>
 #include <vulkan/vulkan_core.h>
 #include <stb_image.h>
 
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 
 namespace vul {
 
+// Header of the files in the ktx transcode cache. The transcoded data follows it with the mip levels from largest to smallest
+struct KtxTranscodeCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vkFormat;
+    uint32_t baseWidth;
+    uint32_t baseHeight;
+    uint32_t baseDepth;
+    uint32_t mipCount;
+    uint32_t layerCount;
+    uint32_t padding;
+    uint64_t dataSize;
+};
+static constexpr char KTX_TRANSCODE_CACHE_MAGIC[8] = {'V', 'U', 'L', 'K', 'T', 'X', 'T', 'C'};
+static constexpr uint32_t KTX_TRANSCODE_CACHE_VERSION = 1;
+
+static std::string ktxTranscodeCacheDirectory;
+
+static constexpr size_t UASTC_BLOCK_SIZE = 16;
+// About 256KiB of UASTC input per transcode task. Textures that fit in one task aren't split
+static constexpr uint32_t KTX_TRANSCODE_TASK_BLOCK_COUNT = 16384;
+
+static std::string getTranscodeCacheFile(uint64_t key)
+{
+    std::stringstream cacheFile;
+    cacheFile << ktxTranscodeCacheDirectory << '/' << std::hex << std::setw(16) << std::setfill('0') << key << ".vtc";
+    return cacheFile.str();
+}
+
 VulSampler::VulSampler(const VulDevice &vulDevice, VkFilter filter, VkSamplerAddressMode addressMode, float maxAnisotropy,
                 VkBorderColor borderColor, VkSamplerMipmapMode mipMapMode, bool enableSamplerReduction,
                 VkSamplerReductionMode samplerReductionMode, float mipLodBias, float mipMinLod, float mipMaxLod)
@@ -59,6 +100,11 @@ VulSampler::VulSampler(const VulDevice &vulDevice, VkFilter filter, VkSamplerAdd
     VUL_NAME_VK(m_sampler)
 }
 
+VulSampler::VulSampler(VulSampler &&other) noexcept
+    : m_vulDevice{other.m_vulDevice}, m_sampler{std::exchange(other.m_sampler, VK_NULL_HANDLE)}
+{
+}
+
 VulSampler::~VulSampler()
 {
     if (m_sampler != VK_NULL_HANDLE) vkDestroySampler(m_vulDevice.device(), m_sampler, nullptr);
@@ -94,33 +140,89 @@ VulImage::VulImage(const VulDevice &vulDevice) : m_vulDevice{vulDevice}
 
 }
 
+VulImage::VulImage(VulImage &&other) noexcept
+    : m_ownsImage{std::exchange(other.m_ownsImage, false)}, m_format{other.m_format}, m_bitsPerTexel{other.m_bitsPerTexel},
+    m_arrayLayersCount{other.m_arrayLayersCount}, m_memoryProperties{other.m_memoryProperties}, m_usage{other.m_usage},
+    m_layout{other.m_layout}, m_tiling{other.m_tiling}, m_aspect{other.m_aspect}, m_imageType{other.m_imageType},
+    m_imageViewType{other.m_imageViewType}, m_mipLevels{std::move(other.m_mipLevels)}, m_data{std::move(other.m_data)},
+    m_baseWidth{other.m_baseWidth}, m_baseHeight{other.m_baseHeight}, m_baseDepth{other.m_baseDepth},
+    m_sparseBlockExtent{other.m_sparseBlockExtent}, m_blockSize{other.m_blockSize}, m_sparseMipTailFirstLod{other.m_sparseMipTailFirstLod},
+    m_sparseMipTailSize{other.m_sparseMipTailSize}, m_sparseMipTailOffset{other.m_sparseMipTailOffset},
+    m_sparseMipTailStride{other.m_sparseMipTailStride}, m_sparseSingleMipTail{other.m_sparseSingleMipTail},
+    m_stagingBuffer{std::move(other.m_stagingBuffer)}, m_stagingBufferHasData{std::exchange(other.m_stagingBufferHasData, false)},
+    m_image{std::exchange(other.m_image, VK_NULL_HANDLE)}, m_imageView{std::exchange(other.m_imageView, VK_NULL_HANDLE)},
+    m_mipImageViews{std::exchange(other.m_mipImageViews, {})}, m_allocation{std::exchange(other.m_allocation, VulAllocator::Allocation{})},
+    m_sparseMemoryRegions{std::exchange(other.m_sparseMemoryRegions, {})}, m_vulDevice{other.m_vulDevice}
+{
+}
+
 VulImage::~VulImage()
 {
     for (VkImageView imageView : m_mipImageViews) vkDestroyImageView(m_vulDevice.device(), imageView, nullptr);
     if (m_imageView != VK_NULL_HANDLE) vkDestroyImageView(m_vulDevice.device(), m_imageView, nullptr);
     if (m_image != VK_NULL_HANDLE && m_ownsImage) vkDestroyImage(m_vulDevice.device(), m_image, nullptr);
-    if (m_imageMemory != VK_NULL_HANDLE) vkFreeMemory(m_vulDevice.device(), m_imageMemory, nullptr);
+    m_vulDevice.getAllocator().free(m_allocation);
     for (const SparseMemory &sparseMemory : m_sparseMemoryRegions) vkFreeMemory(m_vulDevice.device(), sparseMemory.memory, nullptr);
 }
 
+void VulImage::takeLoadedData(VulImage &&other)
+{
+    m_format = other.m_format;
+    m_bitsPerTexel = other.m_bitsPerTexel;
+    m_baseWidth = other.m_baseWidth;
+    m_baseHeight = other.m_baseHeight;
+    m_baseDepth = other.m_baseDepth;
+    m_mipLevels = std::move(other.m_mipLevels);
+    m_data = std::move(other.m_data);
+    m_stagingBuffer = std::move(other.m_stagingBuffer);
+    m_stagingBufferHasData = other.m_stagingBufferHasData;
+    other.m_stagingBufferHasData = false;
+}
+
 void VulImage::OldVkImageStuff::destoyImageStuff()
 {
     for (VkImageView mipImageView : mipImageViews) vkDestroyImageView(device, mipImageView, nullptr);
     if (imageView != VK_NULL_HANDLE) vkDestroyImageView(device, imageView, nullptr);
     if (image != VK_NULL_HANDLE) vkDestroyImage(device, image, nullptr);
-    if (imageMemory != VK_NULL_HANDLE) vkFreeMemory(device, imageMemory, nullptr);
+    if (allocator != nullptr) allocator->free(allocation);
 }
 
 void VulImage::loadCompressedKtxFromFile(const std::string &fileName, KtxCompressionFormat compressionFormat,
-        uint32_t inputMipLevel, uint32_t mipLevelCount)
+        uint32_t inputMipLevel, uint32_t mipLevelCount, bool transcodeIntoStaging)
 {
-    if (fileName.length() == 0 || mipLevelCount == 0) return;
+    loadOrSplitCompressedKtx(fileName, compressionFormat, inputMipLevel, mipLevelCount, transcodeIntoStaging, false);
+}
+
+std::unique_ptr<VulImage::KtxLoad> VulImage::startCompressedKtxLoad(const std::string &fileName, KtxCompressionFormat compressionFormat,
+        uint32_t inputMipLevel, uint32_t mipLevelCount, bool transcodeIntoStaging)
+{
+    return loadOrSplitCompressedKtx(fileName, compressionFormat, inputMipLevel, mipLevelCount, transcodeIntoStaging, true);
+}
+
+std::unique_ptr<VulImage::KtxLoad> VulImage::loadOrSplitCompressedKtx(const std::string &fileName, KtxCompressionFormat compressionFormat,
+        uint32_t inputMipLevel, uint32_t mipLevelCount, bool transcodeIntoStaging, bool allowSplit)
+{
+    if (fileName.length() == 0 || mipLevelCount == 0) return nullptr;
 
     KtxCompressionFormatProperties ktxFormatProperties = getKtxCompressionFormatProperties(compressionFormat);
     VkFormatProperties formatProperties = getVkFormatProperties(ktxFormatProperties.vkFormat);
 
+    std::unique_ptr<VulMappedFile> ktxFile;
+    std::string cacheFile;
+    if (!ktxTranscodeCacheDirectory.empty()) {
+        ktxFile = std::make_unique<VulMappedFile>(fileName);
+        uint64_t key = hashBytes(ktxFile->getData(), ktxFile->getSize());
+        key = hashCombine(key, static_cast<uint64_t>(compressionFormat));
+        key = hashCombine(key, inputMipLevel);
+        key = hashCombine(key, mipLevelCount);
+        cacheFile = getTranscodeCacheFile(key);
+        if (loadFromKtxTranscodeCache(cacheFile, ktxFormatProperties.vkFormat, transcodeIntoStaging)) return nullptr;
+    }
+
     ktxTexture2 *origTexture;
-    KTX_error_code result = ktxTexture2_CreateFromNamedFile(fileName.c_str(), KTX_TEXTURE_CREATE_NO_FLAGS, &origTexture); 
+    KTX_error_code result = ktxFile.get() != nullptr ?
+        ktxTexture2_CreateFromMemory(ktxFile->getData(), ktxFile->getSize(), KTX_TEXTURE_CREATE_NO_FLAGS, &origTexture) :
+        ktxTexture2_CreateFromNamedFile(fileName.c_str(), KTX_TEXTURE_CREATE_NO_FLAGS, &origTexture); 
     if (result != KTX_SUCCESS) throw std::runtime_error("Failed to create ktxTexture. File: " + fileName + " Error code: " + std::to_string(result));
 
     ktxTextureCreateInfo createInfo{};
@@ -139,57 +241,302 @@ void VulImage::loadCompressedKtxFromFile(const std::string &fileName, KtxCompres
     texture->vtbl->LoadImageData(ktxTexture(origTexture), texture->pData, texture->dataSize);
     mipLevelCount = std::min(texture->numLevels, mipLevelCount);
 
-    result = ktxTexture2_TranscodeBasis(texture, ktxFormatProperties.transcodeFormat, 0);
-    if (result != KTX_SUCCESS) throw std::runtime_error("Failed to transcode ktxTexture to format " +
-            std::to_string(ktxFormatProperties.transcodeFormat) + " File: " + fileName + " Error code: " + std::to_string(result));
-
     const uint32_t baseWidth = alignUp(texture->baseWidth, formatProperties.sideLengthAlignment);
     const uint32_t baseHeight = alignUp(texture->baseHeight, formatProperties.sideLengthAlignment);
     const uint32_t baseDepth = texture->baseDepth;
+    const uint32_t layerCount = texture->numLayers;
+    const size_t requiredSize = setMipLayout(baseWidth, baseHeight, baseDepth, mipLevelCount, layerCount, ktxFormatProperties.vkFormat);
+    uint8_t *dst = allocateTexelStorage(requiredSize, transcodeIntoStaging);
+
+    // UASTC blocks don't depend on each other, so bands of block rows can be transcoded on their own and written straight
+    // to where they go in the image, as long as the target has 4x4 blocks laid out the same way
+    const uint32_t outputBlockSize = formatProperties.bitsPerTexel * 16 / 8;
+    std::vector<KtxLoad::Task> tasks;
+    bool isSplittable = allowSplit && ktxTexture2_GetColorModel_e(texture) == KHR_DF_MODEL_UASTC
+        && formatProperties.sideLengthAlignment == 4 && baseDepth == 1 && texture->numFaces == 1;
+    for (uint32_t i = 0; i < mipLevelCount && isSplittable; i++) {
+        const uint32_t blocksPerRow = (std::max(texture->baseWidth >> i, 1u) + 3) / 4;
+        const uint32_t blockRowCount = (std::max(texture->baseHeight >> i, 1u) + 3) / 4;
+        isSplittable = static_cast<size_t>(blocksPerRow) * blockRowCount * outputBlockSize == m_mipLevels[i].layerSize;
+        const uint32_t bandRowCount = std::max(KTX_TRANSCODE_TASK_BLOCK_COUNT / blocksPerRow, 1u);
+        for (uint32_t layer = 0; layer < layerCount; layer++) for (uint32_t row = 0; row < blockRowCount; row += bandRowCount)
+            tasks.push_back({i, layer, row, std::min(bandRowCount, blockRowCount - row)});
+    }
+    if (isSplittable && tasks.size() > 1) {
+        std::unique_ptr<KtxLoad> load(new KtxLoad(*this));
+        load->m_texture = texture;
+        load->m_transcodeFormat = ktxFormatProperties.transcodeFormat;
+        load->m_outputBlockSize = outputBlockSize;
+        load->m_dst = dst;
+        load->m_cacheFile = cacheFile;
+        load->m_remainingTaskCount = tasks.size();
+        load->m_tasks = std::move(tasks);
+        ktxTexture_Destroy(ktxTexture(origTexture));
+        return load;
+    }
+
+    result = ktxTexture2_TranscodeBasis(texture, ktxFormatProperties.transcodeFormat, 0);
+    if (result != KTX_SUCCESS) throw std::runtime_error("Failed to transcode ktxTexture to format " +
+            std::to_string(ktxFormatProperties.transcodeFormat) + " File: " + fileName + " Error code: " + std::to_string(result));
 
-    std::vector<std::vector<void *>> data(texture->numLevels);
-    uint8_t *pCopySrc = texture->pData;
+    // Libktx always transcodes into its own allocation, so that's the one copy left. The levels are stored smallest first
+    // in it with the layers of a level next to each other
+    std::vector<const uint8_t *> mipData(mipLevelCount);
+    const uint8_t *pCopySrc = texture->pData;
     for (int i = texture->numLevels - 1; i >= 0; i--) {
         const uint32_t width = std::max(baseWidth / static_cast<uint32_t>(std::pow(2, i)), 1u);
         const uint32_t height = std::max(baseHeight / static_cast<uint32_t>(std::pow(2, i)), 1u);
         const uint32_t depth = std::max(baseDepth / static_cast<uint32_t>(std::pow(2, i)), 1u);
-        uint32_t layerSize = alignUp(width, formatProperties.sideLengthAlignment) *
+        const size_t layerSize = static_cast<size_t>(alignUp(width, formatProperties.sideLengthAlignment)) *
             alignUp(height, formatProperties.sideLengthAlignment) * depth * formatProperties.bitsPerTexel / 8;
 
-        data[i].resize(texture->numLayers);
-        for (uint32_t j = 0; j < texture->numLayers; j++) {
-            data[i][j] = pCopySrc;
-            pCopySrc += layerSize;
-        } 
+        if (static_cast<uint32_t>(i) < mipLevelCount) {
+            memcpy(dst + m_mipLevels[i].layers[0], pCopySrc, layerSize * layerCount);
+            mipData[i] = pCopySrc;
+        }
+        pCopySrc += layerSize * layerCount;
     }
-    data.resize(mipLevelCount);
+    for (MipLevel &mipLevel : m_mipLevels) std::fill(mipLevel.containsData.begin(), mipLevel.containsData.end(), true);
 
-    loadRawFromMemory(baseWidth, baseHeight, baseDepth, data, ktxFormatProperties.vkFormat); 
+    if (!cacheFile.empty()) writeKtxTranscodeCache(cacheFile, mipData);
     ktxTexture_Destroy(ktxTexture(origTexture));
     ktxTexture_Destroy(ktxTexture(texture));
+    return nullptr;
+}
+
+VulImage::KtxLoad::~KtxLoad()
+{
+    if (m_texture != nullptr) ktxTexture_Destroy(ktxTexture(m_texture));
+}
+
+bool VulImage::KtxLoad::runTask(uint32_t taskIdx)
+{
+    VUL_PROFILE_FUNC()
+
+    const Task &task = m_tasks[taskIdx];
+    const uint32_t width = std::max(m_texture->baseWidth >> task.mipLevel, 1u);
+    const uint32_t height = std::max(m_texture->baseHeight >> task.mipLevel, 1u);
+    const size_t blocksPerRow = (width + 3) / 4;
+
+    // The band is a texture of its own to libktx, with the same data format descriptor as the whole one
+    ktxTextureCreateInfo createInfo{};
+    createInfo.baseWidth = width;
+    createInfo.baseHeight = std::min(height - task.firstBlockRow * 4, task.blockRowCount * 4);
+    createInfo.baseDepth = 1;
+    createInfo.numLevels = 1;
+    createInfo.numFaces = 1;
+    createInfo.numLayers = 1;
+    createInfo.numDimensions = 2;
+    createInfo.generateMipmaps = false;
+    createInfo.pDfd = m_texture->pDfd;
+    ktxTexture2 *band;
+    KTX_error_code result = ktxTexture2_Create(&createInfo, KTX_TEXTURE_CREATE_ALLOC_STORAGE, &band);
+    if (result != KTX_SUCCESS) throw std::runtime_error("Failed to create ktxTexture for a transcode band. Error code: " + std::to_string(result));
+
+    ktx_size_t imageOffset;
+    ktxTexture_GetImageOffset(ktxTexture(m_texture), task.mipLevel, task.layer, 0, &imageOffset);
+    memcpy(band->pData, m_texture->pData + imageOffset + task.firstBlockRow * blocksPerRow * UASTC_BLOCK_SIZE, band->dataSize);
+    result = ktxTexture2_TranscodeBasis(band, m_transcodeFormat, 0);
+    if (result != KTX_SUCCESS) {
+        ktxTexture_Destroy(ktxTexture(band));
+        throw std::runtime_error("Failed to transcode ktxTexture band to format " + std::to_string(m_transcodeFormat)
+                + " Error code: " + std::to_string(result));
+    }
+    memcpy(m_dst + m_image.m_mipLevels[task.mipLevel].layers[task.layer] + task.firstBlockRow * blocksPerRow * m_outputBlockSize,
+            band->pData, band->dataSize);
+    ktxTexture_Destroy(ktxTexture(band));
+
+    if (--m_remainingTaskCount > 0) return false;
+    finish();
+    return true;
+}
+
+void VulImage::KtxLoad::finish()
+{
+    for (MipLevel &mipLevel : m_image.m_mipLevels) std::fill(mipLevel.containsData.begin(), mipLevel.containsData.end(), true);
+    if (!m_cacheFile.empty()) {
+        std::vector<const uint8_t *> mipData(m_image.m_mipLevels.size());
+        for (size_t i = 0; i < mipData.size(); i++) mipData[i] = m_dst + m_image.m_mipLevels[i].layers[0];
+        m_image.writeKtxTranscodeCache(m_cacheFile, mipData);
+    }
+    m_image.appendOldMipLevels(m_oldData, m_oldMipLevels);
+    ktxTexture_Destroy(ktxTexture(m_texture));
+    m_texture = nullptr;
+}
+
+void VulImage::setKtxTranscodeCacheDirectory(const std::string &directory)
+{
+    if (!directory.empty()) std::filesystem::create_directories(directory);
+    ktxTranscodeCacheDirectory = directory;
+}
+
+const std::string &VulImage::getKtxTranscodeCacheDirectory()
+{
+    return ktxTranscodeCacheDirectory;
+}
+
+bool VulImage::loadFromKtxTranscodeCache(const std::string &cacheFile, VkFormat format, bool intoStaging)
+{
+    VUL_PROFILE_FUNC()
+
+    if (!std::filesystem::exists(cacheFile)) return false;
+    VulMappedFile file(cacheFile);
+
+    KtxTranscodeCacheHeader header;
+    if (file.getSize() < sizeof(header)) return false;
+    memcpy(&header, file.getData(), sizeof(header));
+    if (memcmp(header.magic, KTX_TRANSCODE_CACHE_MAGIC, sizeof(KTX_TRANSCODE_CACHE_MAGIC)) != 0 || header.version != KTX_TRANSCODE_CACHE_VERSION
+            || header.vkFormat != static_cast<uint32_t>(format) || header.baseWidth == 0 || header.baseHeight == 0 || header.baseDepth == 0
+            || header.mipCount == 0 || header.layerCount == 0 || sizeof(header) + header.dataSize > file.getSize()) return false;
+
+    const size_t requiredSize = setMipLayout(header.baseWidth, header.baseHeight, header.baseDepth, header.mipCount, header.layerCount, format);
+    if (requiredSize != header.dataSize) {
+        m_mipLevels.clear();
+        return false;
+    }
+
+    memcpy(allocateTexelStorage(requiredSize, intoStaging), file.getData() + sizeof(header), requiredSize);
+    for (MipLevel &mipLevel : m_mipLevels) std::fill(mipLevel.containsData.begin(), mipLevel.containsData.end(), true);
+    return true;
+}
+
+void VulImage::writeKtxTranscodeCache(const std::string &cacheFile, const std::vector<const uint8_t *> &mipData) const
+{
+    VUL_PROFILE_FUNC()
+
+    KtxTranscodeCacheHeader header{};
+    memcpy(header.magic, KTX_TRANSCODE_CACHE_MAGIC, sizeof(KTX_TRANSCODE_CACHE_MAGIC));
+    header.version = KTX_TRANSCODE_CACHE_VERSION;
+    header.vkFormat = static_cast<uint32_t>(m_format);
+    header.baseWidth = m_baseWidth;
+    header.baseHeight = m_baseHeight;
+    header.baseDepth = m_baseDepth;
+    header.mipCount = m_mipLevels.size();
+    header.layerCount = m_mipLevels[0].layers.size();
+    header.dataSize = 0;
+    for (const MipLevel &mipLevel : m_mipLevels) header.dataSize += mipLevel.layerSize * mipLevel.layers.size();
+
+    // Several threads can transcode the same texture at once, so each writes its own temporary file and the renames race
+    // harmlessly since the contents are identical. A failed write only means the texture gets transcoded again next time
+    std::stringstream tmpFile;
+    tmpFile << cacheFile << '.' << std::this_thread::get_id() << ".tmp";
+    {
+        std::ofstream file(tmpFile.str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (size_t i = 0; i < m_mipLevels.size(); i++)
+            file.write(reinterpret_cast<const char *>(mipData[i]), m_mipLevels[i].layerSize * m_mipLevels[i].layers.size());
+        if (!file.good()) {
+            file.close();
+            std::filesystem::remove(tmpFile.str());
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpFile.str(), cacheFile, error);
+    if (error) std::filesystem::remove(tmpFile.str(), error);
 }
 
-void VulImage::loadCubemapFromEXR(const std::string &filename)
+void VulImage::loadCubemapFromEXR(const std::string &filename, bool compressToBc6h)
 {
-    Imf::RgbaInputFile file(filename.c_str());
-    Imath::Box2i dataWindow = file.dataWindow();
-    uint32_t width = dataWindow.max.x - dataWindow.min.x + 1;
-    uint32_t height = dataWindow.max.y - dataWindow.min.y + 1;
-    assert(height % 6 == 0);
-    height /= 6;
+    VUL_PROFILE_FUNC()
+
+    // Compressing takes far longer than decoding, so the compressed result goes into the transcode cache
+    std::string cacheFile;
+    if (compressToBc6h && !ktxTranscodeCacheDirectory.empty()) {
+        VulMappedFile exrFile(filename);
+        uint64_t key = hashBytes(exrFile.getData(), exrFile.getSize());
+        key = hashCombine(key, static_cast<uint64_t>(VK_FORMAT_BC6H_UFLOAT_BLOCK));
+        key = hashCombine(key, static_cast<uint64_t>(BC6H_ENCODER_VERSION));
+        cacheFile = getTranscodeCacheFile(key);
+        if (loadFromKtxTranscodeCache(cacheFile, VK_FORMAT_BC6H_UFLOAT_BLOCK, false)) return;
+    }
+
+    Imath::Box2i dataWindow;
+    uint32_t linesPerBlock = 1;
+    {
+        Imf::RgbaInputFile file(filename.c_str());
+        dataWindow = file.dataWindow();
+        const Imf::Header &header = file.header();
+        linesPerBlock = header.hasTileDescription() ? header.tileDescription().ySize : Imf::numLinesInBuffer(header.compression());
+    }
+    const uint32_t width = dataWindow.max.x - dataWindow.min.x + 1;
+    const uint32_t fileHeight = dataWindow.max.y - dataWindow.min.y + 1;
+    assert(fileHeight % 6 == 0);
+    const uint32_t height = fileHeight / 6;
+
+    // The faces are stacked on top of each other in the file, and the last two are in the opposite order to Vulkan's
+    constexpr std::array<uint32_t, 6> FILE_FACE_TO_LAYER = {0, 1, 2, 3, 5, 4};
+    const size_t faceTexelCount = static_cast<size_t>(width) * height;
+    std::vector<Imf::Rgba> decodedTexels;
+    Imf::Rgba *texels = nullptr;
+    if (compressToBc6h) {
+        decodedTexels.resize(faceTexelCount * 6);
+        texels = decodedTexels.data();
+    } else {
+        keepEmpty(width, height, 1, 1, 6, VK_FORMAT_R16G16B16A16_SFLOAT);
+        texels = reinterpret_cast<Imf::Rgba *>(m_data.data());
+    }
 
-    std::unique_ptr<Imf::Rgba[]> pixels = std::unique_ptr<Imf::Rgba[]>(new Imf::Rgba[width * height * 6]());
-    file.setFrameBuffer(pixels.get(), 1, width);
-    file.readPixels(dataWindow.min.y, dataWindow.max.y);
+    // Every thread decodes chunks of rows of the whole file with its own handle to it. Chunks are a whole number of the file's
+    // compression blocks, like the 256 scanlines of DWAB, counted from the top of the data window where the blocks start, so no
+    // block gets decoded by two threads. Blocks can cross faces, so a chunk is read face by face
+    const uint32_t rowsPerChunk = (64 + linesPerBlock - 1) / linesPerBlock * linesPerBlock;
+    const uint32_t chunkCount = (fileHeight + rowsPerChunk - 1) / rowsPerChunk;
+    std::atomic_uint32_t chunkIdx = 0;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto decodeChunks = [&]() {
+        try {
+            std::unique_ptr<Imf::RgbaInputFile> file;
+            for (uint32_t i = chunkIdx++; i < chunkCount; i = chunkIdx++) {
+                if (file == nullptr) file = std::make_unique<Imf::RgbaInputFile>(filename.c_str());
+                const uint32_t chunkEnd = std::min((i + 1) * rowsPerChunk, fileHeight);
+                for (uint32_t row = i * rowsPerChunk; row < chunkEnd;) {
+                    const uint32_t face = row / height;
+                    const uint32_t faceEnd = std::min((face + 1) * height, chunkEnd);
+                    // Exr frame buffers point to where the texel at (0, 0) would be, and this puts the face's first row at its layer
+                    Imf::Rgba *faceStart = texels + faceTexelCount * FILE_FACE_TO_LAYER[face];
+                    file->setFrameBuffer(faceStart - dataWindow.min.x - (static_cast<ptrdiff_t>(dataWindow.min.y) + face * height) * width, 1, width);
+                    file->readPixels(dataWindow.min.y + row, dataWindow.min.y + faceEnd - 1);
+                    row = faceEnd;
+                }
+            }
+        } catch (...) {
+            std::scoped_lock lock(errorMutex);
+            if (!error) error = std::current_exception();
+        }
+    };
+    {
+        const uint32_t threadCount = std::min(std::max(std::thread::hardware_concurrency(), 1u), chunkCount);
+        std::vector<std::jthread> threads(threadCount);
+        for (size_t i = 0; i < threads.size(); i++) threads[i] = std::jthread(decodeChunks);
+    }
+    if (error) std::rethrow_exception(error);
 
-    std::vector<void *> mipLevel(6);
-    mipLevel[0] = pixels.get() + height * width * 0;
-    mipLevel[1] = pixels.get() + height * width * 1;
-    mipLevel[2] = pixels.get() + height * width * 2;
-    mipLevel[3] = pixels.get() + height * width * 3;
-    mipLevel[4] = pixels.get() + height * width * 5;
-    mipLevel[5] = pixels.get() + height * width * 4;
-    loadRawFromMemory(width, height, 1, {mipLevel}, VK_FORMAT_R16G16B16A16_SFLOAT);
+    if (!compressToBc6h) {
+        for (MipLevel &mipLevel : m_mipLevels) std::fill(mipLevel.containsData.begin(), mipLevel.containsData.end(), true);
+        return;
+    }
+
+    keepEmpty(width, height, 1, 1, 6, VK_FORMAT_BC6H_UFLOAT_BLOCK);
+    const uint32_t blockRowCount = (height + 3) / 4;
+    std::atomic_uint32_t blockRowIdx = 0;
+    auto compressBlockRows = [&]() {
+        for (uint32_t i = blockRowIdx++; i < blockRowCount * 6; i = blockRowIdx++) {
+            const uint32_t layer = i / blockRowCount;
+            compressBc6hBlockRows(reinterpret_cast<const uint16_t *>(texels + faceTexelCount * layer), width, height,
+                    i % blockRowCount, 1, &m_data[m_mipLevels[0].layers[layer]]);
+        }
+    };
+    {
+        const uint32_t threadCount = std::min(std::max(std::thread::hardware_concurrency(), 1u), blockRowCount * 6);
+        std::vector<std::jthread> threads(threadCount);
+        for (size_t i = 0; i < threads.size(); i++) threads[i] = std::jthread(compressBlockRows);
+    }
+    for (MipLevel &mipLevel : m_mipLevels) std::fill(mipLevel.containsData.begin(), mipLevel.containsData.end(), true);
+
+    if (!cacheFile.empty()) writeKtxTranscodeCache(cacheFile, {m_data.data()});
 }
 
 void VulImage::loadUncompressedFromFile(const std::string &filename)
@@ -220,6 +567,18 @@ void VulImage::loadRawFromMemory(uint32_t baseWidth, uint32_t baseHeight, uint32
 
 void VulImage::keepEmpty(uint32_t baseWidth, uint32_t baseHeight, uint32_t baseDepth, uint32_t mipCount,
         uint32_t arrayCount, VkFormat format)
+{
+    m_data.resize(setMipLayout(baseWidth, baseHeight, baseDepth, mipCount, arrayCount, format));
+}
+
+void VulImage::keepEmptyWithoutData(uint32_t baseWidth, uint32_t baseHeight, uint32_t baseDepth, uint32_t mipCount,
+        uint32_t arrayCount, VkFormat format)
+{
+    setMipLayout(baseWidth, baseHeight, baseDepth, mipCount, arrayCount, format);
+}
+
+size_t VulImage::setMipLayout(uint32_t baseWidth, uint32_t baseHeight, uint32_t baseDepth, uint32_t mipCount,
+        uint32_t arrayCount, VkFormat format)
 {
     assert(baseWidth > 0);
     assert(baseHeight > 0);
@@ -244,24 +603,62 @@ void VulImage::keepEmpty(uint32_t baseWidth, uint32_t baseHeight, uint32_t baseD
         m_mipLevels[i].depth = depth;
         m_mipLevels[i].layerSize = alignUp(width, formatProperties.sideLengthAlignment)
             * alignUp(height, formatProperties.sideLengthAlignment) * depth * formatProperties.bitsPerTexel / 8;
-        requiredSize += m_mipLevels[i].layerSize * arrayCount;
+        m_mipLevels[i].layers.resize(arrayCount);
+        m_mipLevels[i].containsData.assign(arrayCount, false);
+        for (uint32_t j = 0; j < arrayCount; j++) {
+            m_mipLevels[i].layers[j] = requiredSize;
+            requiredSize += m_mipLevels[i].layerSize;
+        }
     }
+    return requiredSize;
+}
 
-    m_data.resize(requiredSize);
-    for (uint32_t i = 0; i < mipCount; i++) {
-        m_mipLevels[i].layers.resize(arrayCount);
-        m_mipLevels[i].containsData.resize(arrayCount);
+uint8_t *VulImage::allocateTexelStorage(size_t size, bool inStaging)
+{
+    if (!inStaging) {
+        m_data.resize(size);
+        return m_data.data();
     }
+
+    // Host visible and coherent, so the loader writes straight into memory that the upload copies from
+    m_stagingBuffer = std::make_unique<vul::VulBuffer>(1, size, false, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, m_vulDevice);
+    VkResult result = m_stagingBuffer->mapAll();
+    if (result != VK_SUCCESS) throw std::runtime_error("Failed to map staging buffer of image " + name + ". Error: " + std::to_string(result));
+    m_stagingBufferHasData = true;
+    return static_cast<uint8_t *>(m_stagingBuffer->getMappedMemory());
 }
 
 void VulImage::addMipLevelsToStartFromCompressedKtxFile(const std::string &fileName,
         KtxCompressionFormat compressionFormat, uint32_t mipLevelCount)
 {
-    const std::vector<uint8_t> oldData = m_data;
-    std::vector<MipLevel> oldMipLevels = m_mipLevels;
+    addOrSplitMipLevelsFromCompressedKtx(fileName, compressionFormat, mipLevelCount, false);
+}
+
+std::unique_ptr<VulImage::KtxLoad> VulImage::startAddingMipLevelsFromCompressedKtxFile(const std::string &fileName,
+        KtxCompressionFormat compressionFormat, uint32_t mipLevelCount)
+{
+    return addOrSplitMipLevelsFromCompressedKtx(fileName, compressionFormat, mipLevelCount, true);
+}
+
+std::unique_ptr<VulImage::KtxLoad> VulImage::addOrSplitMipLevelsFromCompressedKtx(const std::string &fileName,
+        KtxCompressionFormat compressionFormat, uint32_t mipLevelCount, bool allowSplit)
+{
+    std::vector<uint8_t> oldData = std::move(m_data);
+    std::vector<MipLevel> oldMipLevels = std::move(m_mipLevels);
     m_mipLevels.clear();
     m_data.clear();
-    loadCompressedKtxFromFile(fileName, compressionFormat, 0, mipLevelCount);
+    std::unique_ptr<KtxLoad> load = loadOrSplitCompressedKtx(fileName, compressionFormat, 0, mipLevelCount, false, allowSplit);
+    if (load == nullptr) {
+        appendOldMipLevels(oldData, oldMipLevels);
+        return nullptr;
+    }
+    load->m_oldData = std::move(oldData);
+    load->m_oldMipLevels = std::move(oldMipLevels);
+    return load;
+}
+
+void VulImage::appendOldMipLevels(const std::vector<uint8_t> &oldData, std::vector<MipLevel> &oldMipLevels)
+{
     for (MipLevel &mipLevel : oldMipLevels) {
         for (size_t &layer : mipLevel.layers) layer += m_data.size();
     }
@@ -283,19 +680,21 @@ std::unique_ptr<VulImage::OldVkImageStuff> VulImage::createCustomImage(VkImageVi
         containsData = containsData || m_mipLevels[i].containsData[j];
     if (containsData && isDeviceLocal) {
         transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cmdBuf);
-        size_t totalSize = 0;
-        for (size_t i = 0; i < m_mipLevels.size(); i++) totalSize += m_mipLevels[i].layerSize * m_arrayLayersCount;
-        m_stagingBuffer = std::make_unique<vul::VulBuffer>(1, totalSize, false, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, m_vulDevice);
+        const bool needsStagingWrites = !m_stagingBufferHasData;
+        if (needsStagingWrites) {
+            size_t totalSize = 0;
+            for (size_t i = 0; i < m_mipLevels.size(); i++) totalSize += m_mipLevels[i].layerSize * m_arrayLayersCount;
+            m_stagingBuffer = std::make_unique<vul::VulBuffer>(1, totalSize, false, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, m_vulDevice);
+        }
         size_t offset = 0;
         for (size_t i = 0; i < m_mipLevels.size(); i++) {
-            m_stagingBuffer->writeData(&m_data[m_mipLevels[i].layers[0]], m_mipLevels[i].layerSize * m_arrayLayersCount, offset, VK_NULL_HANDLE);
+            if (needsStagingWrites) m_stagingBuffer->writeData(&m_data[m_mipLevels[i].layers[0]], m_mipLevels[i].layerSize * m_arrayLayersCount, offset, VK_NULL_HANDLE);
             copyBufferToImage(m_stagingBuffer->getBuffer(), offset, i, cmdBuf);
             offset += m_mipLevels[i].layerSize * m_arrayLayersCount;
 
         }
         if (layout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, cmdBuf);
         VUL_NAME_VK(m_stagingBuffer->getBuffer())
-        VUL_NAME_VK(m_stagingBuffer->getMemory())
         
     }
     else transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, layout, cmdBuf);
@@ -325,6 +724,25 @@ std::unique_ptr<VulImage::OldVkImageStuff> VulImage::createCustomImageSparse(VkI
     assert(propertyCount < MAX_PROPERTIES && propertyCount > 0);
     m_sparseBlockExtent = properties[0].properties.imageGranularity;
 
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(m_vulDevice.device(), m_image, &memoryRequirements);
+    m_blockSize = memoryRequirements.alignment;
+
+    uint32_t requirementCount = 0;
+    vkGetImageSparseMemoryRequirements(m_vulDevice.device(), m_image, &requirementCount, nullptr);
+    std::vector<VkSparseImageMemoryRequirements> requirements(requirementCount);
+    vkGetImageSparseMemoryRequirements(m_vulDevice.device(), m_image, &requirementCount, requirements.data());
+    m_sparseMipTailFirstLod = m_mipLevels.size();
+    for (const VkSparseImageMemoryRequirements &requirement : requirements) {
+        if (!(requirement.formatProperties.aspectMask & m_aspect)) continue;
+        m_sparseMipTailFirstLod = requirement.imageMipTailFirstLod;
+        m_sparseMipTailSize = requirement.imageMipTailSize;
+        m_sparseMipTailOffset = requirement.imageMipTailOffset;
+        m_sparseMipTailStride = requirement.imageMipTailStride;
+        m_sparseSingleMipTail = requirement.formatProperties.flags & VK_SPARSE_IMAGE_FORMAT_SINGLE_MIPTAIL_BIT;
+        break;
+    }
+
     m_imageView = createImageView(0, m_mipLevels.size());
     transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, layout, cmdBuf);
 
@@ -352,7 +770,7 @@ void VulImage::allocateSparseMemory(const std::vector<uint32_t> &blockCounts)
     }
 }
 
-void VulImage::bindSparseMemory(const std::vector<SparseBindInfo> &bindInfos)
+void VulImage::bindSparseMemory(const std::vector<SparseBindInfo> &bindInfos, VkSemaphore signalSemaphore)
 {
     std::vector<VkSparseImageMemoryBind> binds;
     for (const SparseBindInfo &info : bindInfos) {
@@ -360,8 +778,8 @@ void VulImage::bindSparseMemory(const std::vector<SparseBindInfo> &bindInfos)
         bind.subresource.aspectMask = m_aspect;
         bind.subresource.mipLevel = info.mipLevel;
         bind.subresource.arrayLayer = info.arrayLayer;
-        bind.memory = m_sparseMemoryRegions[info.memoryIndex].memory;
-        bind.memoryOffset = info.blockOffset * m_blockSize;
+        bind.memory = info.unbind ? VK_NULL_HANDLE : m_sparseMemoryRegions[info.memoryIndex].memory;
+        bind.memoryOffset = info.unbind ? 0 : info.blockOffset * m_blockSize;
         bind.offset = info.imageRegionOffset;
         bind.extent = info.imageRegionSize;
         bind.flags = 0;
@@ -379,11 +797,55 @@ void VulImage::bindSparseMemory(const std::vector<SparseBindInfo> &bindInfos)
     bindInfo.pImageBinds = &imageMemoryBindInfo;
     bindInfo.imageBindCount = 1;
 
+    if (signalSemaphore != VK_NULL_HANDLE) {
+        bindInfo.pSignalSemaphores = &signalSemaphore;
+        bindInfo.signalSemaphoreCount = 1;
+        VkResult result = vkQueueBindSparse(m_vulDevice.mainQueue(), 1, &bindInfo, VK_NULL_HANDLE);
+        if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind sparse memory of image " + name + ". Error: " + std::to_string(result));
+        return;
+    }
     vkQueueWaitIdle(m_vulDevice.mainQueue());
     vkQueueBindSparse(m_vulDevice.mainQueue(), 1, &bindInfo, VK_NULL_HANDLE);
     vkQueueWaitIdle(m_vulDevice.mainQueue());
 }
 
+void VulImage::bindSparseMipTail(uint32_t memoryIndex, uint32_t blockOffset)
+{
+    if (getSparseMipTailBlockCount() == 0) return;
+    const uint32_t tailCount = m_sparseSingleMipTail ? 1 : m_arrayLayersCount;
+    const VkDeviceSize blocksPerTail = (m_sparseMipTailSize + m_blockSize - 1) / m_blockSize;
+
+    std::vector<VkSparseMemoryBind> binds(tailCount);
+    for (uint32_t i = 0; i < tailCount; i++) {
+        binds[i].resourceOffset = m_sparseMipTailOffset + i * m_sparseMipTailStride;
+        binds[i].size = m_sparseMipTailSize;
+        binds[i].memory = m_sparseMemoryRegions[memoryIndex].memory;
+        binds[i].memoryOffset = (blockOffset + i * blocksPerTail) * m_blockSize;
+        binds[i].flags = 0;
+    }
+
+    VkSparseImageOpaqueMemoryBindInfo opaqueMemoryBindInfo{};
+    opaqueMemoryBindInfo.image = m_image;
+    opaqueMemoryBindInfo.pBinds = binds.data();
+    opaqueMemoryBindInfo.bindCount = binds.size();
+
+    VkBindSparseInfo bindInfo{};
+    bindInfo.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+    bindInfo.pImageOpaqueBinds = &opaqueMemoryBindInfo;
+    bindInfo.imageOpaqueBindCount = 1;
+
+    vkQueueWaitIdle(m_vulDevice.mainQueue());
+    vkQueueBindSparse(m_vulDevice.mainQueue(), 1, &bindInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(m_vulDevice.mainQueue());
+}
+
+uint32_t VulImage::getSparseMipTailBlockCount() const
+{
+    if (m_sparseMipTailFirstLod >= m_mipLevels.size() || m_sparseMipTailSize == 0) return 0;
+    const uint32_t tailCount = m_sparseSingleMipTail ? 1 : m_arrayLayersCount;
+    return (m_sparseMipTailSize + m_blockSize - 1) / m_blockSize * tailCount;
+}
+
 void VulImage::createFromVkImage(VkImage image, VkImageViewType type, VkFormat format, VkImageAspectFlags aspect,
         uint32_t mipLevelCount, uint32_t arrayLayerCount)
 {
@@ -397,14 +859,106 @@ void VulImage::createFromVkImage(VkImage image, VkImageViewType type, VkFormat f
     m_imageView = createImageView(0, m_mipLevels.size());
 }
 
+void VulImage::createMipMaps(VkCommandBuffer cmdBuf)
+{
+    VUL_PROFILE_FUNC()
+
+    const VkImageLayout layout = m_layout;
+    if (layout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) transitionImageLayout(layout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cmdBuf);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_image;
+    barrier.subresourceRange.aspectMask = m_aspect;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = m_arrayLayersCount;
+
+    for (uint32_t mip = 1; mip < m_mipLevels.size(); mip++) {
+        barrier.subresourceRange.baseMipLevel = mip - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        const MipLevel &src = m_mipLevels[mip - 1];
+        const MipLevel &dst = m_mipLevels[mip];
+        VkImageBlit blit{};
+        blit.srcOffsets[1] = {static_cast<int32_t>(src.width), static_cast<int32_t>(src.height), static_cast<int32_t>(src.depth)};
+        blit.srcSubresource = {m_aspect, mip - 1, 0, m_arrayLayersCount};
+        blit.dstOffsets[1] = {static_cast<int32_t>(dst.width), static_cast<int32_t>(dst.height), static_cast<int32_t>(dst.depth)};
+        blit.dstSubresource = {m_aspect, mip, 0, m_arrayLayersCount};
+        vkCmdBlitImage(cmdBuf, m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                1, &blit, VK_FILTER_LINEAR);
+    }
+
+    // All but the last mip are now transfer sources, so they go back separately from it
+    const VkImageLayout finalLayout = layout == VK_IMAGE_LAYOUT_UNDEFINED ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : layout;
+    std::array<VkImageMemoryBarrier, 2> finalBarriers = {barrier, barrier};
+    finalBarriers[0].subresourceRange.baseMipLevel = 0;
+    finalBarriers[0].subresourceRange.levelCount = m_mipLevels.size() - 1;
+    finalBarriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    finalBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    finalBarriers[1].subresourceRange.baseMipLevel = m_mipLevels.size() - 1;
+    finalBarriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    finalBarriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    for (VkImageMemoryBarrier &finalBarrier : finalBarriers) {
+        finalBarrier.newLayout = finalLayout;
+        finalBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+    const uint32_t finalBarrierCount = m_mipLevels.size() > 1 ? 2 : 1;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr,
+            finalBarrierCount, &finalBarriers[2 - finalBarrierCount]);
+    m_layout = finalLayout;
+}
+
 void VulImage::createImageViewsForMipMaps()
 {
+    if (m_mipImageViews.size() > 0) return;
     m_mipImageViews.resize(m_mipLevels.size());
     for (uint32_t i = 0; i < m_mipImageViews.size(); i++) {
         m_mipImageViews[i] = createImageView(i, 1);
     }
 }
 
+void VulImage::modifyImage(const std::vector<DataSection> &modificationSections, VkCommandBuffer cmdBuf)
+{
+    VUL_PROFILE_FUNC()
+
+    if (modificationSections.size() == 0) return;
+    size_t totalSize = 0;
+    for (const DataSection &section : modificationSections) totalSize += section.dataSize;
+    m_stagingBuffer = std::make_unique<vul::VulBuffer>(1, totalSize, false, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, m_vulDevice);
+    VkResult result = m_stagingBuffer->mapAll();
+    if (result != VK_SUCCESS) throw std::runtime_error("Failed to map staging buffer of image " + name + ". Error: " + std::to_string(result));
+    VUL_NAME_VK(m_stagingBuffer->getBuffer())
+
+    std::vector<VkBufferImageCopy> regions(modificationSections.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < modificationSections.size(); i++) {
+        const DataSection &section = modificationSections[i];
+        memcpy(static_cast<uint8_t *>(m_stagingBuffer->getMappedMemory()) + offset, section.data, section.dataSize);
+        regions[i].bufferOffset = offset;
+        regions[i].bufferRowLength = 0;
+        regions[i].bufferImageHeight = 0;
+        regions[i].imageSubresource.aspectMask = m_aspect;
+        regions[i].imageSubresource.mipLevel = section.mipLevel;
+        regions[i].imageSubresource.baseArrayLayer = section.arrayLayer;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageOffset = {static_cast<int32_t>(section.startingX), static_cast<int32_t>(section.startingY), static_cast<int32_t>(section.startingZ)};
+        regions[i].imageExtent = {section.width, section.height, section.depth};
+        offset += section.dataSize;
+    }
+
+    const VkImageLayout layout = m_layout;
+    if (layout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) transitionImageLayout(layout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cmdBuf);
+    vkCmdCopyBufferToImage(cmdBuf, m_stagingBuffer->getBuffer(), m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(), regions.data());
+    if (layout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, cmdBuf);
+}
+
 VkRenderingAttachmentInfo VulImage::getAttachmentInfo(VkClearValue clearValue) const
 {
     VUL_PROFILE_FUNC()
@@ -528,6 +1082,33 @@ void VulImage::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newL
     m_layout = newLayout;
 }
 
+void VulImage::transitionImageLayoutWithStages(VkImageLayout newLayout, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+        VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkCommandBuffer cmdBuf)
+{
+    VkImageMemoryBarrier barrier = makeLayoutTransitionBarrier(newLayout, srcAccess, dstAccess);
+    vkCmdPipelineBarrier(cmdBuf, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+VkImageMemoryBarrier VulImage::makeLayoutTransitionBarrier(VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = m_layout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.image = m_image;
+    barrier.subresourceRange.aspectMask = m_aspect;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = m_mipLevels.size();
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = m_arrayLayersCount;
+    m_layout = newLayout;
+    return barrier;
+}
+
 void VulImage::transitionQueueFamily(uint32_t srcFamilyIdx, uint32_t dstFamilyIdx, VkPipelineStageFlags accessMask, VkCommandBuffer cmdBuf)
 {
     VkImageMemoryBarrier barrier{};
@@ -678,11 +1259,14 @@ std::unique_ptr<VulImage::OldVkImageStuff> VulImage::prepareImageCreation(VkImag
 
     std::unique_ptr<OldVkImageStuff> oldVkImageStuff = std::make_unique<OldVkImageStuff>();
     oldVkImageStuff->image = m_image;
-    oldVkImageStuff->imageMemory = m_imageMemory;
+    oldVkImageStuff->allocation = m_allocation;
     oldVkImageStuff->imageView = m_imageView;
     oldVkImageStuff->mipImageViews = m_mipImageViews;
     oldVkImageStuff->device = m_vulDevice.device();
-    deleteStagingResources();
+    oldVkImageStuff->allocator = &m_vulDevice.getAllocator();
+    m_allocation = VulAllocator::Allocation{};
+    m_mipImageViews.clear();
+    if (!m_stagingBufferHasData) deleteStagingResources();
 
     return oldVkImageStuff;
 }
@@ -720,18 +1304,12 @@ void VulImage::allocateVkMemory()
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(m_vulDevice.device(), m_image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_vulDevice.findMemoryType(memRequirements.memoryTypeBits, m_memoryProperties);
-
-    if (vkAllocateMemory(m_vulDevice.device(), &allocInfo, nullptr, &m_imageMemory) != VK_SUCCESS)
+    const VulAllocator::ResourceType resourceType = m_tiling == VK_IMAGE_TILING_LINEAR ? VulAllocator::ResourceType::linear :
+        VulAllocator::ResourceType::optimal;
+    if (m_vulDevice.getAllocator().allocate(memRequirements, m_memoryProperties, resourceType, m_allocation) != VK_SUCCESS)
         throw std::runtime_error("failed to allocate image memory in VulImage");
-    if (vkBindImageMemory(m_vulDevice.device(), m_image, m_imageMemory, 0) != VK_SUCCESS)
+    if (vkBindImageMemory(m_vulDevice.device(), m_image, m_allocation.memory, m_allocation.offset) != VK_SUCCESS)
         throw std::runtime_error("Failed to bind image memory in VulImage");
-
-    if (name.length() > 0) VUL_NAME_VK_MANUAL(m_imageMemory, (name + "   image memory").c_str());
-    if (name.length() == 0) VUL_NAME_VK(m_imageMemory)
 }
 
 VkImageView VulImage::createImageView(uint32_t baseMipLevel, uint32_t mipLevelCount)
@@ -903,6 +1481,10 @@ VulImage::VkFormatProperties VulImage::getVkFormatProperties(VkFormat format)
             properties.bitsPerTexel = 8;
             properties.sideLengthAlignment = 4;
             break;
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+            properties.bitsPerTexel = 8;
+            properties.sideLengthAlignment = 4;
+            break;
         case VK_FORMAT_BC7_SRGB_BLOCK:
             properties.bitsPerTexel = 8;
             properties.sideLengthAlignment = 4;
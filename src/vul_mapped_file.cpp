@@ -0,0 +1,44 @@
+#include <vul_mapped_file.hpp>
+#include <vul_debug_tools.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vul {
+
+VulMappedFile::VulMappedFile(const std::string &fileName) : m_fileName{fileName}
+{
+    VUL_PROFILE_FUNC()
+
+    const int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open file for mapping: " + fileName + " Error: " + std::strerror(errno));
+
+    struct stat fileStats{};
+    if (fstat(fd, &fileStats) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to get the size of file: " + fileName + " Error: " + std::strerror(errno));
+    }
+    m_size = static_cast<size_t>(fileStats.st_size);
+    if (m_size == 0) {
+        close(fd);
+        return;
+    }
+
+    void *mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) throw std::runtime_error("Failed to map file: " + fileName + " Error: " + std::strerror(errno));
+    m_data = static_cast<const uint8_t *>(mapping);
+}
+
+VulMappedFile::~VulMappedFile()
+{
+    if (m_data != nullptr) munmap(const_cast<uint8_t *>(m_data), m_size);
+}
+
+}
@@ -3,6 +3,7 @@
 #include <functional>
 #include <thread>
 #include <vul_meshlet_scene.hpp>
+#include <vul_upload_batch.hpp>
 #include <meshoptimizer/src/meshoptimizer.h>
 
 namespace vul {
@@ -122,7 +123,7 @@ void VulMeshletScene::createMeshletsFromScene(vul::Scene &scene, uint32_t maxTri
     materials = scene.materials;
     images = scene.images;
 
-    VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
+    VulUploadBatch uploads(vulDevice);
     if (wantedBuffers.vertex) vertexBuffer = std::move(scene.vertexBuffer);
     if (wantedBuffers.normal) normalBuffer = std::move(scene.normalBuffer);
     if (wantedBuffers.tangent) tangentBuffer = std::move(scene.tangentBuffer);
@@ -130,34 +131,36 @@ void VulMeshletScene::createMeshletsFromScene(vul::Scene &scene, uint32_t maxTri
     if (wantedBuffers.vertIdxs) {
         vertIndexBuffer = std::make_unique<vul::VulBuffer>(sizeof(*vertIndices.begin()), vertIndices.size(), true,
             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulDevice);
-        vertIndexBuffer->writeVector(vertIndices, 0, cmdBuf);
+        uploads.writeVector(*vertIndexBuffer, vertIndices, 0);
     }
     if (wantedBuffers.triIdxs) {
         triIndexBuffer = std::make_unique<vul::VulBuffer>(sizeof(*triIndices.begin()), triIndices.size(), true,
                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulDevice);
-        triIndexBuffer->writeVector(triIndices, 0, cmdBuf);
+        uploads.writeVector(*triIndexBuffer, triIndices, 0);
     }
     if (wantedBuffers.material) materialBuffer = std::move(scene.materialBuffer);
     if (wantedBuffers.meshlets) {
         meshletBuffer = std::make_unique<vul::VulBuffer>(sizeof(Meshlet), meshlets.size(), true,
                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulDevice);
-        meshletBuffer->writeVector(meshlets, 0, cmdBuf);
+        uploads.writeVector(*meshletBuffer, meshlets, 0);
     }
     if (wantedBuffers.meshletBounds) {
         meshletBoundsBuffer = std::make_unique<vul::VulBuffer>(sizeof(MeshletBounds), meshletBounds.size(), true,
                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulDevice);
-        meshletBoundsBuffer->writeVector(meshletBounds, 0, cmdBuf);
+        uploads.writeVector(*meshletBoundsBuffer, meshletBounds, 0);
     }
     if (wantedBuffers.meshes) {
         meshBuffer = std::make_unique<vul::VulBuffer>(sizeof(MeshInfo), meshes.size(), true,
                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulDevice);
-        meshBuffer->writeVector(meshes, 0, cmdBuf);
+        uploads.writeVector(*meshBuffer, meshes, 0);
     }
     if (wantedBuffers.indirectDrawCommands) {
         indirectDrawCommandsBuffer = std::make_unique<vul::VulBuffer>(sizeof(VkDrawMeshTasksIndirectCommandEXT),
                 indirectDrawCommands.size(), true, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulDevice);
-        indirectDrawCommandsBuffer->writeVector(indirectDrawCommands, 0, cmdBuf);
+        uploads.writeVector(*indirectDrawCommandsBuffer, indirectDrawCommands, 0);
     }
+    VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
+    uploads.record(cmdBuf, cmdPool);
     cmdPool.submit(cmdBuf, true);
 }
 
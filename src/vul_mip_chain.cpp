@@ -0,0 +1,96 @@
+#include <vul_mip_chain.hpp>
+#include <vul_debug_tools.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace vul {
+
+VulMipChainGenerator::VulMipChainGenerator(VulImage &image, Reduction reduction, const VulDescriptorPool &descPool,
+        const VulDevice &vulDevice, const std::string &shaderFile) : m_image{image}, m_reduction{reduction}, m_vulDevice{vulDevice}
+{
+    if (m_image.getImageType() != VK_IMAGE_TYPE_2D || m_image.getArrayCount() != 1)
+        throw std::runtime_error("Mip chain generation only supports 2D images with a single layer. Image: " + m_image.name);
+    if (m_image.getBaseWidth() > MAX_SIDE_LENGTH || m_image.getBaseHeight() > MAX_SIDE_LENGTH)
+        throw std::runtime_error("Mip chain generation supports images up to " + std::to_string(MAX_SIDE_LENGTH) + " texels per side. Image: " + m_image.name);
+    if (m_image.getMipCount() < 2 || m_image.getMipCount() > MAX_WRITTEN_MIP_COUNT + 1)
+        throw std::runtime_error("Mip chain generation needs between 2 and " + std::to_string(MAX_WRITTEN_MIP_COUNT + 1) + " mips. Image: " + m_image.name);
+    const VkImageUsageFlags requiredUsage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    if ((m_image.getImageUsages() & requiredUsage) != requiredUsage)
+        throw std::runtime_error("Mip chain generation needs sampled and storage usage on the image. Image: " + m_image.name);
+
+    m_groupCountX = (m_image.getBaseWidth() + TILE_SIDE_LENGTH - 1) / TILE_SIDE_LENGTH;
+    m_groupCountY = (m_image.getBaseHeight() + TILE_SIDE_LENGTH - 1) / TILE_SIDE_LENGTH;
+
+    m_image.createImageViewsForMipMaps();
+    // Mip 0 is only ever read with texelFetch, so the sampler settings don't matter beyond being valid
+    m_sampler = VulSampler::createCustomSampler(m_vulDevice, VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, 0.0f,
+            VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK, VK_SAMPLER_MIPMAP_MODE_NEAREST, false, VK_SAMPLER_REDUCTION_MODE_WEIGHTED_AVERAGE,
+            0.0f, 0.0f, 0.0f);
+
+    m_intermediateBuffer = std::make_unique<VulBuffer>(1, INTERMEDIATE_BUFFER_SIZE, true,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_vulDevice);
+    VUL_NAME_VK(m_intermediateBuffer->getBuffer())
+
+    VulDescriptorSet::RawImageDescriptorInfo srcInfo{};
+    srcInfo.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    srcInfo.descriptorInfo = {m_sampler->getSampler(), m_image.getImageViewForMipLevel(0), VK_IMAGE_LAYOUT_GENERAL};
+    // Every element of the array has to be valid, so the ones past the last mip repeat it and the shader never touches them
+    std::vector<VulDescriptorSet::RawImageDescriptorInfo> dstInfos(MAX_WRITTEN_MIP_COUNT);
+    for (uint32_t i = 0; i < MAX_WRITTEN_MIP_COUNT; i++) {
+        const uint32_t mip = std::min(i + 1, m_image.getMipCount() - 1);
+        dstInfos[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        dstInfos[i].descriptorInfo = {VK_NULL_HANDLE, m_image.getImageViewForMipLevel(mip), VK_IMAGE_LAYOUT_GENERAL};
+    }
+    std::vector<VulDescriptorSet::Descriptor> descriptors(3);
+    descriptors[0] = {VulDescriptorSet::DescriptorType::rawImageInfo, VK_SHADER_STAGE_COMPUTE_BIT, &srcInfo};
+    descriptors[1] = {VulDescriptorSet::DescriptorType::rawImageInfo, VK_SHADER_STAGE_COMPUTE_BIT, dstInfos.data(), MAX_WRITTEN_MIP_COUNT};
+    descriptors[2] = {VulDescriptorSet::DescriptorType::storageBuffer, VK_SHADER_STAGE_COMPUTE_BIT, m_intermediateBuffer.get()};
+    m_descriptorSet = VulDescriptorSet::createDescriptorSet(descriptors, descPool);
+
+    m_pipeline = std::make_unique<VulCompPipeline>(shaderFile,
+            std::vector<VkDescriptorSetLayout>{m_descriptorSet->getLayout()->getDescriptorSetLayout()}, m_vulDevice, 1);
+}
+
+void VulMipChainGenerator::generate(VkCommandBuffer cmdBuf, VkImageLayout finalLayout)
+{
+    VUL_PROFILE_FUNC()
+
+    // The last workgroup resets the counter after itself, so it only needs clearing once
+    if (!m_counterCleared) {
+        vkCmdFillBuffer(cmdBuf, m_intermediateBuffer->getBuffer(), 0, sizeof(uint32_t), 0);
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = m_intermediateBuffer->getBuffer();
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                &bufferBarrier, 0, nullptr);
+        m_counterCleared = true;
+    }
+
+    // Mip 0 may have been written by anything, and the previous contents of the other mips don't matter
+    m_image.transitionImageLayoutWithStages(VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, cmdBuf);
+
+    PushConstant push{};
+    push.mipCount = m_image.getMipCount() - 1;
+    push.reduction = static_cast<uint32_t>(m_reduction);
+    push.groupCount = m_groupCountX * m_groupCountY;
+    m_pipeline->pPushData = &push;
+    m_pipeline->pushSize = sizeof(push);
+    m_pipeline->recordDispatch(cmdBuf, {m_descriptorSet->getSet()}, m_groupCountX, m_groupCountY, 1);
+    m_pipeline->pPushData = nullptr;
+    m_pipeline->pushSize = 0;
+
+    m_image.transitionImageLayoutWithStages(finalLayout, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT, cmdBuf);
+}
+
+}
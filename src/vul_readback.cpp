@@ -0,0 +1,181 @@
+#include <vul_readback.hpp>
+#include <vul_debug_tools.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+namespace vul {
+
+VulReadback::VulReadback(VkDeviceSize bytesPerFrame, const VulDevice &vulDevice) : m_vulDevice{vulDevice}
+{
+    // Slots are multiples of the atom size, so invalidating one never touches the memory of anything else
+    const VkDeviceSize sizeAlignment = std::max(RING_ALIGNMENT, m_vulDevice.properties.limits.nonCoherentAtomSize);
+    m_bytesPerFrame = (bytesPerFrame + sizeAlignment - 1) / sizeAlignment * sizeAlignment;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = m_bytesPerFrame * VulSwapChain::MAX_FRAMES_IN_FLIGHT;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkResult result = vkCreateBuffer(m_vulDevice.device(), &bufferInfo, nullptr, &m_ring);
+    if (result != VK_SUCCESS) throw std::runtime_error("Failed to create readback ring. Error: " + std::to_string(result));
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(m_vulDevice.device(), m_ring, &memRequirements);
+    memRequirements.alignment = std::max(memRequirements.alignment, sizeAlignment);
+    VulAllocator &allocator = m_vulDevice.getAllocator();
+    const VkMemoryPropertyFlags cachedProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    const VkMemoryPropertyFlags properties = allocator.hasMemoryType(memRequirements.memoryTypeBits, cachedProperties) ? cachedProperties
+            : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    result = allocator.allocate(memRequirements, properties, VulAllocator::ResourceType::linear, m_ringAllocation);
+    if (result == VK_SUCCESS) result = vkBindBufferMemory(m_vulDevice.device(), m_ring, m_ringAllocation.memory, m_ringAllocation.offset);
+    if (result != VK_SUCCESS) {
+        vkDestroyBuffer(m_vulDevice.device(), m_ring, nullptr);
+        allocator.free(m_ringAllocation);
+        throw std::runtime_error("Failed to allocate readback ring memory. Error: " + std::to_string(result));
+    }
+    m_isRingCoherent = allocator.getMemoryProperties().memoryTypes[m_ringAllocation.memoryTypeIndex].propertyFlags
+            & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VUL_NAME_VK(m_ring)
+}
+
+VulReadback::~VulReadback()
+{
+    vkDestroyBuffer(m_vulDevice.device(), m_ring, nullptr);
+    m_vulDevice.getAllocator().free(m_ringAllocation);
+}
+
+void VulReadback::readBuffer(const VulBuffer &buffer, VkDeviceSize size, VkDeviceSize offset, uint32_t frameIndex,
+        VkCommandBuffer cmdBuf, Callback callback)
+{
+    VUL_PROFILE_FUNC()
+
+    if (size + offset > buffer.getBufferSize()) throw std::runtime_error("Size + offset of the read back data must be at most equal to the size of the buffer");
+    if (!(buffer.getUsageFlags() & VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) throw std::runtime_error("Read back buffer needs transfer src usage flag");
+    const VkDeviceSize ringOffset = reserve(size, frameIndex);
+
+    recordMemoryBarrier(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_READ_BIT, cmdBuf);
+    VkBufferCopy copy{};
+    copy.srcOffset = offset;
+    copy.dstOffset = ringOffset;
+    copy.size = size;
+    vkCmdCopyBuffer(cmdBuf, buffer.getBuffer(), m_ring, 1, &copy);
+    // Later commands may overwrite the source right away, like clearing a counter after reading it
+    recordMemoryBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_ACCESS_HOST_READ_BIT, cmdBuf);
+
+    m_frames[frameIndex].pendingReads.push_back({ringOffset, size, std::move(callback)});
+}
+
+std::future<std::vector<uint8_t>> VulReadback::readBuffer(const VulBuffer &buffer, VkDeviceSize size, VkDeviceSize offset,
+        uint32_t frameIndex, VkCommandBuffer cmdBuf)
+{
+    auto [future, callback] = makeFutureCallback();
+    readBuffer(buffer, size, offset, frameIndex, cmdBuf, std::move(callback));
+    return std::move(future);
+}
+
+void VulReadback::readImage(VulImage &image, const ImageRegion &region, uint32_t frameIndex, VkCommandBuffer cmdBuf,
+        Callback callback)
+{
+    VUL_PROFILE_FUNC()
+
+    if (!(image.getImageUsages() & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) throw std::runtime_error("Read back image needs transfer src usage flag. Image: " + image.name);
+    const VkExtent3D mipSize = image.getMipSize(region.mipLevel);
+    if (region.offset.x < 0 || region.offset.y < 0 || region.offset.z < 0 ||
+            static_cast<uint32_t>(region.offset.x) + region.extent.width > mipSize.width ||
+            static_cast<uint32_t>(region.offset.y) + region.extent.height > mipSize.height ||
+            static_cast<uint32_t>(region.offset.z) + region.extent.depth > mipSize.depth)
+        throw std::runtime_error("Read back region must be inside the mip level of the image. Image: " + image.name);
+    if (image.getLayout() == VK_IMAGE_LAYOUT_UNDEFINED) throw std::runtime_error("Can't read back an image with undefined contents. Image: " + image.name);
+    const VkDeviceSize size = static_cast<VkDeviceSize>(region.extent.width) * region.extent.height * region.extent.depth * image.getBitsPerTexel() / 8;
+    const VkDeviceSize ringOffset = reserve(size, frameIndex);
+
+    const VkImageLayout layout = image.getLayout();
+    image.transitionImageLayoutWithStages(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, cmdBuf);
+    VkBufferImageCopy copy{};
+    copy.bufferOffset = ringOffset;
+    copy.bufferRowLength = 0;
+    copy.bufferImageHeight = 0;
+    copy.imageSubresource.aspectMask = image.getAspect();
+    copy.imageSubresource.mipLevel = region.mipLevel;
+    copy.imageSubresource.baseArrayLayer = region.arrayLayer;
+    copy.imageSubresource.layerCount = 1;
+    copy.imageOffset = region.offset;
+    copy.imageExtent = region.extent;
+    vkCmdCopyImageToBuffer(cmdBuf, image.getImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_ring, 1, &copy);
+    image.transitionImageLayoutWithStages(layout, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, cmdBuf);
+    recordMemoryBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            VK_ACCESS_HOST_READ_BIT, cmdBuf);
+
+    m_frames[frameIndex].pendingReads.push_back({ringOffset, size, std::move(callback)});
+}
+
+std::future<std::vector<uint8_t>> VulReadback::readImage(VulImage &image, const ImageRegion &region, uint32_t frameIndex,
+        VkCommandBuffer cmdBuf)
+{
+    auto [future, callback] = makeFutureCallback();
+    readImage(image, region, frameIndex, cmdBuf, std::move(callback));
+    return std::move(future);
+}
+
+void VulReadback::resolve(uint32_t frameIndex)
+{
+    VUL_PROFILE_FUNC()
+
+    Frame &frame = m_frames[frameIndex];
+    if (!m_isRingCoherent && !frame.pendingReads.empty()) {
+        VkMappedMemoryRange range{};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = m_ringAllocation.memory;
+        range.offset = m_ringAllocation.offset + frameIndex * m_bytesPerFrame;
+        range.size = m_bytesPerFrame;
+        VkResult result = vkInvalidateMappedMemoryRanges(m_vulDevice.device(), 1, &range);
+        if (result != VK_SUCCESS) throw std::runtime_error("Failed to invalidate readback ring. Error: " + std::to_string(result));
+    }
+    const uint8_t *ring = static_cast<const uint8_t *>(m_ringAllocation.mapped);
+    for (PendingRead &read : frame.pendingReads) read.callback(ring + read.ringOffset, read.size);
+    frame.pendingReads.clear();
+    frame.usedBytes = 0;
+}
+
+VkDeviceSize VulReadback::reserve(VkDeviceSize size, uint32_t frameIndex)
+{
+    Frame &frame = m_frames[frameIndex];
+    const VkDeviceSize alignedSize = (size + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+    if (frame.usedBytes + alignedSize > m_bytesPerFrame)
+        throw std::runtime_error("Readback ring slot of the frame is full. Used: " + std::to_string(frame.usedBytes) + ", requested: "
+                + std::to_string(size) + ", bytes per frame: " + std::to_string(m_bytesPerFrame));
+    const VkDeviceSize ringOffset = frameIndex * m_bytesPerFrame + frame.usedBytes;
+    frame.usedBytes += alignedSize;
+    return ringOffset;
+}
+
+std::pair<std::future<std::vector<uint8_t>>, VulReadback::Callback> VulReadback::makeFutureCallback()
+{
+    // std::function needs copyable callables, so the promise is shared
+    std::shared_ptr<std::promise<std::vector<uint8_t>>> promise = std::make_shared<std::promise<std::vector<uint8_t>>>();
+    std::future<std::vector<uint8_t>> future = promise->get_future();
+    Callback callback = [promise](const void *data, VkDeviceSize size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        promise->set_value(std::vector<uint8_t>(bytes, bytes + size));
+    };
+    return {std::move(future), std::move(callback)};
+}
+
+void VulReadback::recordMemoryBarrier(VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage,
+        VkAccessFlags dstAccess, VkCommandBuffer cmdBuf)
+{
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(cmdBuf, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+}
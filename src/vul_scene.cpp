@@ -1,6 +1,8 @@
 #include "vul_buffer.hpp"
 #include "vul_command_pool.hpp"
 #include "vul_transform.hpp"
+#include "vul_upload_batch.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
@@ -9,9 +11,11 @@
 #include<vul_debug_tools.hpp>
 #include<vul_gltf_loader.hpp>
 #include<vul_scene.hpp>
+#include<vul_scene_cache.hpp>
 #include <memory>
 #include <stdexcept>
 #include <iostream>
+#include <thread>
 
 #include<tiny_gltf.h>
 #include <vulkan/vulkan_core.h>
@@ -125,7 +129,7 @@ void Scene::loadCubes(const std::vector<Cube> &cubes, const std::vector<vul::Glt
     std::vector<glm::vec4> uselessTangents(lVertices.size());
     std::vector<glm::vec2> uselessUvs(lVertices.size());
 
-    createBuffers(lIndices, lVertices, lNormals, uselessTangents, uselessUvs, mats, nods, wantedBuffers, cmdPool);
+    createBuffers(lIndices, lVertices, lNormals, uselessTangents, uselessUvs, mats, nods, {}, wantedBuffers, cmdPool);
 }
 
 void Scene::loadSpheres(const std::vector<Sphere> &spheres, const std::vector<vul::GltfLoader::Material> &mats, WantedBuffers wantedBuffers, VulCmdPool &cmdPool)
@@ -226,7 +230,7 @@ void Scene::loadSpheres(const std::vector<Sphere> &spheres, const std::vector<vu
     std::vector<glm::vec4> uselessTangents(lVertices.size());
     std::vector<glm::vec2> uselessUvs(lVertices.size());
 
-    createBuffers(lIndices, lVertices, lVertices, uselessTangents, uselessUvs, mats, nods, wantedBuffers, cmdPool);
+    createBuffers(lIndices, lVertices, lVertices, uselessTangents, uselessUvs, mats, nods, {}, wantedBuffers, cmdPool);
 }
 
 void Scene::loadPlanes(const std::vector<Plane> &planes, const std::vector<GltfLoader::Material> &mats, WantedBuffers wantedBuffers, VulCmdPool &cmdPool)
@@ -280,15 +284,32 @@ void Scene::loadPlanes(const std::vector<Plane> &planes, const std::vector<GltfL
     std::vector<glm::vec4> uselessTangents(lVertices.size());
     std::vector<glm::vec3> uselessNormals(lVertices.size());
 
-    createBuffers(lIndices, lVertices, uselessNormals, uselessTangents, lUvs, mats, nods, wantedBuffers, cmdPool);
+    createBuffers(lIndices, lVertices, uselessNormals, uselessTangents, lUvs, mats, nods, {}, wantedBuffers, cmdPool);
 }
 
-void Scene::loadSceneSync(const std::string &fileName, const std::string &textureDir, WantedBuffers wantedBuffers, VulCmdPool &cmdPool)
+void Scene::loadSceneSync(const std::string &fileName, const std::string &textureDir, WantedBuffers wantedBuffers, VulCmdPool &cmdPool,
+        const std::string &cacheFile)
 {
+    VUL_PROFILE_FUNC()
+
+    if (!cacheFile.empty()) {
+        std::unique_ptr<VulSceneCache> sceneCache = VulSceneCache::open(cacheFile, fileName);
+        if (sceneCache.get() != nullptr) {
+            std::vector<std::shared_ptr<VulImage>> lImages = GltfLoader::loadTextures(sceneCache->imageSources, sceneCache->textureSources,
+                    textureDir, 0, std::max(std::thread::hardware_concurrency() - 1, 1u), m_vulDevice, cmdPool);
+            for (const std::shared_ptr<VulImage> &image : lImages) image->deleteCpuData();
+            moveLoadedStuffToScene(sceneCache->indices, sceneCache->vertices, sceneCache->normals, sceneCache->tangents, sceneCache->uvs,
+                    sceneCache->instanceTransforms, sceneCache->meshes, sceneCache->nodes, sceneCache->materials, sceneCache->lights, lImages,
+                    wantedBuffers, cmdPool);
+            return;
+        }
+    }
+
     GltfLoader gltfLoader(fileName);
     gltfLoader.importMaterials();
     gltfLoader.importDrawableNodes(GltfLoader::gltfAttribOr(GltfLoader::gltfAttribOr(GltfLoader::GltfAttributes::Normal,
                     GltfLoader::GltfAttributes::Tangent), GltfLoader::GltfAttributes::TexCoord));
+    if (!cacheFile.empty()) VulSceneCache::write(cacheFile, gltfLoader);
     gltfLoader.importFullTexturesSync(textureDir, m_vulDevice, cmdPool);
     moveGltfStuffToScene(gltfLoader, wantedBuffers, cmdPool);
 }
@@ -307,37 +328,52 @@ std::unique_ptr<GltfLoader::AsyncImageLoadingInfo> Scene::loadSceneAsync(const s
 }
 
 void Scene::moveGltfStuffToScene(GltfLoader &gltfLoader, WantedBuffers wantedBuffers, VulCmdPool &cmdPool)
+{
+    moveLoadedStuffToScene(gltfLoader.indices, gltfLoader.positions, gltfLoader.normals, gltfLoader.tangents, gltfLoader.uvCoords,
+            gltfLoader.instanceTransforms, gltfLoader.primMeshes, gltfLoader.nodes, gltfLoader.materials, gltfLoader.lights, gltfLoader.images,
+            wantedBuffers, cmdPool);
+}
+
+void Scene::moveLoadedStuffToScene(std::span<const uint32_t> lIndices, std::span<const glm::vec3> lVertices, std::span<const glm::vec3> lNormals,
+                std::span<const glm::vec4> lTangents, std::span<const glm::vec2> lUvs, std::span<const glm::mat4> lInstanceTransforms,
+                std::vector<GltfLoader::GltfPrimMesh> &lMeshes, std::vector<GltfLoader::GltfNode> &lNodes, std::vector<GltfLoader::Material> &lMaterials,
+                const std::vector<GltfLoader::GltfLight> &lLights, const std::vector<std::shared_ptr<VulImage>> &lImages, WantedBuffers wantedBuffers, VulCmdPool &cmdPool)
 {
     const uint32_t oldIdxCount = indexBuffer.get() ? indexBuffer->getBufferSize() / sizeof(uint32_t) : 0;
     const uint32_t oldVertCount = vertexBuffer.get() ? vertexBuffer->getBufferSize() / sizeof(glm::vec3) : 0;
     const uint32_t oldMatCount = materials.size();
     const uint32_t oldMeshCount = meshes.size();
     const uint32_t oldImageCount = images.size();
-    for (GltfLoader::GltfPrimMesh &mesh : gltfLoader.primMeshes) {
+    const uint32_t oldInstanceCount = instanceTransforms.size();
+    for (GltfLoader::GltfPrimMesh &mesh : lMeshes) {
         mesh.firstIndex += oldIdxCount;
         mesh.vertexOffset += oldVertCount;
         mesh.materialIndex += oldMatCount;
     }
-    for (GltfLoader::GltfNode &node : gltfLoader.nodes) node.primMesh += oldMeshCount;
-    for (GltfLoader::Material &mat : gltfLoader.materials) {
+    for (GltfLoader::GltfNode &node : lNodes) {
+        node.primMesh += oldMeshCount;
+        if (node.instanceCount > 0) node.firstInstance += oldInstanceCount;
+    }
+    for (GltfLoader::Material &mat : lMaterials) {
         mat.colorTextureIndex += oldImageCount;
         mat.normalTextureIndex += oldImageCount;
         mat.roughnessMetallinessTextureIndex += oldImageCount;
     }
 
-    lights.insert(lights.end(), gltfLoader.lights.begin(), gltfLoader.lights.end());
-    nodes.insert(nodes.end(), gltfLoader.nodes.begin(), gltfLoader.nodes.end());
-    meshes.insert(meshes.end(), gltfLoader.primMeshes.begin(), gltfLoader.primMeshes.end());
-    materials.insert(materials.end(), gltfLoader.materials.begin(), gltfLoader.materials.end());
-    images.insert(images.end(), gltfLoader.images.begin(), gltfLoader.images.end());
+    lights.insert(lights.end(), lLights.begin(), lLights.end());
+    nodes.insert(nodes.end(), lNodes.begin(), lNodes.end());
+    instanceTransforms.insert(instanceTransforms.end(), lInstanceTransforms.begin(), lInstanceTransforms.end());
+    meshes.insert(meshes.end(), lMeshes.begin(), lMeshes.end());
+    materials.insert(materials.end(), lMaterials.begin(), lMaterials.end());
+    images.insert(images.end(), lImages.begin(), lImages.end());
 
-    createBuffers(gltfLoader.indices, gltfLoader.positions, gltfLoader.normals, gltfLoader.tangents, gltfLoader.uvCoords, gltfLoader.materials, gltfLoader.nodes, wantedBuffers, cmdPool);
+    createBuffers(lIndices, lVertices, lNormals, lTangents, lUvs, lMaterials, lNodes, lInstanceTransforms, wantedBuffers, cmdPool);
 }
 
-void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vector<glm::vec3> &lVertices,
-                const std::vector<glm::vec3> &lNormals, const std::vector<glm::vec4> &lTangents, const std::vector<glm::vec2> &lUvs,
+void Scene::createBuffers(std::span<const uint32_t> lIndices, std::span<const glm::vec3> lVertices,
+                std::span<const glm::vec3> lNormals, std::span<const glm::vec4> lTangents, std::span<const glm::vec2> lUvs,
                 const std::vector<GltfLoader::Material> &mats, const std::vector<GltfLoader::GltfNode> &nods,
-                WantedBuffers wantedBuffers, VulCmdPool &cmdPool)
+                std::span<const glm::mat4> lInstanceTransforms, WantedBuffers wantedBuffers, VulCmdPool &cmdPool)
 {
     std::vector<PackedMaterial> packedMaterials;
     for (const GltfLoader::Material &mat : mats) {
@@ -364,7 +400,7 @@ void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vect
         primInfo.firstIndex = mesh.firstIndex;
         primInfo.vertexOffset = mesh.vertexOffset;
         primInfo.materialIndex = mesh.materialIndex;
-        primInfo.padding = 69;
+        primInfo.firstInstance = node.instanceCount > 0 ? static_cast<int>(node.firstInstance) : -1;
         primInfos.push_back(primInfo);
     }
 
@@ -373,12 +409,13 @@ void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vect
     if (wantedBuffers.enableUsageForAccelerationStructures) optionalFlags |= VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
 
     VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
+    VulUploadBatch uploads(m_vulDevice);
     if (lIndices.size() > 0 && wantedBuffers.index) {
         if (indexBuffer.get() == nullptr) {
             indexBuffer = std::make_unique<vul::VulBuffer>(sizeof(*lIndices.data()), lIndices.size(), true, VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | optionalFlags, m_vulDevice);
-            indexBuffer->writeVector(lIndices, 0, cmdBuf);
-        } else indexBuffer->appendVector(lIndices, cmdPool);
+            uploads.writeBuffer(*indexBuffer, lIndices.data(), lIndices.size_bytes(), 0);
+        } else uploads.appendBuffer(*indexBuffer, lIndices.data(), static_cast<uint32_t>(lIndices.size()), cmdBuf);
         indices.insert(indices.end(), lIndices.begin(), lIndices.end());
         VUL_NAME_VK(indexBuffer->getBuffer())
     }
@@ -386,8 +423,8 @@ void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vect
         if (vertexBuffer.get() == nullptr) {
             vertexBuffer = std::make_unique<vul::VulBuffer>(sizeof(*lVertices.data()), lVertices.size(), true, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | optionalFlags, m_vulDevice);
-            vertexBuffer->writeVector(lVertices, 0, cmdBuf);
-        } else vertexBuffer->appendVector(lVertices, cmdPool);
+            uploads.writeBuffer(*vertexBuffer, lVertices.data(), lVertices.size_bytes(), 0);
+        } else uploads.appendBuffer(*vertexBuffer, lVertices.data(), static_cast<uint32_t>(lVertices.size()), cmdBuf);
         vertices.insert(vertices.end(), lVertices.begin(), lVertices.end());
         VUL_NAME_VK(vertexBuffer->getBuffer())
     }
@@ -395,8 +432,8 @@ void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vect
         if (normalBuffer.get() == nullptr) {
             normalBuffer = std::make_unique<vul::VulBuffer>(sizeof(*lNormals.data()), lNormals.size(), true, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_vulDevice);
-            normalBuffer->writeVector(lNormals, 0, cmdBuf);
-        } else normalBuffer->appendVector(lNormals, cmdPool);
+            uploads.writeBuffer(*normalBuffer, lNormals.data(), lNormals.size_bytes(), 0);
+        } else uploads.appendBuffer(*normalBuffer, lNormals.data(), static_cast<uint32_t>(lNormals.size()), cmdBuf);
         normals.insert(normals.end(), lNormals.begin(), lNormals.end());
         VUL_NAME_VK(normalBuffer->getBuffer())
     }
@@ -404,8 +441,8 @@ void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vect
         if (tangentBuffer.get() == nullptr) {
             tangentBuffer = std::make_unique<vul::VulBuffer>(sizeof(*lTangents.data()), lTangents.size(), true, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_vulDevice);
-            tangentBuffer->writeVector(lTangents, 0, cmdBuf);
-        } else tangentBuffer->appendVector(lTangents, cmdPool);
+            uploads.writeBuffer(*tangentBuffer, lTangents.data(), lTangents.size_bytes(), 0);
+        } else uploads.appendBuffer(*tangentBuffer, lTangents.data(), static_cast<uint32_t>(lTangents.size()), cmdBuf);
         tangents.insert(tangents.end(), lTangents.begin(), lTangents.end());
         VUL_NAME_VK(tangentBuffer->getBuffer())
     }
@@ -413,8 +450,8 @@ void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vect
         if (uvBuffer.get() == nullptr) {
             uvBuffer = std::make_unique<vul::VulBuffer>(sizeof(*lUvs.data()), lUvs.size(), true, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_vulDevice);
-            uvBuffer->writeVector(lUvs, 0, cmdBuf);
-        } else uvBuffer->appendVector(lUvs, cmdPool);
+            uploads.writeBuffer(*uvBuffer, lUvs.data(), lUvs.size_bytes(), 0);
+        } else uploads.appendBuffer(*uvBuffer, lUvs.data(), static_cast<uint32_t>(lUvs.size()), cmdBuf);
         uvs.insert(uvs.end(), lUvs.begin(), lUvs.end());
         VUL_NAME_VK(uvBuffer->getBuffer())
     }
@@ -422,18 +459,27 @@ void Scene::createBuffers(const std::vector<uint32_t> &lIndices, const std::vect
         if (materialBuffer.get() == nullptr) {
             materialBuffer = std::make_unique<vul::VulBuffer>(sizeof(*packedMaterials.data()), packedMaterials.size(), true,
                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_vulDevice);
-            materialBuffer->writeVector(packedMaterials, 0, cmdBuf);
-        } else materialBuffer->appendVector(packedMaterials, cmdPool);
+            uploads.writeVector(*materialBuffer, packedMaterials, 0);
+        } else uploads.appendBuffer(*materialBuffer, packedMaterials.data(), static_cast<uint32_t>(packedMaterials.size()), cmdBuf);
         VUL_NAME_VK(materialBuffer->getBuffer())
     }
     if (primInfos.size() > 0 && wantedBuffers.primInfo) {
         if (primInfoBuffer.get() == nullptr) {
             primInfoBuffer = std::make_unique<vul::VulBuffer>(sizeof(*primInfos.data()), primInfos.size(), true,
                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_vulDevice);
-            primInfoBuffer->writeVector(primInfos, 0, cmdBuf);
-        } else primInfoBuffer->appendVector(primInfos, cmdPool);
+            uploads.writeVector(*primInfoBuffer, primInfos, 0);
+        } else uploads.appendBuffer(*primInfoBuffer, primInfos.data(), static_cast<uint32_t>(primInfos.size()), cmdBuf);
         VUL_NAME_VK(primInfoBuffer->getBuffer())
     }
+    if (lInstanceTransforms.size() > 0) {
+        if (instanceTransformBuffer.get() == nullptr) {
+            instanceTransformBuffer = std::make_unique<vul::VulBuffer>(sizeof(*lInstanceTransforms.data()), lInstanceTransforms.size(), true,
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | optionalFlags, m_vulDevice);
+            uploads.writeBuffer(*instanceTransformBuffer, lInstanceTransforms.data(), lInstanceTransforms.size_bytes(), 0);
+        } else uploads.appendBuffer(*instanceTransformBuffer, lInstanceTransforms.data(), static_cast<uint32_t>(lInstanceTransforms.size()), cmdBuf);
+        VUL_NAME_VK(instanceTransformBuffer->getBuffer())
+    }
+    uploads.record(cmdBuf, cmdPool);
     cmdPool.submit(cmdBuf, true);
 }
 
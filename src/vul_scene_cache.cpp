@@ -0,0 +1,356 @@
+#include <vul_scene_cache.hpp>
+#include <vul_hash.hpp>
+#include <vul_debug_tools.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace vul {
+
+enum BakedSection : uint32_t {
+    indicesSection,
+    verticesSection,
+    normalsSection,
+    tangentsSection,
+    uvsSection,
+    instanceTransformsSection,
+    meshesSection,
+    nodesSection,
+    materialsSection,
+    lightsSection,
+    imageSourcesSection,
+    textureSourcesSection,
+    dependenciesSection,
+    stringsSection,
+    bakedSectionCount
+};
+
+// Every struct below is written to the file as is, so they must stay trivially copyable and any change to them needs
+// VulSceneCache::VERSION bumped
+struct BakedSectionRange {
+    uint64_t offset;
+    uint64_t size;
+};
+struct BakedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    uint64_t sourceHash;
+    BakedSectionRange sections[bakedSectionCount];
+};
+struct BakedString {
+    uint32_t offset;
+    uint32_t length;
+};
+struct BakedMesh {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t vertexOffset;
+    uint32_t vertexCount;
+    int materialIndex;
+    glm::vec3 posMin;
+    glm::vec3 posMax;
+    BakedString name;
+};
+struct BakedNode {
+    glm::mat4 worldMatrix;
+    glm::mat3 normalMatrix;
+    glm::vec3 position;
+    int primMesh;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+    BakedString name;
+};
+struct BakedMaterial {
+    glm::vec4 colorFactor;
+    glm::vec3 emissiveFactor;
+    float roughness;
+    float metalliness;
+    int colorTextureIndex;
+    int roughnessMetallinessTextureIndex;
+    int normalTextureIndex;
+    uint32_t alphaMode;
+    float emissionStrength;
+    float ior;
+    BakedString name;
+};
+struct BakedLight {
+    uint32_t type;
+    glm::vec3 position;
+    glm::vec3 direction;
+    glm::vec3 color;
+    float intensity;
+    float range;
+    BakedString name;
+};
+struct BakedImageSource {
+    BakedString uri;
+    uint32_t format;
+};
+
+static constexpr char BAKED_MAGIC[8] = {'V', 'U', 'L', 'S', 'C', 'E', 'N', 'E'};
+static constexpr uint64_t BAKED_SECTION_ALIGNMENT = 4096;
+static_assert(sizeof(BakedHeader) <= BAKED_SECTION_ALIGNMENT);
+
+static uint64_t hashFileStamp(const std::string &fileName)
+{
+    const uint64_t size = std::filesystem::file_size(fileName);
+    const uint64_t writeTime = static_cast<uint64_t>(std::filesystem::last_write_time(fileName).time_since_epoch().count());
+    return hashCombine(size, writeTime);
+}
+
+// Only the json is hashed. The buffers, which are nearly all of the data, are keyed by their size and last write time, so a
+// warm start doesn't have to read them. For a glb the json chunk is hashed and the bin chunk is covered by the file's stamp
+static uint64_t hashSourceFiles(const std::vector<std::string> &sourceFiles)
+{
+    VUL_PROFILE_FUNC()
+
+    if (sourceFiles.empty()) return 0;
+    uint64_t hash = 0;
+    {
+        VulMappedFile file(sourceFiles[0]);
+        const uint8_t *json = file.getData();
+        size_t jsonSize = file.getSize();
+        uint32_t glbHeader[5];
+        if (file.getSize() >= sizeof(glbHeader) && memcmp(file.getData(), "glTF", 4) == 0) {
+            memcpy(glbHeader, file.getData(), sizeof(glbHeader));
+            json = file.getData() + sizeof(glbHeader);
+            jsonSize = std::min(static_cast<size_t>(glbHeader[3]), file.getSize() - sizeof(glbHeader));
+            hash = hashFileStamp(sourceFiles[0]);
+        }
+        hash = hashCombine(hash, hashBytes(json, jsonSize));
+        hash = hashCombine(hash, jsonSize);
+    }
+    for (size_t i = 1; i < sourceFiles.size(); i++) hash = hashCombine(hash, hashFileStamp(sourceFiles[i]));
+    return hash;
+}
+
+class BakedStringTable {
+    public:
+        BakedString add(const std::string &string)
+        {
+            const BakedString bakedString{static_cast<uint32_t>(m_data.size()), static_cast<uint32_t>(string.size())};
+            m_data.insert(m_data.end(), string.begin(), string.end());
+            return bakedString;
+        }
+        const std::vector<char> &getData() const {return m_data;}
+
+    private:
+        std::vector<char> m_data;
+};
+
+static bool readBakedString(std::span<const char> strings, BakedString bakedString, std::string &outString)
+{
+    if (static_cast<size_t>(bakedString.offset) + bakedString.length > strings.size()) return false;
+    outString.assign(strings.data() + bakedString.offset, bakedString.length);
+    return true;
+}
+
+template<typename T>
+static bool getBakedSection(const VulMappedFile &file, const BakedHeader &header, BakedSection section, std::span<const T> &outSection)
+{
+    const BakedSectionRange &range = header.sections[section];
+    if (range.offset % BAKED_SECTION_ALIGNMENT != 0 || range.offset > file.getSize() || range.size > file.getSize() - range.offset
+            || range.size % sizeof(T) != 0) return false;
+    outSection = std::span<const T>(reinterpret_cast<const T *>(file.getData() + range.offset), range.size / sizeof(T));
+    return true;
+}
+
+VulSceneCache::VulSceneCache(std::unique_ptr<VulMappedFile> mappedFile) : m_mappedFile{std::move(mappedFile)}
+{
+}
+
+bool VulSceneCache::readSections()
+{
+    BakedHeader header;
+    memcpy(&header, m_mappedFile->getData(), sizeof(header));
+
+    if (!getBakedSection(*m_mappedFile, header, indicesSection, indices) || !getBakedSection(*m_mappedFile, header, verticesSection, vertices)
+            || !getBakedSection(*m_mappedFile, header, normalsSection, normals) || !getBakedSection(*m_mappedFile, header, tangentsSection, tangents)
+            || !getBakedSection(*m_mappedFile, header, uvsSection, uvs)
+            || !getBakedSection(*m_mappedFile, header, instanceTransformsSection, instanceTransforms)) return false;
+
+    std::span<const char> strings;
+    std::span<const BakedMesh> bakedMeshes;
+    std::span<const BakedNode> bakedNodes;
+    std::span<const BakedMaterial> bakedMaterials;
+    std::span<const BakedLight> bakedLights;
+    std::span<const BakedImageSource> bakedImageSources;
+    std::span<const int> bakedTextureSources;
+    if (!getBakedSection(*m_mappedFile, header, stringsSection, strings) || !getBakedSection(*m_mappedFile, header, meshesSection, bakedMeshes)
+            || !getBakedSection(*m_mappedFile, header, nodesSection, bakedNodes)
+            || !getBakedSection(*m_mappedFile, header, materialsSection, bakedMaterials)
+            || !getBakedSection(*m_mappedFile, header, lightsSection, bakedLights)
+            || !getBakedSection(*m_mappedFile, header, imageSourcesSection, bakedImageSources)
+            || !getBakedSection(*m_mappedFile, header, textureSourcesSection, bakedTextureSources)) return false;
+
+    for (const BakedMesh &bakedMesh : bakedMeshes) {
+        // Meshes index straight into the geometry sections, so ranges outside of them would be read out of bounds later
+        if (static_cast<size_t>(bakedMesh.firstIndex) + bakedMesh.indexCount > indices.size()
+                || static_cast<size_t>(bakedMesh.vertexOffset) + bakedMesh.vertexCount > vertices.size()) return false;
+        GltfLoader::GltfPrimMesh &mesh = meshes.emplace_back();
+        mesh.firstIndex = bakedMesh.firstIndex;
+        mesh.indexCount = bakedMesh.indexCount;
+        mesh.vertexOffset = bakedMesh.vertexOffset;
+        mesh.vertexCount = bakedMesh.vertexCount;
+        mesh.materialIndex = bakedMesh.materialIndex;
+        mesh.posMin = bakedMesh.posMin;
+        mesh.posMax = bakedMesh.posMax;
+        if (!readBakedString(strings, bakedMesh.name, mesh.name)) return false;
+    }
+    for (const BakedNode &bakedNode : bakedNodes) {
+        if (static_cast<size_t>(bakedNode.firstInstance) + bakedNode.instanceCount > instanceTransforms.size()) return false;
+        GltfLoader::GltfNode &node = nodes.emplace_back();
+        node.worldMatrix = bakedNode.worldMatrix;
+        node.normalMatrix = bakedNode.normalMatrix;
+        node.position = bakedNode.position;
+        node.primMesh = bakedNode.primMesh;
+        node.firstInstance = bakedNode.firstInstance;
+        node.instanceCount = bakedNode.instanceCount;
+        if (!readBakedString(strings, bakedNode.name, node.name)) return false;
+    }
+    for (const BakedMaterial &bakedMaterial : bakedMaterials) {
+        GltfLoader::Material &material = materials.emplace_back();
+        material.colorFactor = bakedMaterial.colorFactor;
+        material.emissiveFactor = bakedMaterial.emissiveFactor;
+        material.roughness = bakedMaterial.roughness;
+        material.metalliness = bakedMaterial.metalliness;
+        material.colorTextureIndex = bakedMaterial.colorTextureIndex;
+        material.roughnessMetallinessTextureIndex = bakedMaterial.roughnessMetallinessTextureIndex;
+        material.normalTextureIndex = bakedMaterial.normalTextureIndex;
+        material.alphaMode = static_cast<GltfLoader::GltfAlphaMode>(bakedMaterial.alphaMode);
+        material.emissionStrength = bakedMaterial.emissionStrength;
+        material.ior = bakedMaterial.ior;
+        if (!readBakedString(strings, bakedMaterial.name, material.name)) return false;
+    }
+    for (const BakedLight &bakedLight : bakedLights) {
+        GltfLoader::GltfLight &light = lights.emplace_back();
+        light.type = static_cast<GltfLoader::GltfLightType>(bakedLight.type);
+        light.position = bakedLight.position;
+        light.direction = bakedLight.direction;
+        light.color = bakedLight.color;
+        light.intensity = bakedLight.intensity;
+        light.range = bakedLight.range;
+        if (!readBakedString(strings, bakedLight.name, light.name)) return false;
+    }
+    for (const BakedImageSource &bakedImageSource : bakedImageSources) {
+        GltfLoader::ImageSource &imageSource = imageSources.emplace_back();
+        if (!readBakedString(strings, bakedImageSource.uri, imageSource.uri)) return false;
+        imageSource.format = static_cast<VulImage::KtxCompressionFormat>(bakedImageSource.format);
+    }
+    textureSources.assign(bakedTextureSources.begin(), bakedTextureSources.end());
+    return true;
+}
+
+std::unique_ptr<VulSceneCache> VulSceneCache::open(const std::string &cacheFile, const std::string &sourceFile)
+{
+    VUL_PROFILE_FUNC()
+
+    if (!std::filesystem::exists(cacheFile)) return nullptr;
+    std::unique_ptr<VulMappedFile> mappedFile = std::make_unique<VulMappedFile>(cacheFile);
+
+    BakedHeader header;
+    if (mappedFile->getSize() < sizeof(header)) return nullptr;
+    memcpy(&header, mappedFile->getData(), sizeof(header));
+    if (memcmp(header.magic, BAKED_MAGIC, sizeof(BAKED_MAGIC)) != 0 || header.version != VERSION || header.sectionCount != bakedSectionCount) return nullptr;
+
+    std::span<const char> strings;
+    std::span<const BakedString> bakedDependencies;
+    if (!getBakedSection(*mappedFile, header, stringsSection, strings) || !getBakedSection(*mappedFile, header, dependenciesSection, bakedDependencies))
+        return nullptr;
+    std::vector<std::string> dependencies(bakedDependencies.size());
+    for (size_t i = 0; i < bakedDependencies.size(); i++) if (!readBakedString(strings, bakedDependencies[i], dependencies[i])) return nullptr;
+    if (dependencies.empty() || dependencies[0] != sourceFile) return nullptr;
+    for (const std::string &dependency : dependencies) if (!std::filesystem::exists(dependency)) return nullptr;
+    if (hashSourceFiles(dependencies) != header.sourceHash) return nullptr;
+
+    std::unique_ptr<VulSceneCache> sceneCache(new VulSceneCache(std::move(mappedFile)));
+    if (!sceneCache->readSections()) return nullptr;
+    return sceneCache;
+}
+
+void VulSceneCache::write(const std::string &cacheFile, const GltfLoader &gltfLoader)
+{
+    VUL_PROFILE_FUNC()
+
+    BakedStringTable strings;
+    std::vector<BakedMesh> bakedMeshes;
+    for (const GltfLoader::GltfPrimMesh &mesh : gltfLoader.primMeshes)
+        bakedMeshes.push_back({mesh.firstIndex, mesh.indexCount, mesh.vertexOffset, mesh.vertexCount, mesh.materialIndex, mesh.posMin, mesh.posMax,
+                strings.add(mesh.name)});
+    std::vector<BakedNode> bakedNodes;
+    for (const GltfLoader::GltfNode &node : gltfLoader.nodes)
+        bakedNodes.push_back({node.worldMatrix, node.normalMatrix, node.position, node.primMesh, node.firstInstance, node.instanceCount,
+                strings.add(node.name)});
+    std::vector<BakedMaterial> bakedMaterials;
+    for (const GltfLoader::Material &mat : gltfLoader.materials)
+        bakedMaterials.push_back({mat.colorFactor, mat.emissiveFactor, mat.roughness, mat.metalliness, mat.colorTextureIndex,
+                mat.roughnessMetallinessTextureIndex, mat.normalTextureIndex, static_cast<uint32_t>(mat.alphaMode), mat.emissionStrength, mat.ior,
+                strings.add(mat.name)});
+    std::vector<BakedLight> bakedLights;
+    for (const GltfLoader::GltfLight &light : gltfLoader.lights)
+        bakedLights.push_back({static_cast<uint32_t>(light.type), light.position, light.direction, light.color, light.intensity, light.range,
+                strings.add(light.name)});
+    std::vector<BakedImageSource> bakedImageSources;
+    for (const GltfLoader::ImageSource &imageSource : gltfLoader.getImageSources())
+        bakedImageSources.push_back({strings.add(imageSource.uri), static_cast<uint32_t>(imageSource.format)});
+    const std::vector<int> textureSources = gltfLoader.getTextureSources();
+    const std::vector<std::string> dependencies = gltfLoader.getSourceFiles();
+    std::vector<BakedString> bakedDependencies;
+    for (const std::string &dependency : dependencies) bakedDependencies.push_back(strings.add(dependency));
+
+    struct SectionData {
+        const void *data;
+        size_t size;
+    };
+    SectionData sectionDatas[bakedSectionCount]{};
+    sectionDatas[indicesSection] = {gltfLoader.indices.data(), gltfLoader.indices.size() * sizeof(uint32_t)};
+    sectionDatas[verticesSection] = {gltfLoader.positions.data(), gltfLoader.positions.size() * sizeof(glm::vec3)};
+    sectionDatas[normalsSection] = {gltfLoader.normals.data(), gltfLoader.normals.size() * sizeof(glm::vec3)};
+    sectionDatas[tangentsSection] = {gltfLoader.tangents.data(), gltfLoader.tangents.size() * sizeof(glm::vec4)};
+    sectionDatas[uvsSection] = {gltfLoader.uvCoords.data(), gltfLoader.uvCoords.size() * sizeof(glm::vec2)};
+    sectionDatas[instanceTransformsSection] = {gltfLoader.instanceTransforms.data(), gltfLoader.instanceTransforms.size() * sizeof(glm::mat4)};
+    sectionDatas[meshesSection] = {bakedMeshes.data(), bakedMeshes.size() * sizeof(BakedMesh)};
+    sectionDatas[nodesSection] = {bakedNodes.data(), bakedNodes.size() * sizeof(BakedNode)};
+    sectionDatas[materialsSection] = {bakedMaterials.data(), bakedMaterials.size() * sizeof(BakedMaterial)};
+    sectionDatas[lightsSection] = {bakedLights.data(), bakedLights.size() * sizeof(BakedLight)};
+    sectionDatas[imageSourcesSection] = {bakedImageSources.data(), bakedImageSources.size() * sizeof(BakedImageSource)};
+    sectionDatas[textureSourcesSection] = {textureSources.data(), textureSources.size() * sizeof(int)};
+    sectionDatas[dependenciesSection] = {bakedDependencies.data(), bakedDependencies.size() * sizeof(BakedString)};
+    sectionDatas[stringsSection] = {strings.getData().data(), strings.getData().size()};
+
+    BakedHeader header{};
+    memcpy(header.magic, BAKED_MAGIC, sizeof(BAKED_MAGIC));
+    header.version = VERSION;
+    header.sectionCount = bakedSectionCount;
+    header.sourceHash = hashSourceFiles(dependencies);
+    uint64_t offset = BAKED_SECTION_ALIGNMENT;
+    for (uint32_t i = 0; i < bakedSectionCount; i++) {
+        header.sections[i] = {offset, sectionDatas[i].size};
+        offset += (sectionDatas[i].size + BAKED_SECTION_ALIGNMENT - 1) / BAKED_SECTION_ALIGNMENT * BAKED_SECTION_ALIGNMENT;
+    }
+
+    // Written next to the real file and renamed over it at the end, so a crash mid write never leaves a half written cache
+    // that would get picked up on the next launch
+    const std::string tmpFile = cacheFile + ".tmp";
+    {
+        std::ofstream file(tmpFile, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) throw std::runtime_error("Failed to open scene cache file for writing: " + tmpFile);
+
+        const std::vector<char> padding(BAKED_SECTION_ALIGNMENT, 0);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(padding.data(), BAKED_SECTION_ALIGNMENT - sizeof(header));
+        for (uint32_t i = 0; i < bakedSectionCount; i++) {
+            file.write(static_cast<const char *>(sectionDatas[i].data), sectionDatas[i].size);
+            const size_t paddingSize = (BAKED_SECTION_ALIGNMENT - sectionDatas[i].size % BAKED_SECTION_ALIGNMENT) % BAKED_SECTION_ALIGNMENT;
+            file.write(padding.data(), paddingSize);
+        }
+        if (!file.good()) throw std::runtime_error("Failed to write scene cache file: " + tmpFile);
+    }
+    std::filesystem::rename(tmpFile, cacheFile);
+}
+
+}
@@ -0,0 +1,227 @@
+#include <vul_staging_ring.hpp>
+#include <vul_debug_tools.hpp>
+
+#include <stdexcept>
+#include <string>
+
+namespace vul {
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+VulStagingRing::VulStagingRing(VkDevice device, VulAllocator &allocator, VkDeviceSize size)
+    : m_device{device}, m_allocator{allocator}, m_size{size}
+{
+    VkResult result = createBuffer(m_size, m_buffer, m_allocation);
+    if (result != VK_SUCCESS) throw std::runtime_error("Failed to create staging ring. Error: " + std::to_string(result));
+    VUL_NAME_VK(m_buffer)
+}
+
+VulStagingRing::~VulStagingRing()
+{
+    for (Entry &entry : m_entries) releaseEntry(entry);
+    vkDestroyBuffer(m_device, m_buffer, nullptr);
+    m_allocator.free(m_allocation);
+}
+
+VulStagingRing::Allocation VulStagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment, VkCommandBuffer cmdBuf)
+{
+    VUL_PROFILE_FUNC()
+
+    return allocateEntry(size, alignment, cmdBuf, false);
+}
+
+VulStagingRing::Allocation VulStagingRing::allocateForReadback(VkDeviceSize size, VkDeviceSize alignment, VkCommandBuffer cmdBuf)
+{
+    VUL_PROFILE_FUNC()
+
+    return allocateEntry(size, alignment, cmdBuf, true);
+}
+
+void VulStagingRing::release(const Allocation &allocation)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (Entry &entry : m_entries) {
+        if (!entry.awaitsRelease) continue;
+        const bool isOwned = entry.ownedBuffer != VK_NULL_HANDLE;
+        if ((isOwned && entry.ownedBuffer == allocation.buffer) || (!isOwned && allocation.buffer == m_buffer && entry.start == allocation.offset)) {
+            entry.awaitsRelease = false;
+            break;
+        }
+    }
+    popCompleted();
+}
+
+VulStagingRing::Allocation VulStagingRing::allocateEntry(VkDeviceSize size, VkDeviceSize alignment, VkCommandBuffer cmdBuf, bool awaitsRelease)
+{
+    if (cmdBuf == VK_NULL_HANDLE) throw std::runtime_error("Staging needs the command buffer that copies from the staged data");
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    pollFences();
+    popCompleted();
+
+    Entry entry{};
+    entry.cmdBuf = cmdBuf;
+    entry.awaitsRelease = awaitsRelease;
+    VkDeviceSize offset = 0;
+    bool reserved = size <= m_size && tryReserve(size, alignment, offset, entry.consumedBytes);
+    while (!reserved && size <= m_size && waitForOldest()) reserved = tryReserve(size, alignment, offset, entry.consumedBytes);
+
+    Allocation allocation{};
+    if (reserved) {
+        entry.start = offset;
+        entry.end = offset + size;
+        allocation.buffer = m_buffer;
+        allocation.offset = offset;
+        allocation.mapped = static_cast<char *>(m_allocation.mapped) + offset;
+    } else {
+        VkResult result = createBuffer(size, entry.ownedBuffer, entry.ownedAllocation);
+        if (result != VK_SUCCESS) throw std::runtime_error("Failed to create overflow staging buffer of size " + std::to_string(size)
+                + ". Error: " + std::to_string(result));
+        allocation.buffer = entry.ownedBuffer;
+        allocation.offset = 0;
+        allocation.mapped = entry.ownedAllocation.mapped;
+    }
+    m_entries.push_back(entry);
+    return allocation;
+}
+
+void VulStagingRing::destroyAfterUse(VkBuffer buffer, VulAllocator::Allocation &allocation, VkCommandBuffer cmdBuf)
+{
+    if (buffer == VK_NULL_HANDLE && allocation.memory == VK_NULL_HANDLE) return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Entry entry{};
+    entry.cmdBuf = cmdBuf;
+    entry.ownedBuffer = buffer;
+    entry.ownedAllocation = allocation;
+    allocation = VulAllocator::Allocation{};
+    m_entries.push_back(entry);
+}
+
+void VulStagingRing::onSubmit(VkCommandBuffer cmdBuf, VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (Entry &entry : m_entries) {
+        // A fence can only be reset and submitted again after its previous submit has finished
+        if (entry.fence == fence) entry.complete = true;
+        else if (entry.fence == VK_NULL_HANDLE && entry.cmdBuf == cmdBuf) entry.fence = fence;
+    }
+    popCompleted();
+}
+
+void VulStagingRing::retire()
+{
+    VUL_PROFILE_FUNC()
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    pollFences();
+    popCompleted();
+}
+
+VkDeviceSize VulStagingRing::getUsedBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_usedBytes;
+}
+
+bool VulStagingRing::tryReserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &outOffset, VkDeviceSize &outConsumedBytes)
+{
+    if (m_usedBytes == 0) {
+        m_head = 0;
+        m_tail = 0;
+    }
+
+    const VkDeviceSize offset = alignUp(m_head, alignment);
+    if (m_head > m_tail || m_usedBytes == 0) {
+        // Free space is from the head to the end and from the start to the tail
+        if (offset + size <= m_size) {
+            outOffset = offset;
+            outConsumedBytes = offset + size - m_head;
+        } else if (size <= m_tail) {
+            outOffset = 0;
+            outConsumedBytes = m_size - m_head + size;
+        } else return false;
+    } else {
+        // Free space is from the head to the tail, and none is left when they meet
+        if (offset + size > m_tail) return false;
+        outOffset = offset;
+        outConsumedBytes = offset + size - m_head;
+    }
+    m_head = outOffset + size;
+    m_usedBytes += outConsumedBytes;
+    return true;
+}
+
+void VulStagingRing::pollFences()
+{
+    for (Entry &entry : m_entries) {
+        if (!entry.complete && entry.fence != VK_NULL_HANDLE && vkGetFenceStatus(m_device, entry.fence) == VK_SUCCESS)
+            entry.complete = true;
+    }
+}
+
+void VulStagingRing::popCompleted()
+{
+    while (!m_entries.empty() && m_entries.front().complete && !m_entries.front().awaitsRelease) {
+        releaseEntry(m_entries.front());
+        m_entries.pop_front();
+    }
+}
+
+bool VulStagingRing::waitForOldest()
+{
+    if (m_entries.empty() || m_entries.front().fence == VK_NULL_HANDLE) return false;
+    // Waiting doesn't help when the host still has to read the oldest entry
+    if (m_entries.front().complete && m_entries.front().awaitsRelease) return false;
+
+    VUL_PROFILE_SCOPE("Waiting for staging ring space")
+    const VkFence fence = m_entries.front().fence;
+    VkResult result = vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX);
+    if (result != VK_SUCCESS) throw std::runtime_error("Waiting for staging ring space failed. Error: " + std::to_string(result));
+    for (Entry &entry : m_entries) {
+        if (entry.fence == fence) entry.complete = true;
+    }
+    popCompleted();
+    return true;
+}
+
+VkResult VulStagingRing::createBuffer(VkDeviceSize size, VkBuffer &outBuffer, VulAllocator::Allocation &outAllocation) const
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkResult result = vkCreateBuffer(m_device, &bufferInfo, nullptr, &outBuffer);
+    if (result != VK_SUCCESS) return result;
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(m_device, outBuffer, &memRequirements);
+    result = m_allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VulAllocator::ResourceType::linear, outAllocation);
+    if (result != VK_SUCCESS) {
+        vkDestroyBuffer(m_device, outBuffer, nullptr);
+        outBuffer = VK_NULL_HANDLE;
+        return result;
+    }
+    return vkBindBufferMemory(m_device, outBuffer, outAllocation.memory, outAllocation.offset);
+}
+
+void VulStagingRing::releaseEntry(Entry &entry)
+{
+    if (entry.ownedBuffer != VK_NULL_HANDLE || entry.ownedAllocation.memory != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_device, entry.ownedBuffer, nullptr);
+        m_allocator.free(entry.ownedAllocation);
+        entry.ownedBuffer = VK_NULL_HANDLE;
+        return;
+    }
+    m_tail = entry.end;
+    m_usedBytes -= entry.consumedBytes;
+}
+
+}
@@ -3,6 +3,7 @@
 #include <vul_debug_tools.hpp>
 #include <memory>
 #include<vul_swap_chain.hpp>
+#include <vul_staging_ring.hpp>
 
 // std
 #include <array>
@@ -106,6 +107,7 @@ VkResult VulSwapChain::submitCommandBuffers(
             throw std::runtime_error("failed to submit draw command buffer!");
         }
     }
+    device.getStagingRing().onSubmit(*buffers, inFlightFences[currentFrame]);
 
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -0,0 +1,49 @@
+#include <vul_texture_registry.hpp>
+#include <vul_hash.hpp>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace vul {
+
+struct TextureRegistryKeyHash {
+    size_t operator()(const VulTextureRegistry::Key &key) const
+    {
+        uint64_t hash = hashCombine(key.contentHash, static_cast<uint64_t>(key.format));
+        return hashCombine(hash, reinterpret_cast<uintptr_t>(key.device));
+    }
+};
+
+static std::mutex textureRegistryMutex;
+static std::unordered_map<VulTextureRegistry::Key, std::weak_ptr<VulImage>, TextureRegistryKeyHash> textureRegistry;
+
+std::shared_ptr<VulImage> VulTextureRegistry::find(const Key &key)
+{
+    std::scoped_lock lock(textureRegistryMutex);
+    const auto it = textureRegistry.find(key);
+    if (it == textureRegistry.end()) return nullptr;
+    std::shared_ptr<VulImage> image = it->second.lock();
+    if (image == nullptr) textureRegistry.erase(it);
+    return image;
+}
+
+void VulTextureRegistry::add(const Key &key, const std::shared_ptr<VulImage> &image)
+{
+    std::scoped_lock lock(textureRegistryMutex);
+    for (auto it = textureRegistry.begin(); it != textureRegistry.end();) {
+        if (it->second.expired()) it = textureRegistry.erase(it);
+        else it++;
+    }
+    textureRegistry[key] = image;
+}
+
+bool VulTextureRegistry::contains(const VulImage *image)
+{
+    std::scoped_lock lock(textureRegistryMutex);
+    for (const auto &[key, registeredImage] : textureRegistry) {
+        if (registeredImage.lock().get() == image) return true;
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,205 @@
+#include <vul_texture_residency.hpp>
+#include <vul_swap_chain.hpp>
+#include <vul_debug_tools.hpp>
+#include <vul_texture_registry.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace vul {
+
+static VulImage::KtxCompressionFormat getKtxCompressionFormat(VkFormat format)
+{
+    if (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK) return VulImage::KtxCompressionFormat::bc1rgbNonLinear;
+    if (format == VK_FORMAT_BC7_SRGB_BLOCK) return VulImage::KtxCompressionFormat::bc7rgbaNonLinear;
+    return VulImage::KtxCompressionFormat::bc7rgbaLinear;
+}
+
+VulTextureResidency::VulTextureResidency(uint64_t vramBudget, uint32_t detailMipCount, uint32_t threadCount, const VulDevice &vulDevice)
+    : m_vramBudget{vramBudget}, m_detailMipCount{detailMipCount}, m_vulDevice{vulDevice}
+{
+    m_jobQueue = std::make_unique<VulCompletionQueue<Job>>(MAX_PENDING_JOBS);
+    m_finishedJobs = std::make_unique<VulCompletionQueue<Job>>(MAX_PENDING_JOBS);
+
+    m_workers.resize(std::max(threadCount, 1u));
+    for (std::jthread &worker : m_workers) worker = std::jthread([this](std::stop_token stoken) {
+        Job job;
+        while (m_jobQueue->pop(job, stoken)) {
+            try {
+                job.loadedImage = std::make_unique<VulImage>(m_vulDevice);
+                job.loadedImage->name = job.fileName;
+                job.loadedImage->loadCompressedKtxFromFile(job.fileName, job.format, job.loadDetail ? 0 : m_detailMipCount, 69, true);
+            } catch (...) {
+                job.loadedImage = nullptr;
+                job.error = std::current_exception();
+            }
+            if (!m_finishedJobs->push(std::move(job), stoken)) break;
+        }
+    });
+}
+
+VulTextureResidency::~VulTextureResidency()
+{
+    m_workers.clear();
+}
+
+std::vector<uint32_t> VulTextureResidency::registerTextures(const std::vector<std::shared_ptr<VulImage>> &images, bool isFullyLoaded)
+{
+    for (const std::shared_ptr<VulImage> &image : images) {
+        if (VulTextureRegistry::contains(image.get())) throw std::runtime_error("Texture " + image->name +
+                " is shared through VulTextureRegistry, and streaming it would leave its other users with a destroyed image view");
+    }
+
+    std::vector<uint32_t> textureIndices;
+    textureIndices.reserve(images.size());
+    for (const std::shared_ptr<VulImage> &image : images) {
+        const auto existing = m_textureIndices.find(image.get());
+        if (existing != m_textureIndices.end()) {
+            textureIndices.push_back(existing->second);
+            continue;
+        }
+
+        Texture texture;
+        texture.image = image;
+        texture.format = getKtxCompressionFormat(image->getFormat());
+        const uint32_t mipCount = image->getMipCount();
+        const uint32_t layerCount = image->getArrayCount();
+        const uint32_t bitsPerTexel = image->getBitsPerTexel();
+        if (isFullyLoaded) {
+            texture.fullBytes = calculateImageBytes(image->getBaseWidth(), image->getBaseHeight(), image->getBaseDepth(), mipCount, layerCount, bitsPerTexel);
+            texture.baselineBytes = mipCount > m_detailMipCount ? calculateImageBytes(image->getBaseWidth() >> m_detailMipCount,
+                    image->getBaseHeight() >> m_detailMipCount, image->getBaseDepth(), mipCount - m_detailMipCount, layerCount, bitsPerTexel) : texture.fullBytes;
+        } else {
+            texture.baselineBytes = calculateImageBytes(image->getBaseWidth(), image->getBaseHeight(), image->getBaseDepth(), mipCount, layerCount, bitsPerTexel);
+            texture.fullBytes = calculateImageBytes(image->getBaseWidth() << m_detailMipCount, image->getBaseHeight() << m_detailMipCount,
+                    image->getBaseDepth(), mipCount + m_detailMipCount, layerCount, bitsPerTexel);
+        }
+        texture.hasDetail = isFullyLoaded;
+        texture.wantsDetail = isFullyLoaded;
+        m_committedBytes += isFullyLoaded ? texture.fullBytes : texture.baselineBytes;
+
+        const uint32_t textureIdx = m_textures.size();
+        m_textures.push_back(texture);
+        m_textureIndices[image.get()] = textureIdx;
+        textureIndices.push_back(textureIdx);
+    }
+    return textureIndices;
+}
+
+void VulTextureResidency::markUsed(uint32_t textureIdx, uint64_t frame)
+{
+    m_textures[textureIdx].lastUsedFrame = std::max(m_textures[textureIdx].lastUsedFrame, frame);
+}
+
+std::vector<uint32_t> VulTextureResidency::update(uint64_t frame, VkCommandBuffer cmdBuf)
+{
+    VUL_PROFILE_FUNC()
+
+    // The caller updates the descriptors right after the update that replaced an image, so once every frame that was in
+    // flight back then has finished nothing can reference the old image anymore. The uploads were recorded into that
+    // frame too, so the same goes for their staging buffers
+    while (!m_retiredImages.empty() && m_retiredImages.front().frame + VulSwapChain::MAX_FRAMES_IN_FLIGHT < frame) m_retiredImages.pop_front();
+
+    std::vector<uint32_t> changedTextures;
+    std::vector<Job> finishedJobs;
+    m_finishedJobs->tryPopAll(finishedJobs);
+    std::exception_ptr error;
+    for (Job &job : finishedJobs) {
+        Texture &texture = m_textures[job.textureIdx];
+        texture.isPending = false;
+        m_pendingJobCount--;
+        if (job.error) {
+            m_committedBytes -= texture.wantsDetail ? texture.fullBytes : texture.baselineBytes;
+            texture.wantsDetail = texture.hasDetail;
+            m_committedBytes += texture.wantsDetail ? texture.fullBytes : texture.baselineBytes;
+            if (!error) error = job.error;
+            continue;
+        }
+
+        texture.image->takeLoadedData(std::move(*job.loadedImage));
+        RetiredImage &retiredImage = m_retiredImages.emplace_back();
+        retiredImage.frame = frame;
+        retiredImage.oldVkImageStuff = texture.image->createCustomImage(VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT, cmdBuf);
+        retiredImage.stagingBuffer = texture.image->releaseStagingResources();
+        texture.image->deleteCpuData();
+        texture.hasDetail = job.loadDetail;
+        changedTextures.push_back(job.textureIdx);
+    }
+    if (error) std::rethrow_exception(error);
+
+    // Cold textures are evicted least recently used first until everything fits in the budget again
+    if (m_committedBytes > m_vramBudget) {
+        std::vector<uint32_t> evictionCandidates;
+        for (uint32_t i = 0; i < m_textures.size(); i++) {
+            const Texture &texture = m_textures[i];
+            if (texture.wantsDetail && !texture.isPending && texture.fullBytes > texture.baselineBytes && !isHot(texture, frame))
+                evictionCandidates.push_back(i);
+        }
+        std::sort(evictionCandidates.begin(), evictionCandidates.end(), [this](uint32_t a, uint32_t b)
+                {return m_textures[a].lastUsedFrame < m_textures[b].lastUsedFrame;});
+        for (uint32_t textureIdx : evictionCandidates) {
+            if (m_committedBytes <= m_vramBudget || m_pendingJobCount >= MAX_PENDING_JOBS) break;
+            startJob(textureIdx, false);
+        }
+    }
+
+    // Hot textures get their detail streamed in most recently used first for as long as they fit
+    std::vector<uint32_t> streamingCandidates;
+    for (uint32_t i = 0; i < m_textures.size(); i++) {
+        const Texture &texture = m_textures[i];
+        if (!texture.wantsDetail && !texture.isPending && texture.fullBytes > texture.baselineBytes && isHot(texture, frame))
+            streamingCandidates.push_back(i);
+    }
+    std::sort(streamingCandidates.begin(), streamingCandidates.end(), [this](uint32_t a, uint32_t b)
+            {return m_textures[a].lastUsedFrame > m_textures[b].lastUsedFrame;});
+    for (uint32_t textureIdx : streamingCandidates) {
+        if (m_pendingJobCount >= MAX_PENDING_JOBS) break;
+        const Texture &texture = m_textures[textureIdx];
+        if (m_committedBytes + texture.fullBytes - texture.baselineBytes > m_vramBudget) continue;
+        startJob(textureIdx, true);
+    }
+
+    return changedTextures;
+}
+
+uint64_t VulTextureResidency::calculateImageBytes(uint32_t width, uint32_t height, uint32_t depth, uint32_t mipCount, uint32_t layerCount, uint32_t bitsPerTexel)
+{
+    // Formats under 16 bits per texel are the block compressed ones, and they're stored in 4x4 blocks
+    const uint32_t sideAlignment = bitsPerTexel < 16 ? 4 : 1;
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < mipCount; i++) {
+        const uint64_t mipWidth = std::max(width >> i, 1u);
+        const uint64_t mipHeight = std::max(height >> i, 1u);
+        const uint64_t mipDepth = std::max(depth >> i, 1u);
+        bytes += (mipWidth + sideAlignment - 1) / sideAlignment * sideAlignment * ((mipHeight + sideAlignment - 1) / sideAlignment * sideAlignment)
+            * mipDepth * bitsPerTexel / 8 * layerCount;
+    }
+    return bytes;
+}
+
+bool VulTextureResidency::isHot(const Texture &texture, uint64_t frame) const
+{
+    return texture.lastUsedFrame + hotFrameCount >= frame && texture.lastUsedFrame > 0;
+}
+
+void VulTextureResidency::startJob(uint32_t textureIdx, bool loadDetail)
+{
+    Texture &texture = m_textures[textureIdx];
+    m_committedBytes -= texture.wantsDetail ? texture.fullBytes : texture.baselineBytes;
+    texture.wantsDetail = loadDetail;
+    m_committedBytes += texture.wantsDetail ? texture.fullBytes : texture.baselineBytes;
+    texture.isPending = true;
+    m_pendingJobCount++;
+
+    Job job;
+    job.textureIdx = textureIdx;
+    job.loadDetail = loadDetail;
+    job.fileName = texture.image->name;
+    job.format = texture.format;
+    m_jobQueue->push(std::move(job));
+}
+
+}
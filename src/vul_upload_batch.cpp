@@ -0,0 +1,196 @@
+#include <vul_upload_batch.hpp>
+#include <vul_debug_tools.hpp>
+#include <vul_staging_ring.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+namespace vul {
+
+VulUploadBatch::VulUploadBatch(const VulDevice &vulDevice) : m_vulDevice{vulDevice}
+{
+}
+
+void VulUploadBatch::writeBuffer(VulBuffer &buffer, const void *data, VkDeviceSize size, VkDeviceSize offset)
+{
+    if (data == nullptr || size == 0) return;
+    if (buffer.getBuffer() == nullptr) throw std::runtime_error("Tried to write to buffer before it was created");
+    if (size + offset > buffer.getBufferSize()) throw std::runtime_error("Size + offset of the written data must be at most equal to the size of the buffer");
+    if (buffer.getMemoryPropertyFlags() & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VkResult result = buffer.writeData(data, size, offset, VK_NULL_HANDLE);
+        if (result != VK_SUCCESS) throw std::runtime_error("Failed to write to host visible buffer. Error: " + std::to_string(result));
+        return;
+    }
+    if (!(buffer.getUsageFlags() & VK_BUFFER_USAGE_TRANSFER_DST_BIT)) throw std::runtime_error("Uploaded buffer needs transfer dst usage flag");
+
+    auto [it, inserted] = m_bufferDestinationIndices.try_emplace(&buffer, m_bufferDestinations.size());
+    if (inserted) m_bufferDestinations.push_back({&buffer, {}});
+    BufferDestination &destination = m_bufferDestinations[it->second];
+
+    // Writes bigger than the ring are split, so that every piece fits in a chunk
+    const VkDeviceSize maxPieceSize = m_vulDevice.getStagingRing().getSize();
+    for (VkDeviceSize pieceOffset = 0; pieceOffset < size; pieceOffset += maxPieceSize) {
+        VkBufferCopy region{};
+        region.dstOffset = offset + pieceOffset;
+        region.size = std::min(size - pieceOffset, maxPieceSize);
+        region.srcOffset = stage(static_cast<const uint8_t *>(data) + pieceOffset, region.size, false, it->second, destination.regions.size());
+        destination.regions.push_back(region);
+    }
+}
+
+void VulUploadBatch::appendBuffer(VulBuffer &buffer, const void *data, uint32_t elementCount, VkCommandBuffer cmdBuf)
+{
+    const VkDeviceSize oldSize = buffer.getBufferSize();
+    VkResult result = buffer.appendEmpty(elementCount, cmdBuf);
+    if (result != VK_SUCCESS) throw std::runtime_error("Failed to grow buffer for appending. Error: " + std::to_string(result));
+    writeBuffer(buffer, data, static_cast<VkDeviceSize>(buffer.getElementSize()) * elementCount, oldSize);
+}
+
+void VulUploadBatch::writeImage(VulImage &image, const ImageRegion &region, const void *data, VkDeviceSize size, VkImageLayout finalLayout)
+{
+    if (data == nullptr || size == 0) return;
+    if (!(image.getImageUsages() & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) throw std::runtime_error("Uploaded image needs transfer dst usage flag. Image: " + image.name);
+    const VkExtent3D mipSize = image.getMipSize(region.mipLevel);
+    if (region.offset.x < 0 || region.offset.y < 0 || region.offset.z < 0 ||
+            static_cast<uint32_t>(region.offset.x) + region.extent.width > mipSize.width ||
+            static_cast<uint32_t>(region.offset.y) + region.extent.height > mipSize.height ||
+            static_cast<uint32_t>(region.offset.z) + region.extent.depth > mipSize.depth)
+        throw std::runtime_error("Uploaded region must be inside the mip level of the image. Image: " + image.name);
+
+    auto [it, inserted] = m_imageDestinationIndices.try_emplace(&image, m_imageDestinations.size());
+    if (inserted) m_imageDestinations.push_back({&image, finalLayout, {}});
+    ImageDestination &destination = m_imageDestinations[it->second];
+    if (destination.finalLayout != finalLayout) throw std::runtime_error("Every upload to an image in a batch must ask for the same final layout. Image: " + image.name);
+
+    VkBufferImageCopy copy{};
+    copy.bufferOffset = stage(data, size, true, it->second, destination.regions.size());
+    copy.bufferRowLength = 0;
+    copy.bufferImageHeight = 0;
+    copy.imageSubresource.aspectMask = image.getAspect();
+    copy.imageSubresource.mipLevel = region.mipLevel;
+    copy.imageSubresource.baseArrayLayer = region.arrayLayer;
+    copy.imageSubresource.layerCount = 1;
+    copy.imageOffset = region.offset;
+    copy.imageExtent = region.extent;
+    destination.regions.push_back(copy);
+}
+
+void VulUploadBatch::record(VkCommandBuffer cmdBuf)
+{
+    recordChunks(cmdBuf, nullptr);
+}
+
+void VulUploadBatch::record(VkCommandBuffer &cmdBuf, VulCmdPool &cmdPool)
+{
+    recordChunks(cmdBuf, &cmdPool);
+}
+
+void VulUploadBatch::recordChunks(VkCommandBuffer &cmdBuf, VulCmdPool *cmdPool)
+{
+    VUL_PROFILE_FUNC()
+
+    if (isEmpty()) return;
+
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    imageBarriers.reserve(m_imageDestinations.size());
+    for (ImageDestination &destination : m_imageDestinations) {
+        imageBarriers.push_back(destination.image->makeLayoutTransitionBarrier(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT));
+    }
+    if (!imageBarriers.empty()) {
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    // Barriers cover everything before them in submission order, so the ones before and after all chunks are enough even when
+    // the chunks end up in different submits
+    const VkDeviceSize maxChunkSize = m_vulDevice.getStagingRing().getSize();
+    size_t firstWrite = 0;
+    while (firstWrite < m_writes.size()) {
+        const VkDeviceSize chunkStart = m_writes[firstWrite].stagingOffset;
+        size_t writeCount = 1;
+        while (firstWrite + writeCount < m_writes.size()) {
+            const Write &write = m_writes[firstWrite + writeCount];
+            if (write.stagingOffset + write.size - chunkStart > maxChunkSize) break;
+            writeCount++;
+        }
+        recordChunk(firstWrite, writeCount, cmdBuf);
+        firstWrite += writeCount;
+
+        if (cmdPool != nullptr && firstWrite < m_writes.size()) {
+            cmdPool->submit(cmdBuf, false);
+            cmdBuf = cmdPool->getPrimaryCommandBuffer();
+        }
+    }
+
+    imageBarriers.clear();
+    for (ImageDestination &destination : m_imageDestinations) {
+        imageBarriers.push_back(destination.image->makeLayoutTransitionBarrier(destination.finalLayout, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT));
+    }
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr,
+            static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+    m_writes.clear();
+    m_bufferDestinations.clear();
+    m_imageDestinations.clear();
+    m_bufferDestinationIndices.clear();
+    m_imageDestinationIndices.clear();
+    m_stagedBytes = 0;
+}
+
+void VulUploadBatch::recordChunk(size_t firstWrite, size_t writeCount, VkCommandBuffer cmdBuf)
+{
+    const Write &lastWrite = m_writes[firstWrite + writeCount - 1];
+    const VkDeviceSize chunkStart = m_writes[firstWrite].stagingOffset;
+    VulStagingRing::Allocation staging = m_vulDevice.getStagingRing().allocate(lastWrite.stagingOffset + lastWrite.size - chunkStart,
+            VulStagingRing::DEFAULT_ALIGNMENT, cmdBuf);
+    uint8_t *mapped = static_cast<uint8_t *>(staging.mapped);
+
+    // Regions are gathered per destination so that each one still gets a single copy command in the chunk
+    std::vector<std::vector<VkBufferCopy>> bufferRegions(m_bufferDestinations.size());
+    std::vector<std::vector<VkBufferImageCopy>> imageRegions(m_imageDestinations.size());
+    for (size_t i = firstWrite; i < firstWrite + writeCount; i++) {
+        const Write &write = m_writes[i];
+        const VkDeviceSize srcOffset = staging.offset + write.stagingOffset - chunkStart;
+        memcpy(mapped + write.stagingOffset - chunkStart, write.data, write.size);
+        if (write.toImage) {
+            VkBufferImageCopy region = m_imageDestinations[write.destinationIndex].regions[write.regionIndex];
+            region.bufferOffset = srcOffset;
+            imageRegions[write.destinationIndex].push_back(region);
+        } else {
+            VkBufferCopy region = m_bufferDestinations[write.destinationIndex].regions[write.regionIndex];
+            region.srcOffset = srcOffset;
+            bufferRegions[write.destinationIndex].push_back(region);
+        }
+    }
+
+    for (size_t i = 0; i < bufferRegions.size(); i++) {
+        if (bufferRegions[i].empty()) continue;
+        vkCmdCopyBuffer(cmdBuf, staging.buffer, m_bufferDestinations[i].buffer->getBuffer(), static_cast<uint32_t>(bufferRegions[i].size()),
+                bufferRegions[i].data());
+    }
+    for (size_t i = 0; i < imageRegions.size(); i++) {
+        if (imageRegions[i].empty()) continue;
+        vkCmdCopyBufferToImage(cmdBuf, staging.buffer, m_imageDestinations[i].image->getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(imageRegions[i].size()), imageRegions[i].data());
+    }
+}
+
+VkDeviceSize VulUploadBatch::stage(const void *data, VkDeviceSize size, bool toImage, size_t destinationIndex, size_t regionIndex)
+{
+    const VkDeviceSize alignment = VulStagingRing::DEFAULT_ALIGNMENT;
+    const VkDeviceSize stagingOffset = (m_stagedBytes + alignment - 1) / alignment * alignment;
+    m_writes.push_back({data, size, stagingOffset, toImage, destinationIndex, regionIndex});
+    m_stagedBytes = stagingOffset + size;
+    return stagingOffset;
+}
+
+}
@@ -0,0 +1,433 @@
+#include <vul_virtual_texture.hpp>
+#include <vul_debug_tools.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+namespace vul {
+
+VulVirtualTexture::VulVirtualTexture(const std::string &tileDirectory, VulImage::KtxCompressionFormat compressionFormat, uint32_t width,
+        uint32_t height, uint32_t layerCount, uint32_t physicalPageCount, uint32_t threadCount, const VulDevice &vulDevice,
+        VulCmdPool &cmdPool) : m_tileDirectory{tileDirectory}, m_compressionFormat{compressionFormat}, m_vulDevice{vulDevice}
+{
+    m_image = std::make_unique<VulImage>(vulDevice);
+    m_image->name = tileDirectory;
+    const uint32_t mipCount = static_cast<uint32_t>(std::log2(std::max(width, height))) + 1;
+    m_image->keepEmptyWithoutData(width, height, 1, mipCount, layerCount, VulImage::getKtxVkFormat(compressionFormat));
+    VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
+    m_image->createCustomImageSparse(VK_IMAGE_VIEW_TYPE_2D_ARRAY, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT
+            | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT, cmdBuf);
+    cmdPool.submit(cmdBuf, true);
+
+    m_pageExtent = m_image->getSparseBlockExtent();
+    m_pagedMipCount = std::min(m_image->getSparseMipTailFirstLod(), m_image->getMipCount());
+    if (m_pagedMipCount == 0) throw std::runtime_error("Virtual texture " + tileDirectory + " is too small to have any pages outside of the mip tail");
+
+    uint64_t pageCount = 0;
+    m_mips.resize(m_pagedMipCount);
+    for (uint32_t i = 0; i < m_pagedMipCount; i++) {
+        const VkExtent3D mipSize = m_image->getMipSize(i);
+        m_mips[i].pageOffset = pageCount;
+        m_mips[i].pageCountX = (mipSize.width + m_pageExtent.width - 1) / m_pageExtent.width;
+        m_mips[i].pageCountY = (mipSize.height + m_pageExtent.height - 1) / m_pageExtent.height;
+        pageCount += static_cast<uint64_t>(m_mips[i].pageCountX) * m_mips[i].pageCountY * layerCount;
+        if (pageCount > UINT32_MAX) throw std::runtime_error("Virtual texture " + tileDirectory + " has more pages than fit in 32 bit indices");
+    }
+    m_pageCount = pageCount;
+
+    // The physical pool is the first sparse memory and the mip tails are in the second one
+    const uint32_t mipTailBlockCount = m_image->getSparseMipTailBlockCount();
+    if (mipTailBlockCount > 0) m_image->allocateSparseMemory({physicalPageCount, mipTailBlockCount});
+    else m_image->allocateSparseMemory({physicalPageCount});
+    m_physicalPages.resize(physicalPageCount);
+    m_freePhysicalPages.resize(physicalPageCount);
+    for (uint32_t i = 0; i < physicalPageCount; i++) m_freePhysicalPages[i] = physicalPageCount - i - 1;
+
+    for (std::unique_ptr<VulBuffer> &feedbackBuffer : m_feedbackBuffers) {
+        feedbackBuffer = std::make_unique<VulBuffer>(sizeof(uint32_t), FEEDBACK_CAPACITY + 1, false, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, vulDevice);
+        VkResult result = feedbackBuffer->mapAll();
+        if (result != VK_SUCCESS) throw std::runtime_error("Failed to map feedback buffer of virtual texture " + tileDirectory + ". Error: " + std::to_string(result));
+        memset(feedbackBuffer->getMappedMemory(), 0, feedbackBuffer->getBufferSize());
+        VUL_NAME_VK(feedbackBuffer->getBuffer())
+    }
+
+    // Padded to whole uints, since that's what shaders read it as
+    const size_t minLodMapSize = static_cast<size_t>(m_mips[0].pageCountX) * m_mips[0].pageCountY * layerCount;
+    m_minLodMap.assign((minLodMapSize + 3) / 4 * 4, m_pagedMipCount);
+    m_minLodMapBuffer = std::make_unique<VulBuffer>(sizeof(uint32_t), m_minLodMap.size() / 4, true, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulDevice);
+    VUL_NAME_VK(m_minLodMapBuffer->getBuffer())
+    m_minLodMapDirtyBegin = 0;
+    m_minLodMapDirtyEnd = m_minLodMap.size();
+
+    loadMipTail(threadCount, cmdPool);
+
+    for (VkSemaphore &semaphore : m_bindSemaphores) {
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VkResult result = vkCreateSemaphore(vulDevice.device(), &semaphoreInfo, nullptr, &semaphore);
+        if (result != VK_SUCCESS) throw std::runtime_error("Failed to create bind semaphore of virtual texture " + tileDirectory + ". Error: " + std::to_string(result));
+    }
+
+    m_jobQueue = std::make_unique<VulCompletionQueue<Job>>(MAX_PENDING_JOBS);
+    m_finishedJobs = std::make_unique<VulCompletionQueue<Job>>(MAX_PENDING_JOBS);
+    m_workers.resize(std::max(threadCount, 1u));
+    for (std::jthread &worker : m_workers) worker = std::jthread([this](std::stop_token stoken) {
+        Job job;
+        while (m_jobQueue->pop(job, stoken)) {
+            try {
+                job.tile = std::make_unique<VulImage>(m_vulDevice);
+                job.tile->loadCompressedKtxFromFile(getTileFileName(job.page), m_compressionFormat, 0, 1);
+            } catch (...) {
+                job.error = std::current_exception();
+            }
+            if (!m_finishedJobs->push(std::move(job), stoken)) break;
+        }
+    });
+}
+
+VulVirtualTexture::~VulVirtualTexture()
+{
+    m_workers.clear();
+    for (VkSemaphore semaphore : m_bindSemaphores) vkDestroySemaphore(m_vulDevice.device(), semaphore, nullptr);
+}
+
+void VulVirtualTexture::update(uint32_t frameIndex, uint64_t frame, VulCmdPool &cmdPool)
+{
+    VUL_PROFILE_FUNC()
+
+    requestPages(frameIndex, frame);
+    uploadFinishedPages(frameIndex, frame, cmdPool);
+}
+
+void VulVirtualTexture::recordFeedbackBarrier(VkCommandBuffer cmdBuf, uint32_t frameIndex) const
+{
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_feedbackBuffers[frameIndex]->getBuffer();
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void VulVirtualTexture::loadMipTail(uint32_t threadCount, VulCmdPool &cmdPool)
+{
+    VUL_PROFILE_FUNC()
+
+    m_image->bindSparseMipTail(1, 0);
+
+    std::vector<Page> pages;
+    for (uint32_t layer = 0; layer < m_image->getArrayCount(); layer++) {
+        for (uint32_t mip = m_pagedMipCount; mip < m_image->getMipCount(); mip++) pages.push_back({layer, mip, 0, 0});
+    }
+    std::vector<std::unique_ptr<VulImage>> tiles(pages.size());
+    std::atomic_uint32_t tileIdx = 0;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto loadTiles = [&]() {
+        for (uint32_t i = tileIdx++; i < pages.size(); i = tileIdx++) {
+            try {
+                tiles[i] = std::make_unique<VulImage>(m_vulDevice);
+                tiles[i]->loadCompressedKtxFromFile(getTileFileName(pages[i]), m_compressionFormat, 0, 1);
+            } catch (...) {
+                std::scoped_lock lock(errorMutex);
+                if (!error) error = std::current_exception();
+            }
+        }
+    };
+    {
+        std::vector<std::jthread> threads(std::max(threadCount, 1u));
+        for (size_t i = 0; i < threads.size(); i++) threads[i] = std::jthread(loadTiles);
+    }
+    if (error) std::rethrow_exception(error);
+
+    std::vector<VulImage::DataSection> sections;
+    sections.reserve(pages.size());
+    for (size_t i = 0; i < pages.size(); i++) sections.push_back(getDataSection(pages[i], *tiles[i]));
+    VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
+    m_image->modifyImage(sections, cmdBuf);
+    uploadMinLodMap(cmdBuf);
+    cmdPool.submit(cmdBuf, true);
+    m_image->deleteStagingResources();
+}
+
+void VulVirtualTexture::requestPages(uint32_t frameIndex, uint64_t frame)
+{
+    // The fence of this frame has been waited on, so the gpu is done writing its feedback
+    uint32_t *feedback = static_cast<uint32_t *>(m_feedbackBuffers[frameIndex]->getMappedMemory());
+    const uint32_t feedbackCount = std::min(feedback[0], FEEDBACK_CAPACITY);
+    std::unordered_set<uint32_t> wantedPageIndices;
+    for (uint32_t i = 0; i < feedbackCount; i++) {
+        const uint32_t pageIdx = feedback[i + 1];
+        if (pageIdx >= m_pageCount) continue;
+        const auto resident = m_residentPages.find(pageIdx);
+        if (resident != m_residentPages.end()) {
+            m_physicalPages[resident->second].lastUsedFrame = frame;
+            continue;
+        }
+
+        // Pages are only made resident after the page above them, so the request goes to the coarsest missing page. The
+        // page above it is what gets sampled in the meantime, so it counts as used
+        Page page = getPage(pageIdx);
+        while (!isResident({page.layer, page.mip + 1, page.x / 2, page.y / 2})) page = {page.layer, page.mip + 1, page.x / 2, page.y / 2};
+        if (page.mip + 1 < m_pagedMipCount)
+            m_physicalPages[m_residentPages[getPageIdx({page.layer, page.mip + 1, page.x / 2, page.y / 2})]].lastUsedFrame = frame;
+        if (!isPending(page)) wantedPageIndices.insert(getPageIdx(page));
+    }
+    feedback[0] = 0;
+
+    // Coarse pages first, since they cover the most screen and finer pages can't be made resident before them
+    std::vector<Page> wantedPages;
+    wantedPages.reserve(wantedPageIndices.size());
+    for (uint32_t pageIdx : wantedPageIndices) wantedPages.push_back(getPage(pageIdx));
+    std::sort(wantedPages.begin(), wantedPages.end(), [](const Page &a, const Page &b) {return a.mip > b.mip;});
+    for (const Page &page : wantedPages) {
+        if (m_pendingPages.size() >= MAX_PENDING_JOBS) break;
+        const uint32_t pageIdx = getPageIdx(page);
+        m_pendingPages.insert(pageIdx);
+
+        Job job;
+        job.pageIdx = pageIdx;
+        job.page = page;
+        m_jobQueue->push(std::move(job));
+    }
+}
+
+void VulVirtualTexture::uploadFinishedPages(uint32_t frameIndex, uint64_t frame, VulCmdPool &cmdPool)
+{
+    // The fence of this frame has been waited on, which also covers the upload submitted before it last time
+    m_uploadStagingBuffers[frameIndex].reset();
+
+    // Evicted pages can be sampled by the frames that were recorded before the eviction, so their physical pages are only
+    // unbound and reused once all of those are done
+    std::vector<VulImage::SparseBindInfo> bindInfos;
+    for (size_t i = 0; i < m_retiringPages.size();) {
+        const RetiringPage &retiring = m_retiringPages[i];
+        if (retiring.evictedFrame + VulSwapChain::MAX_FRAMES_IN_FLIGHT > frame) {
+            i++;
+            continue;
+        }
+        bindInfos.push_back(getBindInfo(getPage(retiring.pageIdx), retiring.physicalIdx, true));
+        m_freePhysicalPages.push_back(retiring.physicalIdx);
+        m_retiringPages[i] = m_retiringPages.back();
+        m_retiringPages.pop_back();
+    }
+
+    std::vector<Job> finishedJobs = std::move(m_waitingJobs);
+    m_waitingJobs.clear();
+    m_finishedJobs->tryPopAll(finishedJobs);
+
+    std::exception_ptr error;
+    std::vector<VulImage::DataSection> sections;
+    for (Job &job : finishedJobs) {
+        // The page stays pending until it has a physical page, so that the page above it can't be evicted to make room for it
+        VulImage::DataSection section{};
+        if (!job.error) {
+            try {
+                section = getDataSection(job.page, *job.tile);
+            } catch (...) {
+                job.error = std::current_exception();
+            }
+        }
+        if (job.error) {
+            if (!error) error = job.error;
+            m_pendingPages.erase(job.pageIdx);
+            continue;
+        }
+        if (m_freePhysicalPages.size() == 0) {
+            m_waitingJobs.push_back(std::move(job));
+            continue;
+        }
+
+        const uint32_t physicalIdx = m_freePhysicalPages.back();
+        m_freePhysicalPages.pop_back();
+        m_physicalPages[physicalIdx] = {job.pageIdx, frame};
+        m_residentPages[job.pageIdx] = physicalIdx;
+        m_pendingPages.erase(job.pageIdx);
+        bindInfos.push_back(getBindInfo(job.page, physicalIdx, false));
+        sections.push_back(section);
+        updateMinLodMap(job.page);
+    }
+
+    // Pages that are already being retired will make room for the waiting ones, and the rest evict something now
+    if (m_waitingJobs.size() > m_retiringPages.size()) evictPages(m_waitingJobs.size() - m_retiringPages.size(), frame);
+    while (m_waitingJobs.size() > m_retiringPages.size()) {
+        // Everything in the pool is in use, so the page gets requested again once something isn't
+        m_pendingPages.erase(m_waitingJobs.back().pageIdx);
+        m_waitingJobs.pop_back();
+    }
+
+    // All binds of the frame go in one batch, which the upload waits for on the gpu instead of the cpu waiting for the queue
+    VkSemaphore bindSemaphore = VK_NULL_HANDLE;
+    if (bindInfos.size() > 0) {
+        bindSemaphore = m_bindSemaphores[frameIndex];
+        m_image->bindSparseMemory(bindInfos, bindSemaphore);
+    }
+    if (sections.size() > 0 || bindSemaphore != VK_NULL_HANDLE || m_minLodMapDirtyBegin < m_minLodMapDirtyEnd) {
+        VkCommandBuffer cmdBuf = cmdPool.getPrimaryCommandBuffer();
+        // The frames in flight may still be reading the min lod map and the image, which mustn't be written under them
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+        m_image->modifyImage(sections, cmdBuf);
+        uploadMinLodMap(cmdBuf);
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        cmdPool.submitAndSynchronize(cmdBuf, bindSemaphore, false, false);
+        m_uploadStagingBuffers[frameIndex] = m_image->releaseStagingResources();
+    }
+
+    if (error) std::rethrow_exception(error);
+}
+
+void VulVirtualTexture::evictPages(size_t count, uint64_t frame)
+{
+    // Only pages that weren't used this frame and that have nothing resident below them can be evicted, least recently used
+    // first. Evicting a page can't give another candidate children, so checking them once up front is enough
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < m_physicalPages.size(); i++) {
+        const PhysicalPage &physicalPage = m_physicalPages[i];
+        if (physicalPage.pageIdx != UINT32_MAX && physicalPage.lastUsedFrame < frame && !hasResidentOrPendingChildren(getPage(physicalPage.pageIdx)))
+            candidates.push_back(i);
+    }
+    count = std::min(count, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), [this](uint32_t a, uint32_t b)
+            {return m_physicalPages[a].lastUsedFrame < m_physicalPages[b].lastUsedFrame;});
+
+    for (size_t i = 0; i < count; i++) {
+        PhysicalPage &physicalPage = m_physicalPages[candidates[i]];
+        m_residentPages.erase(physicalPage.pageIdx);
+        m_retiringPages.push_back({candidates[i], physicalPage.pageIdx, frame});
+        updateMinLodMap(getPage(physicalPage.pageIdx));
+        physicalPage.pageIdx = UINT32_MAX;
+    }
+}
+
+void VulVirtualTexture::updateMinLodMap(const Page &page)
+{
+    const uint32_t pageCountX = m_mips[0].pageCountX;
+    const uint32_t pageCountY = m_mips[0].pageCountY;
+    const uint32_t beginX = page.x << page.mip;
+    const uint32_t beginY = page.y << page.mip;
+    const uint32_t endX = std::min((page.x + 1) << page.mip, pageCountX);
+    const uint32_t endY = std::min((page.y + 1) << page.mip, pageCountY);
+    const bool resident = isResident(page);
+    for (uint32_t y = beginY; y < endY; y++) {
+        for (uint32_t x = beginX; x < endX; x++) {
+            uint8_t &minLod = m_minLodMap[(static_cast<size_t>(page.layer) * pageCountY + y) * pageCountX + x];
+            if (resident) minLod = std::min(minLod, static_cast<uint8_t>(page.mip));
+            else if (minLod == page.mip) {
+                uint32_t mip = page.mip + 1;
+                while (mip < m_pagedMipCount && !isResident({page.layer, mip, x >> mip, y >> mip})) mip++;
+                minLod = mip;
+            }
+        }
+    }
+    m_minLodMapDirtyBegin = std::min(m_minLodMapDirtyBegin, (static_cast<size_t>(page.layer) * pageCountY + beginY) * pageCountX + beginX);
+    m_minLodMapDirtyEnd = std::max(m_minLodMapDirtyEnd, (static_cast<size_t>(page.layer) * pageCountY + endY - 1) * pageCountX + endX);
+}
+
+void VulVirtualTexture::uploadMinLodMap(VkCommandBuffer cmdBuf)
+{
+    if (m_minLodMapDirtyBegin >= m_minLodMapDirtyEnd) return;
+    const size_t begin = m_minLodMapDirtyBegin / 4 * 4;
+    const size_t end = (m_minLodMapDirtyEnd + 3) / 4 * 4;
+    VkResult result = m_minLodMapBuffer->writeData(&m_minLodMap[begin], end - begin, begin, cmdBuf);
+    if (result != VK_SUCCESS) throw std::runtime_error("Failed to upload min lod map of virtual texture " + m_tileDirectory + ". Error: " + std::to_string(result));
+    m_minLodMapDirtyBegin = SIZE_MAX;
+    m_minLodMapDirtyEnd = 0;
+}
+
+VulVirtualTexture::Page VulVirtualTexture::getPage(uint32_t pageIdx) const
+{
+    Page page;
+    page.mip = m_pagedMipCount - 1;
+    while (m_mips[page.mip].pageOffset > pageIdx) page.mip--;
+    const uint32_t pagesInLayer = m_mips[page.mip].pageCountX * m_mips[page.mip].pageCountY;
+    const uint32_t pageInMip = pageIdx - m_mips[page.mip].pageOffset;
+    page.layer = pageInMip / pagesInLayer;
+    page.y = pageInMip % pagesInLayer / m_mips[page.mip].pageCountX;
+    page.x = pageInMip % pagesInLayer % m_mips[page.mip].pageCountX;
+    return page;
+}
+
+std::string VulVirtualTexture::getTileFileName(const Page &page) const
+{
+    return m_tileDirectory + "/" + std::to_string(page.layer) + "_" + std::to_string(page.mip) + "_" + std::to_string(page.x) + "_"
+        + std::to_string(page.y) + ".ktx2";
+}
+
+VulImage::SparseBindInfo VulVirtualTexture::getBindInfo(const Page &page, uint32_t physicalIdx, bool unbind) const
+{
+    // Pages on the right and bottom edges only reach the edge of the mip
+    const VkExtent3D mipSize = m_image->getMipSize(page.mip);
+    VulImage::SparseBindInfo bindInfo{};
+    bindInfo.memoryIndex = 0;
+    bindInfo.blockOffset = physicalIdx;
+    bindInfo.imageRegionOffset = {static_cast<int32_t>(page.x * m_pageExtent.width), static_cast<int32_t>(page.y * m_pageExtent.height), 0};
+    bindInfo.imageRegionSize = {std::min(m_pageExtent.width, mipSize.width - page.x * m_pageExtent.width),
+        std::min(m_pageExtent.height, mipSize.height - page.y * m_pageExtent.height), 1};
+    bindInfo.arrayLayer = page.layer;
+    bindInfo.mipLevel = page.mip;
+    bindInfo.unbind = unbind;
+    return bindInfo;
+}
+
+VulImage::DataSection VulVirtualTexture::getDataSection(const Page &page, VulImage &tile) const
+{
+    // Mip tail mips are a single tile no matter their size
+    const VkExtent3D mipSize = m_image->getMipSize(page.mip);
+    VkExtent3D expectedSize = mipSize;
+    if (page.mip < m_pagedMipCount) expectedSize = getBindInfo(page, 0, false).imageRegionSize;
+    const VkExtent3D tileSize = tile.getMipSize(0);
+    if (tileSize.width != expectedSize.width || tileSize.height != expectedSize.height || tile.getFormat() != m_image->getFormat())
+        throw std::runtime_error("Tile " + getTileFileName(page) + " doesn't match the size or format of its page");
+
+    VulImage::DataSection section{};
+    section.data = tile.getCpuData(0, 0);
+    section.dataSize = tile.getMipLayerSize(0);
+    section.startingX = page.x * m_pageExtent.width;
+    section.startingY = page.y * m_pageExtent.height;
+    section.startingZ = 0;
+    section.width = tileSize.width;
+    section.height = tileSize.height;
+    section.depth = 1;
+    section.mipLevel = page.mip;
+    section.arrayLayer = page.layer;
+    return section;
+}
+
+bool VulVirtualTexture::isResident(const Page &page) const
+{
+    return page.mip >= m_pagedMipCount || m_residentPages.contains(getPageIdx(page));
+}
+
+bool VulVirtualTexture::isPending(const Page &page) const
+{
+    return m_pendingPages.contains(getPageIdx(page));
+}
+
+bool VulVirtualTexture::hasResidentOrPendingChildren(const Page &page) const
+{
+    if (page.mip == 0) return false;
+    const Mip &childMip = m_mips[page.mip - 1];
+    for (uint32_t y = page.y * 2; y < std::min(page.y * 2 + 2, childMip.pageCountY); y++) {
+        for (uint32_t x = page.x * 2; x < std::min(page.x * 2 + 2, childMip.pageCountX); x++) {
+            const Page child{page.layer, page.mip - 1, x, y};
+            if (isResident(child) || isPending(child)) return true;
+        }
+    }
+    return false;
+}
+
+}